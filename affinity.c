@@ -0,0 +1,162 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <numa.h>
+
+#include "affinity.h"
+
+#define CPULIST_ISSET(cpu, list) ((list)->cpus[(cpu) / 8] & (1 << (cpu) % 8))
+
+// AUX_CPUS are the CPUs of threads that don't take part in the measurement,
+// such as the control socket and locality scans. Empty when not configured.
+struct cpulist AUX_CPUS;
+
+// cpulist_parse parses a list of CPUs and CPU ranges such as "0-3,8". It
+// returns 0 on success and -1 on failure.
+int cpulist_parse(const char *arg, struct cpulist *list)
+{
+	const char *s = arg;
+	memset(list, 0, sizeof(*list));
+
+	while (*s != '\0') {
+		char *end;
+		long first = strtol(s, &end, 10), last = first;
+		if (end == s)
+			goto fail;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtol(s, &end, 10);
+			if (end == s)
+				goto fail;
+		}
+		if (first < 0 || last < first || last >= CPULIST_MAX)
+			goto fail;
+		for (long cpu = first; cpu <= last; cpu++) {
+			if (!CPULIST_ISSET(cpu, list))
+				list->count++;
+			list->cpus[cpu / 8] |= 1 << cpu % 8;
+		}
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			goto fail;
+		s = end;
+	}
+	if (list->count > 0)
+		return 0;
+
+fail:
+	printf("Invalid CPU list: %s.\n", arg);
+	return -1;
+}
+
+// cpulist_nth returns the n-th CPU of list, wrapping around when n is larger
+// than the number of CPUs, or -1 if the list is empty.
+int cpulist_nth(const struct cpulist *list, int n)
+{
+	if (list->count == 0)
+		return -1;
+
+	n %= list->count;
+	for (int cpu = 0; cpu < CPULIST_MAX; cpu++) {
+		if (CPULIST_ISSET(cpu, list) && n-- == 0)
+			return cpu;
+	}
+	return -1;
+}
+
+// pin_thread restricts thread to cpu. It returns 0 on success and -1 on
+// failure.
+int pin_thread(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (err) {
+		printf("Failed to pin thread to CPU %d: %s\n", cpu,
+		       strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+// pin_node_thread restricts thread to the CPUs of node. It returns 0 on
+// success and -1 on failure.
+int pin_node_thread(pthread_t thread, int node)
+{
+	if (numa_available() == -1)
+		return 0;
+
+	struct bitmask *cpus = numa_allocate_cpumask();
+	if (numa_node_to_cpus(node, cpus)) {
+		printf("Failed to find the CPUs of node %d.\n", node);
+		numa_free_cpumask(cpus);
+		return -1;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu = 0; cpu < cpus->size && cpu < CPU_SETSIZE; cpu++) {
+		if (numa_bitmask_isbitset(cpus, cpu))
+			CPU_SET(cpu, &set);
+	}
+	numa_free_cpumask(cpus);
+	int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (err) {
+		printf("Failed to pin thread to node %d: %s\n", node,
+		       strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+// pin_aux_thread restricts the calling thread to AUX_CPUS, if set.
+void pin_aux_thread()
+{
+	if (AUX_CPUS.count == 0)
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu = 0; cpu < CPULIST_MAX && cpu < CPU_SETSIZE; cpu++) {
+		if (CPULIST_ISSET(cpu, &AUX_CPUS))
+			CPU_SET(cpu, &set);
+	}
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err)
+		printf("WARN: Failed to pin auxiliary thread: %s\n",
+		       strerror(err));
+}
+
+// set_fifo switches thread to the SCHED_FIFO policy with the given priority.
+// It returns 0 on success and -1 on failure.
+int set_fifo(pthread_t thread, int priority)
+{
+	struct sched_param param = { .sched_priority = priority };
+	int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+	if (err) {
+		printf("Failed to use SCHED_FIFO priority %d: %s\n", priority,
+		       strerror(err));
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+#define CPULIST_MAX 1024
+
+// cpulist is a set of CPUs given on the command line, such as "0-3,8".
+struct cpulist {
+	int count;
+	unsigned char cpus[CPULIST_MAX / 8];
+};
+
+extern struct cpulist AUX_CPUS;
+
+int cpulist_parse(const char *arg, struct cpulist *list);
+int cpulist_nth(const struct cpulist *list, int n);
+int pin_thread(pthread_t thread, int cpu);
+int pin_node_thread(pthread_t thread, int node);
+void pin_aux_thread(void);
+int set_fifo(pthread_t thread, int priority);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "affinity.h"
+#include "async.h"
+
+// The async pool keeps up to ASYNC_DEPTH memory operations outstanding. They
+// wait in a ring buffer until one of the pool threads runs them, so with
+// fewer threads than operations their latency includes queuing.
+static struct mem_request *QUEUE;
+static int QUEUE_HEAD;
+static int QUEUE_LEN;
+static int DEPTH;
+// OUTSTANDING counts queued and running operations.
+static int OUTSTANDING;
+static void (*RUN)(struct mem_request *);
+
+static pthread_t *ASYNC_TIDS;
+static int ASYNC_THREADS;
+static pthread_mutex_t ASYNC_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ASYNC_COND = PTHREAD_COND_INITIALIZER;
+static bool ASYNC_STOP = false;
+
+// async_parse parses an async pool of the form <depth>[,threads=<n>], with one
+// thread per operation by default. It returns 0 on success and -1 on failure.
+int async_parse(const char *arg, int *depth, int *threads)
+{
+	char *end;
+	*depth = strtol(arg, &end, 10);
+	*threads = *depth;
+	if (!strncmp(end, ",threads=", 9))
+		*threads = strtol(end + 9, &end, 10);
+	if (*end != '\0' || *depth < 1 || *depth > ASYNC_MAX_DEPTH ||
+	    *threads < 1 || *threads > *depth) {
+		printf("Invalid async pool: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// async_loop runs queued operations until the pool is stopped.
+static void *async_loop(void *arg)
+{
+	pthread_mutex_lock(&ASYNC_LOCK);
+	while (true) {
+		while (QUEUE_LEN == 0 && !ASYNC_STOP)
+			pthread_cond_wait(&ASYNC_COND, &ASYNC_LOCK);
+		if (ASYNC_STOP)
+			break;
+
+		struct mem_request req = QUEUE[QUEUE_HEAD];
+		QUEUE_HEAD = (QUEUE_HEAD + 1) % DEPTH;
+		QUEUE_LEN--;
+		pthread_mutex_unlock(&ASYNC_LOCK);
+		RUN(&req);
+		pthread_mutex_lock(&ASYNC_LOCK);
+		OUTSTANDING--;
+	}
+	pthread_mutex_unlock(&ASYNC_LOCK);
+	return NULL;
+}
+
+// async_start starts threads to run up to depth outstanding operations with
+// run. The threads share the CPUs of node rather than the one the access
+// thread is pinned to, so outstanding operations really run concurrently. It
+// returns 0 on success and -1 on failure.
+int async_start(int depth, int threads, int node,
+		void (*run)(struct mem_request *))
+{
+	QUEUE = calloc(depth, sizeof(struct mem_request));
+	ASYNC_TIDS = calloc(threads, sizeof(pthread_t));
+	if (QUEUE == NULL || ASYNC_TIDS == NULL) {
+		printf("Failed to allocate the async pool.\n");
+		goto fail;
+	}
+	DEPTH = depth;
+	RUN = run;
+	QUEUE_HEAD = 0;
+	QUEUE_LEN = 0;
+	OUTSTANDING = 0;
+	ASYNC_STOP = false;
+
+	for (ASYNC_THREADS = 0; ASYNC_THREADS < threads; ASYNC_THREADS++) {
+		if (pthread_create(&ASYNC_TIDS[ASYNC_THREADS], NULL,
+				   async_loop, NULL)) {
+			printf("Failed to start async thread.\n");
+			async_stop();
+			return -1;
+		}
+		if (pin_node_thread(ASYNC_TIDS[ASYNC_THREADS], node)) {
+			ASYNC_THREADS++;
+			async_stop();
+			return -1;
+		}
+	}
+	return 0;
+
+fail:
+	free(QUEUE);
+	free(ASYNC_TIDS);
+	QUEUE = NULL;
+	ASYNC_TIDS = NULL;
+	return -1;
+}
+
+// async_available returns how many more operations can be submitted before
+// depth operations are outstanding.
+int async_available()
+{
+	pthread_mutex_lock(&ASYNC_LOCK);
+	int available = DEPTH - OUTSTANDING;
+	pthread_mutex_unlock(&ASYNC_LOCK);
+	return available;
+}
+
+// async_submit queues req to be run by a pool thread. The caller makes sure
+// fewer than depth operations are outstanding.
+void async_submit(const struct mem_request *req)
+{
+	pthread_mutex_lock(&ASYNC_LOCK);
+	QUEUE[(QUEUE_HEAD + QUEUE_LEN) % DEPTH] = *req;
+	QUEUE_LEN++;
+	OUTSTANDING++;
+	pthread_cond_signal(&ASYNC_COND);
+	pthread_mutex_unlock(&ASYNC_LOCK);
+}
+
+// async_stop waits for running operations and stops the pool, dropping the
+// operations that are still queued.
+void async_stop()
+{
+	if (ASYNC_TIDS == NULL)
+		return;
+
+	pthread_mutex_lock(&ASYNC_LOCK);
+	ASYNC_STOP = true;
+	pthread_cond_broadcast(&ASYNC_COND);
+	pthread_mutex_unlock(&ASYNC_LOCK);
+	for (int i = 0; i < ASYNC_THREADS; i++)
+		pthread_join(ASYNC_TIDS[i], NULL);
+
+	free(QUEUE);
+	free(ASYNC_TIDS);
+	QUEUE = NULL;
+	ASYNC_TIDS = NULL;
+	DEPTH = 0;
+	OUTSTANDING = 0;
+}
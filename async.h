@@ -0,0 +1,31 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "bench.h"
+
+#define ASYNC_MAX_DEPTH 1024
+
+int async_parse(const char *arg, int *depth, int *threads);
+int async_start(int depth, int threads, int node,
+		void (*run)(struct mem_request *));
+int async_available(void);
+void async_submit(const struct mem_request *req);
+void async_stop(void);
+
+#endif
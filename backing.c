@@ -0,0 +1,222 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "backing.h"
+
+#define FILL_CHUNK MB
+
+const char *PREFAULT_STRING[] = {
+	"none",
+	"populate",
+	"willneed",
+	"cold",
+};
+
+static int BACKING_FD = -1;
+
+// backing_parse parses a backing of the form anon or
+// file:<path>[,shared|,private][,populate|,willneed|,cold]. It returns 0 on
+// success and -1 on failure.
+int backing_parse(const char *arg, struct backing *b)
+{
+	memset(b, 0, sizeof(*b));
+	if (!strcmp(arg, "anon"))
+		return 0;
+	if (strncmp(arg, "file:", 5)) {
+		printf("Invalid backing: %s.\n", arg);
+		return -1;
+	}
+
+	b->file = true;
+	b->shared = true;
+	const char *path = arg + 5;
+	size_t len = strcspn(path, ",");
+	if (len == 0 || len >= BACKING_PATH_MAX) {
+		printf("Invalid backing file path: %s.\n", arg);
+		return -1;
+	}
+	memcpy(b->path, path, len);
+
+	const char *opt = path + len;
+	while (*opt == ',') {
+		opt++;
+		size_t n = strcspn(opt, ",");
+		if (n == 6 && !strncmp(opt, "shared", n)) {
+			b->shared = true;
+		} else if (n == 7 && !strncmp(opt, "private", n)) {
+			b->shared = false;
+		} else {
+			int i;
+			for (i = PREFAULT_POPULATE; i <= PREFAULT_COLD; i++) {
+				if (strlen(PREFAULT_STRING[i]) == n &&
+				    !strncmp(opt, PREFAULT_STRING[i], n))
+					break;
+			}
+			if (i > PREFAULT_COLD) {
+				printf("Invalid backing option: %.*s.\n",
+				       (int)n, opt);
+				return -1;
+			}
+			b->prefault = i;
+		}
+		opt += n;
+	}
+	return 0;
+}
+
+// fill_file writes random data to fd from offset up to size. It returns 0 on
+// success and -1 on failure.
+int fill_file(int fd, size_t offset, size_t size)
+{
+	int rand_fd = open("/dev/urandom", O_RDONLY);
+	char *buf = malloc(FILL_CHUNK);
+	int ret = -1;
+	if (rand_fd == -1 || buf == NULL) {
+		printf("Failed to open /dev/urandom: %s\n", strerror(errno));
+		goto free;
+	}
+
+	while (offset < size) {
+		size_t n = size - offset < FILL_CHUNK ? size - offset :
+							FILL_CHUNK;
+		if (read(rand_fd, buf, n) != n ||
+		    pwrite(fd, buf, n, offset) != n) {
+			printf("Failed to fill file: %s\n",
+			       strerror(errno));
+			goto free;
+		}
+		offset += n;
+	}
+	ret = fsync(fd);
+
+free:
+	if (rand_fd != -1)
+		close(rand_fd);
+	free(buf);
+	return ret;
+}
+
+// backing_map maps size bytes of memory as described by b. A backing file
+// shorter than size is extended and filled with random data, while the
+// contents of a long enough file are kept. It returns MAP_FAILED on failure.
+void *backing_map(const struct backing *b, size_t size)
+{
+	if (!b->file)
+		return mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	BACKING_FD = open(b->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (BACKING_FD == -1) {
+		printf("Failed to open backing file %s: %s\n", b->path,
+		       strerror(errno));
+		return MAP_FAILED;
+	}
+	struct stat st;
+	if (fstat(BACKING_FD, &st)) {
+		printf("Failed to stat backing file %s: %s\n", b->path,
+		       strerror(errno));
+		close(BACKING_FD);
+		BACKING_FD = -1;
+		return MAP_FAILED;
+	}
+	if (st.st_size < size) {
+		printf("Filling %s with %.3f GB of data...\n", b->path,
+		       (size - st.st_size) / (double)GB);
+		if (fill_file(BACKING_FD, st.st_size, size))
+			return MAP_FAILED;
+	}
+	if (b->prefault == PREFAULT_COLD &&
+	    posix_fadvise(BACKING_FD, 0, size, POSIX_FADV_DONTNEED))
+		printf("WARN: Failed to drop %s from the page cache.\n",
+		       b->path);
+
+	int flags = b->shared ? MAP_SHARED : MAP_PRIVATE;
+	if (b->prefault == PREFAULT_POPULATE)
+		flags |= MAP_POPULATE;
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags,
+			  BACKING_FD, 0);
+	if (data == MAP_FAILED) {
+		printf("Failed to map backing file %s: %s\n", b->path,
+		       strerror(errno));
+		return MAP_FAILED;
+	}
+	if (b->prefault == PREFAULT_WILLNEED &&
+	    madvise(data, size, MADV_WILLNEED))
+		printf("WARN: Failed to read ahead %s: %s\n", b->path,
+		       strerror(errno));
+	return data;
+}
+
+// backing_unmap unmaps data and closes the backing file, if any.
+void backing_unmap(void *data, size_t size)
+{
+	if (data != NULL && data != MAP_FAILED)
+		munmap(data, size);
+	if (BACKING_FD != -1) {
+		close(BACKING_FD);
+		BACKING_FD = -1;
+	}
+}
+
+// resident_pages returns how many of the pages overlapping [addr, addr + len)
+// are resident in memory, and stores the number of pages in pages.
+unsigned long resident_pages(void *addr, size_t len, unsigned long *pages)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = (unsigned long)addr / page * page;
+	unsigned long end = (unsigned long)addr + len;
+	*pages = (end - start + page - 1) / page;
+	if (len == 0) {
+		*pages = 0;
+		return 0;
+	}
+
+	unsigned char *vec = malloc(*pages);
+	if (vec == NULL || mincore((void *)start, end - start, vec)) {
+		free(vec);
+		*pages = 0;
+		return 0;
+	}
+	unsigned long resident = 0;
+	for (unsigned long i = 0; i < *pages; i++)
+		resident += vec[i] & 1;
+	free(vec);
+	return resident;
+}
+
+// resident_bytes returns the resident set size of the process, or 0 if it
+// can't be read.
+unsigned long resident_bytes()
+{
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL)
+		return 0;
+
+	unsigned long size, resident;
+	int n = fscanf(fp, "%lu %lu", &size, &resident);
+	fclose(fp);
+	return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
@@ -0,0 +1,56 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef BACKING_H
+#define BACKING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BACKING_PATH_MAX 4096
+
+// Prefault is how the pages of a file backed DATA are brought in before the
+// test starts.
+enum Prefault {
+	// PREFAULT_NONE leaves the page cache as it is.
+	PREFAULT_NONE,
+	// PREFAULT_POPULATE maps the file with MAP_POPULATE.
+	PREFAULT_POPULATE,
+	// PREFAULT_WILLNEED asks for read ahead with MADV_WILLNEED.
+	PREFAULT_WILLNEED,
+	// PREFAULT_COLD drops the file from the page cache.
+	PREFAULT_COLD,
+};
+
+extern const char *PREFAULT_STRING[];
+
+// backing describes the memory DATA lives in, either anonymous memory or a
+// memory mapped file.
+struct backing {
+	bool file;
+	bool shared;
+	enum Prefault prefault;
+	char path[BACKING_PATH_MAX];
+};
+
+int backing_parse(const char *arg, struct backing *b);
+void *backing_map(const struct backing *b, size_t size);
+void backing_unmap(void *data, size_t size);
+int fill_file(int fd, size_t offset, size_t size);
+unsigned long resident_pages(void *addr, size_t len, unsigned long *pages);
+unsigned long resident_bytes(void);
+
+#endif
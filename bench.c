@@ -14,8 +14,10 @@
 	limitations under the License.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -25,55 +27,82 @@
 #include <math.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <getopt.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <numa.h>
 
 #include "bench.h"
+#include "scenario.h"
+#include "timeline.h"
+#include "control.h"
+#include "output.h"
+#include "compare.h"
+#include "placement.h"
+#include "timing.h"
+#include "async.h"
+#include "workset.h"
+#include "pagemap.h"
 
 void *DATA;
 unsigned long DATA_SIZE;
+// ACCESS_OFFSET and ACCESS_SIZE are the part of DATA the worker accesses.
+unsigned long ACCESS_OFFSET;
+unsigned long ACCESS_SIZE;
+// FILE_BACKED is set when DATA is a memory mapped file, whose page cache
+// hits and misses are tracked.
+bool FILE_BACKED = false;
+// ASYNC_DEPTH is how many operations are kept outstanding in the async pool,
+// or 0 to run one operation per tick.
+int ASYNC_DEPTH = 0;
+// PAYLOAD_MIX is how often writes use each payload.
+struct payload_mix PAYLOAD_MIX;
+// MERGEABLE is whether part of DATA is merged by KSM.
+static bool MERGEABLE;
+// COW_TRACKED is whether writes are split by whether they take copy-on-write
+// faults.
+static bool COW_TRACKED;
+// SWAPPING is whether DATA is limited by a cgroup, so it may be swapped out.
+static bool SWAPPING;
+// LAZY_POPULATE is whether DATA isn't loaded eagerly, so faults taken by
+// operations count as population.
+static bool LAZY_POPULATE;
 
 unsigned long *SAMPLES;
 unsigned long *RESULTS;
 unsigned long *RATES;
+unsigned char *PHASE_IDS;
 unsigned long RESULTS_SIZE;
 unsigned long RESULTS_I = 0;
 pthread_mutex_t TICK_LOCK;
+pthread_mutex_t RECORD_LOCK = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t TICK;
+bool WORKER_READY = false;
 
 volatile sig_atomic_t PROCEED = 0;
 
-enum MemOp {
-	READ,
-	WRITE,
-};
+struct scenario SCENARIO;
+int CURRENT_PHASE = 0;
+unsigned long SEQ_OFFSET = 0;
+
+struct shared *SHARED;
+struct worker *WORKER;
+
+// CONTINUOUS runs the benchmark until it is told to stop, keeping only
+// histograms instead of every result.
+bool CONTINUOUS = false;
+unsigned long SUMMARY_INTERVAL_NS = 0;
+unsigned long NEXT_SUMMARY_NS = 0;
 
 static const char *MEM_OP_STRING[] = {
 	"Read",
 	"Write",
 };
 
-// stats are statistics values computed from sampled data.
-struct stats {
-	unsigned long min;
-	unsigned long max;
-	double avg;
-	double stdev;
-	double p99;
-	double p95;
-	double p90;
-};
-
-// benchmark_opts are the options used to customize a benchmark run.
-struct benchmark_opts {
-	int duration;
-	int data_size;
-	int forks;
-	long seed;
-	bool quick;
-	bool numa;
-	enum MemOp mem_op;
-	char *ready_file;
+static const char *MEM_OP_EVENT[] = {
+	"read",
+	"write",
 };
 
 // usage prints the usage message.
@@ -81,17 +110,98 @@ void usage()
 {
 	printf("Architect Memory Benchmark.\n\n"
 	       "Usage:\n"
-	       "  bech [-h] [-t <seconds>] [-d <gigabytes>] [-s <seed>] [-r <path>] [-f <number>] [-n] [-w] [-q]\n"
+	       "  bech [-h] [-t <seconds>] [-d <gigabytes>] [-s <seed>] [-r <path>] [-f <number>] [-c <path>] [-l <path>] [-u <path>] [-i <seconds>] [-n] [-w] [-q]\n"
+	       "       [--output json|csv] [--output-file <path>] [--placement <policy>]\n"
+	       "       [--locality <seconds>] [--relocalize <percent>]\n"
+	       "       [--cpus <list>] [--tick-cpus <list>] [--aux-cpus <list>] [--fifo <priority>] [--mlock]\n"
+	       "       [--clock monotonic|tsc] [--migration-check <seconds>]\n"
+	       "       [--backing anon|file:<path>[,shared|,private][,populate|,willneed|,cold]]\n"
+	       "       [--populate eager|lazy|populate-flag|none]\n"
+	       "       [--io <path>[,psync|,uring][,direct][,depth=<n>][,bs=<bytes>][,size=<megabytes>]]\n"
+	       "       [--async <depth>[,threads=<n>]]\n"
+	       "       [--churn <allocs/s>[,malloc|,arena|,mmap][,size=<min>-<max>][,lifetime=<ms>]]\n"
+	       "       [--working-set ramp|sawtooth|step[,min=<pct>][,max=<pct>][,period=<s>][,dontneed|,free|,munmap]]\n"
+	       "       [--verify all|<pct>[,threads=<n>]] [--fingerprint[=<threads>]]\n"
+	       "       [--payload zero|random|copy|counter|byte|sparse|<payload>:<weight>[,<payload>:<weight>...]]\n"
+	       "       [--sparse <n>[bytes|lines][,pages=<pct>]]\n"
+	       "       [--ksm <dup_pct>[,region=<pct>][,wait=<s>]]\n"
+	       "       [--cow <children>[,at=<s>][,every=<s>][,hold=<s>][,rate=<writes/s>]]\n"
+	       "       [--swap <pct>[,high][,cgroup=<path>]] [--cgroup-stats[=<ms>]]\n"
+	       "  bench compare [-h] [-t <percent>] [-a <alpha>] [-m <metric>] <base.json> <new.json>\n"
 	       "\nOptions:\n"
 	       "  -h  Display this help message.\n"
-	       "  -t  Time in seconds for how long the test should run [default: 10].\n"
+	       "  -t  Time in seconds for how long the test should run, 0 to run until stopped [default: 10].\n"
 	       "  -d  Amount of data in gigabytes to load into memory [default: 10].\n"
 	       "  -s  Seed for the random number generator [default: current timestamp].\n"
 	       "  -f  Number of processes to forks for memory access [default: 1].\n"
 	       "  -n  If set, distribute forked processes across NUMA nodes.\n"
 	       "  -r  Path used to indicate the benchmark is ready to run.\n"
 	       "  -w  Measure memory writes instead of reads.\n"
-	       "  -q  Quick mode, don't wait for SIGUSR1 before starting test.\n");
+	       "  -q  Quick mode, don't wait for SIGUSR1 before starting test.\n"
+	       "  -c  Path to a scenario file describing the phases to run.\n"
+	       "  -l  Path to write a CSV timeline of every memory operation.\n"
+	       "  -u  Path of a Unix domain socket to accept control commands on.\n"
+	       "  -i  Interval in seconds between rolling window summaries [default: 10 if -t 0].\n"
+	       "  --output       Write results as json or csv to stdout, moving the report to stderr.\n"
+	       "  --output-file  Path to write the --output results to instead of stdout.\n"
+	       "  --placement    NUMA placement of the data: bind[:<node>], interleave, partition or remote[:<node>] [default: bind:0].\n"
+	       "  --locality     Interval in seconds between scans of the NUMA nodes of the data, 0 to only scan at start and end.\n"
+	       "  --relocalize   Move data back to its node when more than this percentage of it is elsewhere.\n"
+	       "  --cpus         CPUs to pin the memory access thread of each worker to, such as 0-3,8.\n"
+	       "  --tick-cpus    CPUs to pin the tick thread of each worker to [default: any CPU of its node].\n"
+	       "  --aux-cpus     CPUs for the control socket and other auxiliary threads.\n"
+	       "  --fifo         Run workers with the SCHED_FIFO policy at this priority.\n"
+	       "  --mlock        Lock the result buffers in memory.\n"
+	       "  --clock        Clock used to time operations, tsc falls back to monotonic if unusable [default: monotonic].\n"
+	       "  --migration-check  Interval in seconds between checks for a host change, 0 to disable [default: 1].\n"
+	       "  --backing      Memory the data lives in, anonymous memory or a memory mapped file [default: anon].\n"
+	       "  --populate     How the data is brought into memory before the test [default: eager].\n"
+	       "  --io           File to read and write every tick next to memory access, with the same phases.\n"
+	       "  --async        Keep this many operations outstanding, run by a pool of threads [default: one per operation].\n"
+	       "  --churn        Allocate and free objects at this rate next to memory access.\n"
+	       "  --working-set  Grow and shrink the accessed data following a curve.\n"
+	       "  --verify       Checksum every page of the data and verify all or a percentage of it on SIGUSR2, the verify command or a migration.\n"
+	       "  --fingerprint  Print a tree hash of the data once it is ready and when SIGUSR1 is received [default: one thread per CPU].\n"
+	       "  --payload      What writes store, or a weighted mix of payloads [default: zero].\n"
+	       "  --sparse       Bytes or cache lines the sparse payload changes per page, in a percentage of pages [default: 8 bytes in all pages].\n"
+	       "  --ksm          Mark a percentage of the data mergeable with a percentage of duplicate pages, and time writes to merged pages [default: region=100, wait=0].\n"
+	       "  --cow          Fork children that write to the data of every worker, and split writes by whether they take copy-on-write faults [default: at=1, hold=5, rate=1000].\n"
+	       "  --swap         Run in a cgroup v2 whose memory.max, or memory.high, is a percentage of the data, and split operations by whether their pages were resident.\n"
+	       "  --cgroup-stats Add the pressure and memory use of the cgroup to every timeline row, sampled at this interval [default: 1000].\n");
+}
+
+// now_ns returns the current CLOCK_MONOTONIC time in nanoseconds.
+unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// window_record adds an operation time to the rolling window of w for the
+// given second since the start of the test.
+static void window_record(struct worker *w, unsigned long second,
+			  unsigned long v)
+{
+	int i = second % WINDOW_SLOTS;
+	if (w->window_second[i] != second || w->window[i].count == 0) {
+		hist_reset(&w->window[i]);
+		w->window_second[i] = second;
+	}
+	hist_record(&w->window[i], v);
+}
+
+// window_merge combines the operation times of w recorded during the last
+// completed seconds into res.
+void window_merge(const struct worker *w, int seconds, struct hist *res)
+{
+	unsigned long now = (now_ns() - SHARED->start_ns) / NSEC_PER_SEC;
+	for (int i = 0; i < WINDOW_SLOTS; i++) {
+		unsigned long second = w->window_second[i];
+		if (w->window[i].count > 0 && second < now &&
+		    now - second <= seconds)
+			hist_merge(res, &w->window[i]);
+	}
 }
 
 // load_mem reads DATA_SIZE bytes of random data into DATA.
@@ -117,14 +227,282 @@ unsigned long load_mem()
 	return loaded;
 }
 
-// access_mem reads or writes a random chunk of DATA and stores how much data
-// was used in SAMPLES and how long the operation took in RESULTS.
-static void *access_mem(void *arg)
+// plan_op picks the kind, offset and size of the next operation of phase_i
+// within the first limit bytes of the worker's data, as described by the
+// phase.
+static void plan_op(int phase_i, unsigned long limit, struct mem_request *req)
 {
-	enum MemOp *mem_op = (enum MemOp *)arg;
+	struct phase *phase = &SCENARIO.phases[phase_i];
+
+	unsigned long size;
+	if (phase->rate > 0)
+		size = phase->rate * phase->interval_ms / 1000;
+	else
+		size = rand() % phase->op_size;
+
+	unsigned long offset;
+	if (phase->pattern == SEQUENTIAL) {
+		offset = SEQ_OFFSET;
+	} else {
+		offset = rand();
+		offset = (offset << 12 | rand()) % (limit - 1);
+	}
+
+	// Adjust how much data to manipulate to make sure we stay within
+	// bounds.
+	if (offset >= limit)
+		offset %= limit;
+	if (offset + size > limit) {
+		size = limit - offset;
+	}
+	SEQ_OFFSET = (offset + size) % limit;
+
+	// Only draw from the RNG for mixed phases so single operation runs
+	// keep producing the same sequence for a given seed.
+	enum MemOp mem_op = phase->write_pct == 100 ? WRITE : READ;
+	if (phase->write_pct > 0 && phase->write_pct < 100)
+		mem_op = rand() % 100 < phase->write_pct ? WRITE : READ;
+
+	req->phase = phase_i;
+	req->mem_op = mem_op;
+	req->offset = offset + ACCESS_OFFSET;
+	req->size = size;
+	req->submit_ns = 0;
+	req->payload = PAYLOAD_ZERO;
+	req->source = req->offset;
+	req->seed = 0;
+	if (mem_op == READ)
+		return;
+
+	req->payload = payload_pick(&PAYLOAD_MIX);
+	if (req->payload == PAYLOAD_RANDOM || req->payload == PAYLOAD_SPARSE) {
+		req->seed = (unsigned long)rand() << 31 ^ rand();
+	} else if (req->payload == PAYLOAD_COPY) {
+		// Keep the offset within pages so whole pages are duplicated.
+		unsigned long page = sysconf(_SC_PAGESIZE);
+		unsigned long max = limit - size;
+		unsigned long source = ((unsigned long)rand() << 12 | rand()) %
+					       (max / page + 1) * page +
+				       offset % page;
+		if (source <= max)
+			req->source = source + ACCESS_OFFSET;
+	}
+}
+
+// run_op reads or writes a chunk of DATA as described by req and stores how
+// much data was used in SAMPLES and how long the operation took in RESULTS.
+// Operations submitted asynchronously also count the time they were queued
+// for.
+static void run_op(struct mem_request *req)
+{
+	struct phase *phase = &SCENARIO.phases[req->phase];
+	enum MemOp mem_op = req->mem_op;
+	unsigned long offset = req->offset;
+	unsigned long size = req->size;
+
+	// Keep the compiler from turning this into calloc, which leaves fresh
+	// pages untouched so they would fault while the operation is timed.
+	void *buf = malloc(size);
+	__asm__ volatile("" : : "r"(buf) : "memory");
+	memset(buf, 0, size);
+	if (mem_op == WRITE) {
+		if (req->payload == PAYLOAD_COPY)
+			populate_range(DATA, req->source, size);
+		payload_prepare(req->payload, buf, size, DATA + req->source,
+				req->seed);
+	}
+
+	// Read or write from DATA and track how long the operation takes, and
+	// whether the thread was descheduled meanwhile. CLOCK_MONOTONIC around
+	// the timer reads bounds the measurement in case the TSC jumps.
+	unsigned long pages = 0, hits = 0, merged = 0, shared = 0;
+	if (FILE_BACKED || SWAPPING)
+		hits = resident_pages(DATA + offset, size, &pages);
+	// Writing to merged pages breaks their sharing.
+	if (MERGEABLE && mem_op == WRITE)
+		merged = ksm_merged_pages(DATA + offset, size);
+	// Writing to pages shared with a forked process copies them.
+	if (COW_TRACKED && mem_op == WRITE)
+		shared = cow_shared_pages(DATA + offset, size);
+	// Pages being written can't be verified until their checksums are
+	// updated.
+	if (mem_op == WRITE)
+		verify_lock(offset, size);
+	struct rusage usage_before, usage_after;
+	getrusage(RUSAGE_THREAD, &usage_before);
+	unsigned long before_ns = now_ns();
+	unsigned long start = timer_read();
+	unsigned long filled = populate_range(DATA, offset, size);
+	unsigned long dirtied = 0, written = 0;
+	switch (mem_op) {
+	case READ:
+		memcpy(buf, DATA + offset, size);
+		// buf is never read, so make sure the copy isn't optimized
+		// away.
+		__asm__ volatile("" : : "r"(buf) : "memory");
+		break;
+	case WRITE:
+		written = payload_write(&PAYLOAD_MIX, req->payload,
+					DATA + offset, buf, size, req->seed,
+					&dirtied);
+		break;
+	}
+	unsigned long stop = timer_read();
+	unsigned long after_ns = now_ns();
+	getrusage(RUSAGE_THREAD, &usage_after);
+	if (mem_op == WRITE) {
+		verify_update(offset, size);
+		verify_unlock(offset, size);
+	}
+	bool preempted = usage_after.ru_nivcsw != usage_before.ru_nivcsw;
+	bool missed = hits < pages;
+	bool populating = LAZY_POPULATE &&
+			  (filled > 0 ||
+			   usage_after.ru_minflt != usage_before.ru_minflt);
+	startup_op(after_ns, !missed && !populating);
+
+	free(buf);
+
+	// Pool threads record their results concurrently.
+	pthread_mutex_lock(&RECORD_LOCK);
+
+	// Store time elapsed in nanoseconds.
+	int event;
+	long service = timer_elapsed_ns(start, stop, after_ns - before_ns,
+					&event);
+	long rate = (size * 1024 / service);
+	if (event == TIMER_OK)
+		event = timer_check();
+	if (event == TIMER_JUMP) {
+		WORKER->timer_jumps++;
+		timeline_row(after_ns, phase->name, "tsc_jump", NULL, 0, 0);
+	} else if (event == TIMER_FREQ_CHANGE) {
+		WORKER->timer_freq_changes++;
+		timeline_row(after_ns, phase->name, "tsc_freq", NULL, 0,
+			     TSC_PER_NS * 1000);
+	}
+
+	long diff = service;
+	unsigned long start_ns = before_ns;
+	if (req->submit_ns > 0) {
+		unsigned long queued = before_ns - req->submit_ns;
+		hist_record(&WORKER->queue_latency, queued);
+		hist_record(&WORKER->service_latency, service);
+		diff += queued;
+		start_ns = req->submit_ns;
+	}
+
+	if (RESULTS_I < RESULTS_SIZE) {
+		SAMPLES[RESULTS_I] = size;
+		RESULTS[RESULTS_I] = diff;
+		RATES[RESULTS_I] = rate;
+		PHASE_IDS[RESULTS_I] = req->phase;
+		RESULTS_I++;
+	} else if (!CONTINUOUS) {
+		printf("WARN: Result storage limit reached.\n");
+	}
+	// Start a new histogram window when requested through the control
+	// socket.
+	if (WORKER->generation != SHARED->generation) {
+		WORKER->generation = SHARED->generation;
+		WORKER->ops = 0;
+		hist_reset(&WORKER->latency);
+	}
+	WORKER->phase = req->phase;
+	WORKER->ops++;
+	WORKER->preempted += preempted;
+	WORKER->major_faults += usage_after.ru_majflt - usage_before.ru_majflt;
+	WORKER->page_hits += hits;
+	WORKER->page_misses += pages - hits;
+	if (FILE_BACKED)
+		hist_record(missed ? &WORKER->uncached_latency :
+				     &WORKER->cached_latency,
+			    diff);
+	if (mem_op == WRITE) {
+		WORKER->payload_ops[req->payload]++;
+		WORKER->payload_bytes[req->payload] += size;
+		WORKER->payload_pages[req->payload] += dirtied;
+		WORKER->payload_written[req->payload] += written;
+	}
+	if (MERGEABLE && mem_op == WRITE) {
+		WORKER->ksm.merged_writes += merged > 0;
+		WORKER->ksm.merged_pages += merged;
+		hist_record(merged > 0 ? &WORKER->ksm.merged_latency :
+					 &WORKER->ksm.unmerged_latency,
+			    diff);
+	}
+	if (SWAPPING) {
+		WORKER->swap.resident_pages += hits;
+		WORKER->swap.nonresident_pages += pages - hits;
+		WORKER->swap.major_faults +=
+			usage_after.ru_majflt - usage_before.ru_majflt;
+		hist_record(missed ? &WORKER->swap.nonresident_latency :
+				     &WORKER->swap.resident_latency,
+			    diff);
+	}
+	if (COW_TRACKED && mem_op == WRITE) {
+		WORKER->cow.cow_writes += shared > 0;
+		WORKER->cow.cow_pages += shared;
+		hist_record(shared > 0 ? &WORKER->cow.cow_latency :
+					 &WORKER->cow.steady_latency,
+			    diff);
+	}
+	WORKER->populated_pages += filled;
+	WORKER->minor_faults += usage_after.ru_minflt - usage_before.ru_minflt;
+	if (populating)
+		WORKER->last_populate_ns = after_ns - SHARED->start_ns;
+	hist_record(populating ? &WORKER->populate_latency :
+				 &WORKER->steady_latency,
+		    diff);
+	hist_record(&WORKER->latency, diff);
+	hist_record(&WORKER->lifetime, diff);
+	hist_record(&WORKER->phase_latency[req->phase], diff);
+	hist_record(&WORKER->segment_latency[SHARED->segments - 1], diff);
+	hist_record(&WORKER->sizes, size);
+	hist_record(&WORKER->rates, rate);
+	window_record(WORKER, (start_ns - SHARED->start_ns) / NSEC_PER_SEC,
+		      diff);
+	pthread_mutex_unlock(&RECORD_LOCK);
+
+	char label[64] = "";
+	const char *flags[] = { preempted ? "preempted" : NULL,
+				missed ? "miss" : NULL,
+				populating ? "populate" : NULL };
+	for (int i = 0; i < 3; i++) {
+		if (flags[i] == NULL)
+			continue;
+		if (label[0] != '\0')
+			strcat(label, "+");
+		strcat(label, flags[i]);
+	}
+	timeline_row(start_ns, phase->name, MEM_OP_EVENT[mem_op],
+		     label[0] != '\0' ? label : NULL, size, diff);
+}
 
+// run_async_op runs an operation of the async pool, first moving it back into
+// the working set if that shrank since the operation was planned.
+static void run_async_op(struct mem_request *req)
+{
+	unsigned long limit = workset_lock(ACCESS_SIZE);
+	unsigned long offset = req->offset - ACCESS_OFFSET;
+	if (offset >= limit)
+		offset %= limit;
+	if (offset + req->size > limit)
+		req->size = limit - offset;
+	req->offset = offset + ACCESS_OFFSET;
+	if (req->source - ACCESS_OFFSET + req->size > limit)
+		req->source = req->offset;
+	run_op(req);
+	workset_unlock();
+}
+
+// access_mem runs an operation on every tick, or tops up the operations
+// outstanding in the async pool to ASYNC_DEPTH.
+static void *access_mem(void *arg)
+{
 	// Notify main thread when ready to handle ticks.
 	pthread_mutex_lock(&TICK_LOCK);
+	WORKER_READY = true;
 	pthread_cond_signal(&TICK);
 	pthread_mutex_unlock(&TICK_LOCK);
 
@@ -132,47 +510,26 @@ static void *access_mem(void *arg)
 		pthread_mutex_lock(&TICK_LOCK);
 		pthread_cond_wait(&TICK, &TICK_LOCK);
 
-		unsigned long size = rand() % (MEM_OP_MAX_MB * MB);
-		unsigned long offset = rand();
-		offset = (offset << 12 | rand()) % (DATA_SIZE - 1);
-
-		// Adjust how much data to manipulate to make sure we stay within
-		// bounds.
-		if (offset + size > DATA_SIZE) {
-			size = DATA_SIZE - offset;
+		struct mem_request req;
+		if (ASYNC_DEPTH == 0) {
+			unsigned long limit = workset_lock(ACCESS_SIZE);
+			plan_op(CURRENT_PHASE, limit, &req);
+			run_op(&req);
+			workset_unlock();
+			pthread_mutex_unlock(&TICK_LOCK);
+			continue;
 		}
 
-		void *buf = malloc(size);
-		memset(buf, 0, size);
-
-		// Read or write from DATA and track how long the operation takes.
-		struct timespec before, after;
-		clock_gettime(CLOCK_MONOTONIC, &before);
-		switch (*mem_op) {
-		case READ:
-			memcpy(buf, DATA + offset, size);
-			break;
-		case WRITE:
-			memcpy(DATA + offset, buf, size);
-			break;
-		}
-		clock_gettime(CLOCK_MONOTONIC, &after);
-
-		free(buf);
-
-		// Store time elapsed in nanoseconds.
-		long secs_diff = after.tv_sec - before.tv_sec;
-		long nsecs_diff = after.tv_nsec - before.tv_nsec;
-		long diff = secs_diff * 1000000000 + nsecs_diff;
-		long rate = (size * 1024 / diff);
-
-		if (RESULTS_I < RESULTS_SIZE) {
-			SAMPLES[RESULTS_I] = size;
-			RESULTS[RESULTS_I] = diff;
-			RATES[RESULTS_I] = rate;
-			RESULTS_I++;
-		} else {
-			printf("WARN: Result storage limit reached.\n");
+		// Only this thread submits, so the pool can't fill up while
+		// topping it up.
+		int available = async_available();
+		if (available == 0)
+			WORKER->async_saturated++;
+		for (int i = 0; i < available; i++) {
+			plan_op(CURRENT_PHASE, workset_lock(ACCESS_SIZE), &req);
+			workset_unlock();
+			req.submit_ns = now_ns();
+			async_submit(&req);
 		}
 		pthread_mutex_unlock(&TICK_LOCK);
 	}
@@ -186,6 +543,21 @@ void handle_signal(int sig)
 	signal(sig, handle_signal);
 }
 
+// handle_verify_signal asks every worker to verify its data.
+void handle_verify_signal(int sig)
+{
+	verify_request();
+	signal(sig, handle_verify_signal);
+}
+
+// handle_stop_signal ends the test gracefully so results are still reported.
+void handle_stop_signal(int sig)
+{
+	if (SHARED != NULL)
+		SHARED->quit = 1;
+	signal(sig, handle_stop_signal);
+}
+
 // cmpulong compares two unsigned long values.
 int cmpulong(const void *a, const void *b)
 {
@@ -253,15 +625,322 @@ void compute_stats(struct stats *res, unsigned long *data, unsigned long size)
 	res->p90 = percentile(data, size, 90);
 }
 
+// print_stats prints statistics about operation sizes, times and throughput.
+void print_stats(pid_t pid, const struct stats *samples_stats,
+		 const struct stats *results_stats,
+		 const struct stats *rates_stats)
+{
+	printf("[%d] Data sample sizes:\n", pid);
+	printf("[%d]     Min: %.3f MB\n", pid, samples_stats->min / (double)MB);
+	printf("[%d]     Max: %.3f MB\n", pid, samples_stats->max / (double)MB);
+	printf("[%d]     Avg: %.3f MB\n", pid, samples_stats->avg / MB);
+	printf("[%d]   Stdev: %.3f MB\n", pid, samples_stats->stdev / MB);
+	printf("[%d]     P99: %.3f MB\n", pid, samples_stats->p99 / MB);
+	printf("[%d]     P95: %.3f MB\n", pid, samples_stats->p95 / MB);
+	printf("[%d]     P90: %.3f MB\n", pid, samples_stats->p90 / MB);
+
+	printf("[%d] Data operation times:\n", pid);
+	printf("[%d]     Min: %ld ns\n", pid, results_stats->min);
+	printf("[%d]     Max: %ld ns\n", pid, results_stats->max);
+	printf("[%d]     Avg: %.2f ns\n", pid, results_stats->avg);
+	printf("[%d]   Stdev: %.2f ns\n", pid, results_stats->stdev);
+	printf("[%d]     P99: %.2f ns\n", pid, results_stats->p99);
+	printf("[%d]     P95: %.2f ns\n", pid, results_stats->p95);
+	printf("[%d]     P90: %.2f ns\n", pid, results_stats->p90);
+
+	printf("[%d] Data operation throughput:\n", pid);
+	printf("[%d]     Min: %.3f GB/s\n", pid,
+	       rates_stats->min / (double)1024);
+	printf("[%d]     Max: %.3f GB/s\n", pid,
+	       rates_stats->max / (double)1024);
+	printf("[%d]     Avg: %.3f GB/s\n", pid, rates_stats->avg / 1024);
+	printf("[%d]   Stdev: %.3f GB/s\n", pid, rates_stats->stdev / 1024);
+	printf("[%d]     P99: %.3f GB/s\n", pid, rates_stats->p99 / 1024);
+	printf("[%d]     P95: %.3f GB/s\n", pid, rates_stats->p95 / 1024);
+	printf("[%d]     P90: %.3f GB/s\n", pid, rates_stats->p90 / 1024);
+}
+
+// print_results sorts the first n entries of samples, results and rates,
+// stores statistics about them in res and prints them.
+void print_results(pid_t pid, unsigned long *samples, unsigned long *results,
+		   unsigned long *rates, unsigned long n, struct result *res)
+{
+	qsort(samples, n, sizeof(unsigned long), cmpulong);
+	qsort(results, n, sizeof(unsigned long), cmpulong);
+	qsort(rates, n, sizeof(unsigned long), cmpulong);
+
+	res->ops = n;
+	res->bytes = 0;
+	for (unsigned long i = 0; i < n; i++)
+		res->bytes += samples[i];
+	compute_stats(&res->sizes, samples, n);
+	compute_stats(&res->times, results, n);
+	compute_stats(&res->rates, rates, n);
+
+	// Report the slowest throughput percentiles.
+	res->rates.p99 = percentile(rates, n, 1);
+	res->rates.p95 = percentile(rates, n, 5);
+	res->rates.p90 = percentile(rates, n, 10);
+
+	print_stats(pid, &res->sizes, &res->times, &res->rates);
+}
+
+// print_hist_results stores statistics about the operations recorded in the
+// lifetime histograms of w in res and prints them.
+void print_hist_results(pid_t pid, const struct worker *w, struct result *res)
+{
+	res->ops = w->lifetime.count;
+	res->bytes = w->sizes.sum;
+	hist_stats(&w->sizes, &res->sizes);
+	hist_stats(&w->lifetime, &res->times);
+	hist_stats(&w->rates, &res->rates);
+	res->rates.p99 = hist_percentile(&w->rates, 1);
+	res->rates.p95 = hist_percentile(&w->rates, 5);
+	res->rates.p90 = hist_percentile(&w->rates, 10);
+
+	print_stats(pid, &res->sizes, &res->times, &res->rates);
+}
+
+// print_window_summary prints the operation times of the rolling windows of
+// the current worker.
+void print_window_summary(pid_t pid)
+{
+	static const int windows[] = { 1, 10, 60 };
+	struct hist *h = malloc(sizeof(struct hist));
+	if (h == NULL)
+		return;
+
+	printf("[%d] Rolling windows:", pid);
+	for (int i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+		hist_reset(h);
+		window_merge(WORKER, windows[i], h);
+		printf("%s %ds: %ld ops, p50 %.2f ns, p99 %.2f ns, max %ld ns",
+		       i ? ";" : "", windows[i], h->count,
+		       hist_percentile(h, 50), hist_percentile(h, 99), h->max);
+	}
+	printf("\n");
+	fflush(stdout);
+	free(h);
+}
+
+// print_phase_results prints the results of each phase of the scenario. It
+// must be called before the result arrays are sorted.
+void print_phase_results(pid_t pid)
+{
+	unsigned long *samples = calloc(sizeof(unsigned long), RESULTS_I);
+	unsigned long *results = calloc(sizeof(unsigned long), RESULTS_I);
+	unsigned long *rates = calloc(sizeof(unsigned long), RESULTS_I);
+
+	for (int p = 0; p < SCENARIO.count; p++) {
+		struct phase *phase = &SCENARIO.phases[p];
+		if (phase->idle)
+			continue;
+
+		unsigned long n = 0, bytes = 0;
+		for (unsigned long i = 0; i < RESULTS_I; i++) {
+			if (PHASE_IDS[i] != p)
+				continue;
+			samples[n] = SAMPLES[i];
+			results[n] = RESULTS[i];
+			rates[n] = RATES[i];
+			bytes += SAMPLES[i];
+			n++;
+		}
+
+		printf("[%d] Phase %s: %ld operations, %.3f MB/s achieved.\n",
+		       pid, phase->name, n,
+		       bytes / (double)MB / phase->duration);
+		if (n > 0)
+			print_results(pid, samples, results, rates, n,
+				      &WORKER->phases[p]);
+	}
+
+	free(samples);
+	free(results);
+	free(rates);
+}
+
+// print_page_cache_results prints how often operations on file backed DATA
+// found their pages in the page cache.
+void print_page_cache_results(pid_t pid)
+{
+	if (!FILE_BACKED)
+		return;
+
+	unsigned long pages = WORKER->page_hits + WORKER->page_misses;
+	printf("[%d] Page cache: %ld hits, %ld misses (%.2f%% hit rate), %ld major faults.\n",
+	       pid, WORKER->page_hits, WORKER->page_misses,
+	       pages ? WORKER->page_hits * 100.0 / pages : 0,
+	       WORKER->major_faults);
+	const struct hist *h[] = { &WORKER->cached_latency,
+				   &WORKER->uncached_latency };
+	const char *name[] = { "Cached", "Uncached" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s operations: %ld, p50 %.2f ns, p99 %.2f ns.\n",
+		       pid, name[i], h[i]->count, hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99));
+	}
+}
+
+// print_populate_results prints the operation times of operations that
+// populated memory separately from the steady state ones.
+void print_populate_results(pid_t pid)
+{
+	printf("[%d] Population: %ld pages filled, %ld minor faults, last at %.3f s.\n",
+	       pid, WORKER->populated_pages, WORKER->minor_faults,
+	       WORKER->last_populate_ns / (double)NSEC_PER_SEC);
+	const struct hist *h[] = { &WORKER->populate_latency,
+				   &WORKER->steady_latency };
+	const char *name[] = { "Populating", "Steady" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s operations: %ld, p50 %.2f ns, p99 %.2f ns.\n",
+		       pid, name[i], h[i]->count, hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99));
+	}
+}
+
+// print_payload_results prints how much data writes stored with every
+// payload, and how many bytes they wrote per page they dirtied.
+void print_payload_results(pid_t pid)
+{
+	unsigned long ops = 0;
+	for (int p = 0; p < PAYLOADS; p++)
+		ops += WORKER->payload_ops[p];
+	if (ops == 0)
+		return;
+
+	for (int p = 0; p < PAYLOADS; p++) {
+		if (WORKER->payload_ops[p] == 0)
+			continue;
+		unsigned long pages = WORKER->payload_pages[p];
+		printf("[%d] Write payload %s: %ld ops over %.3f MB, %ld pages dirtied, %.1f bytes written per page.\n",
+		       pid, PAYLOAD_STRING[p], WORKER->payload_ops[p],
+		       WORKER->payload_bytes[p] / (double)MB, pages,
+		       pages ? WORKER->payload_written[p] / (double)pages : 0);
+	}
+}
+
+// print_async_results prints how long operations of the async pool were
+// queued for and took to run.
+void print_async_results(pid_t pid)
+{
+	if (ASYNC_DEPTH == 0)
+		return;
+
+	printf("[%d] Async: %ld ticks found all %d operations outstanding.\n",
+	       pid, WORKER->async_saturated, ASYNC_DEPTH);
+	const struct hist *h[] = { &WORKER->queue_latency,
+				   &WORKER->service_latency };
+	const char *name[] = { "Queue", "Service" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s time: p50 %.2f ns, p99 %.2f ns, max %ld ns.\n",
+		       pid, name[i], hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99), h[i]->max);
+	}
+}
+
+// print_segment_results prints the operation times of every segment of the
+// run if a migration was detected.
+void print_segment_results(pid_t pid)
+{
+	if (SHARED->segments < 2)
+		return;
+
+	struct stats s;
+	for (int i = 0; i < SHARED->segments; i++) {
+		const struct hist *h = &WORKER->segment_latency[i];
+		hist_stats(h, &s);
+		printf("[%d] Segment %d (%s at %.3f s): %ld ops, avg %.2f ns, p50 %.2f ns, p99 %.2f ns, max %ld ns\n",
+		       pid, i, i == 0 ? "pre-migration" : "post-migration",
+		       SHARED->segment[i].start_ns / (double)NSEC_PER_SEC,
+		       h->count, s.avg, hist_percentile(h, 50), s.p99, s.max);
+		if (i > 0)
+			printf("[%d]   Detected by: %s\n", pid,
+			       SHARED->segment[i].reasons);
+	}
+}
+
+// maybe_print_summary prints a rolling window summary if one is due.
+void maybe_print_summary(pid_t pid)
+{
+	if (SUMMARY_INTERVAL_NS == 0)
+		return;
+
+	unsigned long now = now_ns();
+	if (now < NEXT_SUMMARY_NS)
+		return;
+	NEXT_SUMMARY_NS = now + SUMMARY_INTERVAL_NS;
+	print_window_summary(pid);
+}
+
+// run_phase issues memory operations for the duration of phase, or forever if
+// the phase has no duration. It returns non-zero if it was interrupted.
+int run_phase(pid_t pid, struct phase *phase)
+{
+	if (phase->idle) {
+		struct timespec second = { .tv_sec = 1 };
+		for (int i = 0; phase->duration == 0 || i < phase->duration;
+		     i++) {
+			if (SHARED->quit || nanosleep(&second, NULL))
+				return 1;
+			maybe_print_summary(pid);
+		}
+		return 0;
+	}
+
+	struct timespec tick_interval = {
+		.tv_sec = phase->interval_ms / 1000,
+		.tv_nsec = (phase->interval_ms % 1000) * 1000000,
+	};
+	unsigned long ticks = (unsigned long)phase->duration * 1000 /
+			      phase->interval_ms;
+	if (phase->duration == 0)
+		ticks = ULONG_MAX;
+
+	for (unsigned long i = 0; i < ticks; i++) {
+		if (SHARED->quit)
+			return 1;
+		maybe_print_summary(pid);
+
+		// Let time pass without accessing memory while paused.
+		if (SHARED->paused) {
+			if (nanosleep(&tick_interval, NULL))
+				return 1;
+			continue;
+		}
+
+		int lock_res = pthread_mutex_trylock(&TICK_LOCK);
+		if (lock_res == 0) {
+			pthread_cond_signal(&TICK);
+			pthread_mutex_unlock(&TICK_LOCK);
+		} else {
+			printf("[%d] WARN: Lock is busy, missing tick.\n", pid);
+		}
+		io_tick(phase);
+		if (nanosleep(&tick_interval, NULL))
+			return 1;
+	}
+	return 0;
+}
+
 int benchmark(struct benchmark_opts opts)
 {
 	int ret = EXIT_SUCCESS;
+	bool child = false;
 
-	// Run benchmark setup in a single NUMA node.
+	if (output_open(&opts))
+		exit(EXIT_FAILURE);
+
+	// Run benchmark setup in a single NUMA node, the one DATA is placed on
+	// unless it is spread across nodes.
+	int setup_node = 0;
+	if (opts.placement == PLACEMENT_BIND ||
+	    opts.placement == PLACEMENT_REMOTE)
+		setup_node = opts.data_node;
 	if (numa_available() != -1) {
 		struct bitmask *mask =
 			numa_bitmask_alloc(numa_num_possible_nodes());
-		numa_bitmask_setbit(mask, 0);
+		numa_bitmask_setbit(mask, setup_node);
 		numa_bind(mask);
 		numa_bitmask_free(mask);
 	}
@@ -269,37 +948,244 @@ int benchmark(struct benchmark_opts opts)
 	struct timespec clock_res;
 	clock_getres(CLOCK_MONOTONIC, &clock_res);
 	printf("Clock resolution: %ld ns\n", clock_res.tv_nsec);
+	timer_init(opts.clock);
+	if (CLOCK_SOURCE == CLOCK_SOURCE_TSC)
+		printf("Timer:            tsc, %.3f ticks/ns, %ld ns overhead\n",
+		       TSC_PER_NS, TIMER_OVERHEAD_NS);
+	else
+		printf("Timer:            monotonic, %ld ns overhead "
+		       "(not subtracted)\n", TIMER_OVERHEAD_NS);
 	printf("Benchmark seed:   %ld\n", opts.seed);
-	printf("Memory operation: %s\n", MEM_OP_STRING[opts.mem_op]);
+	if (opts.scenario_file == NULL) {
+		printf("Memory operation: %s\n", MEM_OP_STRING[opts.mem_op]);
+	} else {
+		printf("Scenario:         %s (%d phases, %ds)\n",
+		       opts.scenario_file, SCENARIO.count,
+		       scenario_duration(&SCENARIO));
+		for (int p = 0; p < SCENARIO.count; p++) {
+			struct phase *phase = &SCENARIO.phases[p];
+			if (phase->idle) {
+				printf("  %s: %ds, idle\n", phase->name,
+				       phase->duration);
+				continue;
+			}
+			printf("  %s: %ds, %s, every %dms, ", phase->name,
+			       phase->duration, PATTERN_STRING[phase->pattern],
+			       phase->interval_ms);
+			if (phase->rate > 0)
+				printf("%.3f MB/s, ", phase->rate / (double)MB);
+			else
+				printf("up to %.3f MB, ",
+				       phase->op_size / (double)MB);
+			printf("%d%% writes\n", phase->write_pct);
+		}
+	}
+	if (opts.backing.file)
+		printf("Backing:          %s (%s, %s)\n", opts.backing.path,
+		       opts.backing.shared ? "shared" : "private",
+		       PREFAULT_STRING[opts.backing.prefault]);
+	if (opts.io.enabled)
+		printf("I/O file:         %s (%s, depth %d, %lu byte blocks%s)\n",
+		       opts.io.path, IO_ENGINE_STRING[opts.io.engine],
+		       opts.io.depth, opts.io.block_size,
+		       opts.io.direct ? ", direct" : "");
+	if (opts.churn.rate > 0)
+		printf("Churn:            %lu allocs/s with %s, %lu-%lu bytes, %lums lifetime\n",
+		       opts.churn.rate, ALLOCATOR_STRING[opts.churn.allocator],
+		       opts.churn.min_size, opts.churn.max_size,
+		       opts.churn.lifetime_ms);
+	if (opts.workset.enabled)
+		printf("Working set:      %s, %d%%-%d%% over %ds, %s\n",
+		       CURVE_STRING[opts.workset.curve], opts.workset.min_pct,
+		       opts.workset.max_pct, opts.workset.period,
+		       SHRINK_STRING[opts.workset.shrink]);
+	if (opts.verify.enabled && opts.verify.sample_pct == 100)
+		printf("Verify:           all pages, %d threads\n",
+		       opts.verify.threads);
+	else if (opts.verify.enabled)
+		printf("Verify:           %d%% of pages, %d threads\n",
+		       opts.verify.sample_pct, opts.verify.threads);
+	if (opts.fingerprint_threads > 0)
+		printf("Fingerprint:      %d threads\n", opts.fingerprint_threads);
+	if (opts.ksm.enabled)
+		printf("KSM:              %d%% of data mergeable, %d%% duplicate pages\n",
+		       opts.ksm.region_pct, opts.ksm.dup_pct);
+	if (opts.cow.enabled && opts.cow.children > 0)
+		printf("Fork storm:       %d children at %d s, every %d s, %d writes/s for %d s\n",
+		       opts.cow.children, opts.cow.at, opts.cow.every,
+		       opts.cow.rate, opts.cow.hold);
+	else if (opts.cow.enabled)
+		printf("Fork storm:       none, classifying copy-on-write faults\n");
+	if (opts.swap.enabled)
+		printf("Memory limit:     %s at %d%% of data%s%s\n",
+		       opts.swap.high ? "memory.high" : "memory.max",
+		       opts.swap.limit_pct, opts.swap.cgroup ? ", cgroup " : "",
+		       opts.swap.cgroup ? opts.swap.cgroup : "");
+	if (opts.cgroup_stats_ms > 0)
+		printf("Cgroup stats:     every %d ms\n", opts.cgroup_stats_ms);
+	if (opts.mem_op == WRITE || opts.scenario_file != NULL) {
+		printf("Write payload:   ");
+		for (int p = 0; p < PAYLOADS; p++) {
+			if (opts.payload.weight[p] > 0)
+				printf(" %s %d%%", PAYLOAD_STRING[p],
+				       opts.payload.weight[p] * 100 /
+					       opts.payload.total);
+			if (p == PAYLOAD_SPARSE && opts.payload.weight[p] > 0)
+				printf(" (%d %s in %d%% of pages)",
+				       opts.payload.sparse.count,
+				       opts.payload.sparse.lines ? "lines" :
+								   "bytes",
+				       opts.payload.sparse.pages_pct);
+		}
+		printf("\n");
+	}
+	if (opts.placement == PLACEMENT_INTERLEAVE ||
+	    opts.placement == PLACEMENT_PARTITION)
+		printf("Data placement:   %s\n", PLACEMENT_STRING[opts.placement]);
+	else
+		printf("Data placement:   %s node %d\n",
+		       PLACEMENT_STRING[opts.placement], opts.data_node);
+	if (opts.placement == PLACEMENT_REMOTE && placement_nodes() < 2)
+		printf("WARN: Only one NUMA node, all accesses are local.\n");
 	printf("\n");
 
 	// Initialize RNG seed, signal handler, and shared variables.
 	srand(opts.seed);
+	PAYLOAD_MIX = opts.payload;
+	MERGEABLE = opts.ksm.enabled;
+	COW_TRACKED = opts.cow.enabled;
+	SWAPPING = opts.swap.enabled;
+	LAZY_POPULATE = opts.populate != POPULATE_EAGER;
 	pthread_mutex_init(&TICK_LOCK, NULL);
 	pthread_cond_init(&TICK, NULL);
 
 	DATA_SIZE = opts.data_size * GB;
-	DATA = (void *)malloc(DATA_SIZE);
-	RESULTS_SIZE = opts.duration * 1000 / TICK_INTERVAL_MS;
+	// DATA is mapped directly so NUMA policies can be applied to it.
+	FILE_BACKED = opts.backing.file;
+	DATA = backing_map(&opts.backing, DATA_SIZE);
+	if (DATA == MAP_FAILED) {
+		printf("Failed to allocate memory: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (placement_apply(DATA, DATA_SIZE, opts.placement, opts.data_node,
+			    opts.forks > 0 ? opts.forks : 1))
+		exit(EXIT_FAILURE);
+	startup_mark(STARTUP_ALLOCATED);
+	// Continuous runs only keep histograms, so memory use stays bounded no
+	// matter how long they run.
+	CONTINUOUS = opts.duration == 0;
+	// Async ticks submit up to async_depth operations each.
+	RESULTS_SIZE = CONTINUOUS ? 0 : scenario_ticks(&SCENARIO);
+	if (opts.async_depth > 0)
+		RESULTS_SIZE *= opts.async_depth;
 	SAMPLES = (unsigned long *)calloc(sizeof(unsigned long), RESULTS_SIZE);
 	RESULTS = (unsigned long *)calloc(sizeof(unsigned long), RESULTS_SIZE);
 	RATES = (unsigned long *)calloc(sizeof(unsigned long), RESULTS_SIZE);
-	struct stats *results_stats = calloc(sizeof(struct stats), 1);
-	struct stats *samples_stats = calloc(sizeof(struct stats), 1);
-	struct stats *rates_stats = calloc(sizeof(struct stats), 1);
+	PHASE_IDS = (unsigned char *)calloc(sizeof(unsigned char), RESULTS_SIZE);
+
+	// Worker statistics are shared with the parent so they can be reported
+	// through the control socket while the test runs.
+	int workers = opts.forks > 0 ? opts.forks : 1;
+	size_t shared_size =
+		sizeof(struct shared) + workers * sizeof(struct worker);
+	SHARED = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (SHARED == MAP_FAILED) {
+		printf("Failed to allocate shared memory: %s\n",
+		       strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	// Keep the statistics from being paged out while they are recorded.
+	if (opts.mlock &&
+	    (mlock(SHARED, shared_size) ||
+	     mlock(SAMPLES, RESULTS_SIZE * sizeof(unsigned long)) ||
+	     mlock(RESULTS, RESULTS_SIZE * sizeof(unsigned long)) ||
+	     mlock(RATES, RESULTS_SIZE * sizeof(unsigned long)) ||
+	     mlock(PHASE_IDS, RESULTS_SIZE)))
+		printf("WARN: Failed to lock statistics in memory: %s\n",
+		       strerror(errno));
+	SHARED->state = LOADING;
+	startup_share(&SHARED->startup);
+	SHARED->workers_count = workers;
+	WORKER = &SHARED->workers[0];
+	WORKER->pid = getpid();
 
 	signal(SIGUSR1, handle_signal);
+	signal(SIGINT, handle_stop_signal);
+	signal(SIGTERM, handle_stop_signal);
 	sigset_t set, old_set;
 	sigemptyset(&set);
 	sigaddset(&set, SIGUSR1);
+	// Only threads that can't be interrupted by it, the verify threads of
+	// the workers and the main thread of the parent, handle SIGUSR2.
+	if (opts.verify.enabled) {
+		sigset_t verify_set;
+		sigemptyset(&verify_set);
+		sigaddset(&verify_set, SIGUSR2);
+		sigprocmask(SIG_BLOCK, &verify_set, NULL);
+		signal(SIGUSR2, handle_verify_signal);
+	}
+
+	AUX_CPUS = opts.aux_cpus;
+	if (opts.control_socket != NULL) {
+		if (control_start(opts.control_socket)) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+	}
 
-	printf("Loading %d GB into memory...\n", opts.data_size);
-	unsigned long loaded = load_mem();
-	if (loaded == 0) {
+	// The data is charged to the cgroup it is first touched in.
+	if (opts.swap.enabled && swap_setup(&opts.swap, DATA_SIZE)) {
 		ret = EXIT_FAILURE;
 		goto free;
 	}
-	printf("Loaded %ld GB into memory.\n", loaded / GB);
+
+	// A backing file already holds the data.
+	unsigned long populate_start = now_ns();
+	if (!FILE_BACKED && opts.populate == POPULATE_EAGER) {
+		printf("Loading %d GB into memory...\n", opts.data_size);
+		unsigned long loaded = load_mem();
+		if (loaded == 0) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+		printf("Loaded %ld GB into memory.\n", loaded / GB);
+	} else if (!FILE_BACKED) {
+		if (populate_setup(opts.populate, DATA, DATA_SIZE)) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+	}
+	SHARED->populate_ns = now_ns() - populate_start;
+	if (LAZY_POPULATE)
+		printf("Populated %d GB (%s) in %.3f s.\n", opts.data_size,
+		       POPULATE_STRING[opts.populate],
+		       SHARED->populate_ns / (double)NSEC_PER_SEC);
+	if (opts.ksm.enabled && ksm_setup(&opts.ksm, DATA, DATA_SIZE)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	startup_mark(STARTUP_LOADED);
+	if (opts.verify.enabled) {
+		if (verify_setup(&opts.verify, DATA, DATA_SIZE)) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+	}
+	if (opts.io.enabled && io_prepare(&opts.io)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	// Fingerprint the data before the ready file tells it can be
+	// snapshotted.
+	if (opts.fingerprint_threads > 0) {
+		fingerprint_setup(DATA, DATA_SIZE, opts.fingerprint_threads);
+		if (fingerprint_take(FINGERPRINT_READY)) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+	}
+	SHARED->state = READY;
 
 	if (opts.ready_file != NULL) {
 		if (remove(opts.ready_file) && errno != ENOENT) {
@@ -317,125 +1203,368 @@ int benchmark(struct benchmark_opts opts)
 		}
 		fclose(fp);
 	}
+	startup_mark(STARTUP_READY);
 	if (!opts.quick) {
 		printf("Waiting for SIGUSR1...\n");
+		fflush(stdout);
+		startup_wait_begin();
 		sigprocmask(SIG_BLOCK, &set, &old_set);
-		while (!PROCEED)
+		while (!PROCEED && !SHARED->quit)
 			sigsuspend(&old_set);
 		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		if (SHARED->quit)
+			goto free;
+		startup_mark(STARTUP_SIGNAL);
 		printf("Signal received.\n");
+		// Check that the data survived a restore.
+		startup_wait_end();
+		if (SHARED->startup.restore_reasons[0] != '\0')
+			verify_request();
+		if (opts.fingerprint_threads > 0) {
+			if (fingerprint_take(FINGERPRINT_START)) {
+				ret = EXIT_FAILURE;
+				goto free;
+			}
+			startup_fingerprinted(
+				fingerprint_get(FINGERPRINT_START)->ns);
+		}
+	}
+
+	ksm_sample(KSM_START);
+	swap_sample(SWAP_START);
+	SHARED->start_ns = now_ns();
+	struct timespec realtime;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	SHARED->start_realtime_ns =
+		realtime.tv_sec * NSEC_PER_SEC + realtime.tv_nsec;
+	SHARED->segments = 1;
+	snprintf(SHARED->segment[0].reasons, SEGMENT_REASONS_MAX, "start");
+	SHARED->state = RUNNING;
+	// The sampler adds its columns to the timeline before it is opened.
+	if (opts.cgroup_stats_ms > 0 &&
+	    cgroup_sampler_start(&SHARED->cgroup, opts.cgroup_stats_ms)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.timeline_file != NULL) {
+		if (timeline_open(opts.timeline_file, SHARED->start_ns)) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+	}
+	if (swap_start()) {
+		ret = EXIT_FAILURE;
+		goto free;
 	}
 
 	if (opts.forks > 0) {
 		printf("Forking %d child processes...\n", opts.forks);
+		// Don't let children inherit and repeat buffered output.
+		fflush(stdout);
+		unsigned long forks_start = now_ns();
 		for (int i = 0; i < opts.forks; i++) {
+			unsigned long start = now_ns();
 			pid_t pid = fork();
 			if (pid == 0) {
-				if (numa_available() != -1) {
-					struct bitmask *mask = numa_bitmask_alloc(
-						numa_num_possible_nodes());
-					int node = 0;
-					if (opts.numa) {
-						node = i %
-						       (numa_max_node() + 1);
-					}
-					numa_bitmask_setbit(mask, node);
-					numa_bind(mask);
-					numa_bitmask_free(mask);
-				}
+				child = true;
+				WORKER = &SHARED->workers[i];
+				WORKER->pid = getpid();
 				goto mem_access;
 			}
+			SHARED->workers[i].cow.forks++;
+			hist_record(&SHARED->workers[i].cow.fork_latency,
+				    now_ns() - start);
 		}
+		unsigned long forks_ns = now_ns() - forks_start;
+		printf("Forked %d child processes in %.3f ms, %.3f ms per fork of %d GB.\n",
+		       opts.forks, forks_ns / 1e6, forks_ns / 1e6 / opts.forks,
+		       opts.data_size);
 
-		for (int i = 0; i < opts.forks; i++) {
-			waitpid(0, NULL, 0);
+		if (locality_start(opts.locality, opts.relocalize) ||
+		    migration_start(opts.migration_check))
+			ret = EXIT_FAILURE;
+		if (opts.verify.enabled) {
+			sigset_t verify_set;
+			sigemptyset(&verify_set);
+			sigaddset(&verify_set, SIGUSR2);
+			pthread_sigmask(SIG_UNBLOCK, &verify_set, NULL);
+		}
+		for (int i = 0; i < opts.forks;) {
+			if (waitpid(0, NULL, 0) != -1)
+				i++;
+			else if (errno != EINTR)
+				break;
 		}
+		SHARED->state = DONE;
 		goto free;
 	}
 
 mem_access:;
 	pid_t pid = getpid();
-	printf("[%d] Accessing memory every %dms for %ds...\n", pid,
-	       TICK_INTERVAL_MS, opts.duration);
-	struct timespec tick_interval = {
-		.tv_sec = TICK_INTERVAL_MS / 1000,
-		.tv_nsec = (TICK_INTERVAL_MS % 1000) * 1000000,
-	};
+	struct worker_placement place;
+	placement_worker(opts.placement, opts.data_node, opts.numa,
+			 WORKER - SHARED->workers, SHARED->workers_count,
+			 DATA_SIZE, &place);
+	int worker_i = WORKER - SHARED->workers;
+	if (opts.worker_cpus.count > 0) {
+		place.cpu = cpulist_nth(&opts.worker_cpus, worker_i);
+		if (numa_available() != -1)
+			place.node = numa_node_of_cpu(place.cpu);
+	}
+	if (placement_pin(&place)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	ACCESS_OFFSET = place.offset;
+	ACCESS_SIZE = place.size;
+	WORKER->access_offset = place.offset;
+	WORKER->access_size = place.size;
+	WORKER->cpu = place.cpu;
+	WORKER->node = place.node;
+	WORKER->data_node = place.data_node;
+	if (place.data_node == -1) {
+		printf("[%d] Running on CPU %d (node %d), data interleaved across %d nodes.\n",
+		       pid, place.cpu, place.node, placement_nodes());
+	} else {
+		printf("[%d] Running on CPU %d (node %d), %.3f GB of data on node %d (%s).\n",
+		       pid, place.cpu, place.node, place.size / (double)GB,
+		       place.data_node,
+		       place.node == place.data_node ? "local" : "remote");
+	}
+	if (opts.locality >= 0 && locality_scan(WORKER) == 0)
+		locality_report(worker_i);
+	if (opts.forks == 0 &&
+	    (locality_start(opts.locality, opts.relocalize) ||
+	     migration_start(opts.migration_check))) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.scenario_file == NULL && CONTINUOUS) {
+		printf("[%d] Accessing memory every %dms until stopped...\n",
+		       pid, SCENARIO.phases[0].interval_ms);
+	} else if (opts.scenario_file == NULL) {
+		printf("[%d] Accessing memory every %dms for %ds...\n", pid,
+		       SCENARIO.phases[0].interval_ms, opts.duration);
+	} else if (CONTINUOUS) {
+		printf("[%d] Repeating %d phases until stopped...\n", pid,
+		       SCENARIO.count);
+	} else {
+		printf("[%d] Running %d phases for %ds...\n", pid,
+		       SCENARIO.count, scenario_duration(&SCENARIO));
+	}
+	if (opts.summary_interval > 0) {
+		SUMMARY_INTERVAL_NS = opts.summary_interval * NSEC_PER_SEC;
+		NEXT_SUMMARY_NS = now_ns() + SUMMARY_INTERVAL_NS;
+	}
 
+	// The pagemap inherited from the parent describes its pages, not those
+	// of the worker.
+	if ((MERGEABLE || COW_TRACKED) && pagemap_open()) {
+		printf("[%d] Failed to open pagemap: %s\n", pid, strerror(errno));
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.async_depth > 0) {
+		if (async_start(opts.async_depth, opts.async_threads,
+				place.node, run_async_op)) {
+			ret = EXIT_FAILURE;
+			goto free;
+		}
+		ASYNC_DEPTH = opts.async_depth;
+		printf("[%d] Keeping %d operations outstanding on %d threads.\n",
+		       pid, opts.async_depth, opts.async_threads);
+	}
+	if (opts.io.enabled &&
+	    io_start(&opts.io, &WORKER->io, worker_i, SHARED->workers_count,
+		     opts.seed + worker_i, opts.async_depth > 0)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.churn.rate > 0 &&
+	    churn_start(&opts.churn, &WORKER->churn, opts.seed + worker_i)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.workset.enabled &&
+	    workset_start(&opts.workset, &WORKER->workset,
+			  (char *)DATA + ACCESS_OFFSET, ACCESS_SIZE,
+			  place.data_node)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (verify_start(&WORKER->verify, ACCESS_OFFSET, ACCESS_SIZE)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.cow.enabled &&
+	    cow_start(&opts.cow, &WORKER->cow, (char *)DATA + ACCESS_OFFSET,
+		      ACCESS_SIZE, opts.seed + worker_i)) {
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+
+	// Only the access thread runs on the CPU of the worker, while the tick
+	// thread stays on its node unless moved elsewhere.
 	pthread_t mem_op_tid;
-	pthread_create(&mem_op_tid, NULL, access_mem, (void *)&opts.mem_op);
+	pthread_create(&mem_op_tid, NULL, access_mem, NULL);
+	if (pin_thread(mem_op_tid, place.cpu)) {
+		pthread_cancel(mem_op_tid);
+		pthread_join(mem_op_tid, NULL);
+		ret = EXIT_FAILURE;
+		goto free;
+	}
+	if (opts.tick_cpus.count > 0) {
+		int cpu = cpulist_nth(&opts.tick_cpus, worker_i);
+		if (pin_thread(pthread_self(), cpu) == 0)
+			printf("[%d] Ticking on CPU %d.\n", pid, cpu);
+	}
+	// Ticks run at a higher priority so a busy access thread sharing their
+	// CPU can't delay them.
+	if (opts.fifo > 0 && (set_fifo(mem_op_tid, opts.fifo) ||
+			      set_fifo(pthread_self(), opts.fifo + 1)))
+		printf("[%d] WARN: Running without SCHED_FIFO.\n", pid);
 
 	// Wait for the background thread to be ready to handle ticks.
 	pthread_mutex_lock(&TICK_LOCK);
-	pthread_cond_wait(&TICK, &TICK_LOCK);
+	while (!WORKER_READY)
+		pthread_cond_wait(&TICK, &TICK_LOCK);
 	pthread_mutex_unlock(&TICK_LOCK);
 
-	for (int i = 0; i < RESULTS_SIZE; i++) {
-		int lock_res = pthread_mutex_trylock(&TICK_LOCK);
-		if (lock_res == 0) {
-			pthread_cond_signal(&TICK);
+	bool interrupted = false;
+	do {
+		for (int p = 0; p < SCENARIO.count && !interrupted; p++) {
+			struct phase *phase = &SCENARIO.phases[p];
+
+			// Wait for any in-flight operation to finish so it's
+			// accounted to the phase it started in.
+			pthread_mutex_lock(&TICK_LOCK);
+			CURRENT_PHASE = p;
 			pthread_mutex_unlock(&TICK_LOCK);
-		} else {
-			printf("[%d] WARN: Lock is busy, missing tick.\n", pid);
+
+			if (SCENARIO.count > 1)
+				printf("[%d] Starting phase %s for %ds...\n",
+				       pid, phase->name, phase->duration);
+			timeline_row(now_ns(), phase->name, "phase", NULL, 0,
+				     0);
+			interrupted = run_phase(pid, phase);
 		}
-		if (nanosleep(&tick_interval, NULL))
-			break;
-	}
+	} while (CONTINUOUS && !interrupted);
 
 	pthread_cancel(mem_op_tid);
 	pthread_join(mem_op_tid, NULL);
+	async_stop();
+	io_stop();
+	churn_stop();
+	workset_stop();
+	verify_stop();
+	cow_stop();
+	if (opts.locality >= 0 && locality_scan(WORKER) == 0)
+		locality_report(worker_i);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	WORKER->involuntary_switches = usage.ru_nivcsw;
+	printf("[%d] Involuntary context switches: %ld, %ld operations preempted.\n",
+	       pid, usage.ru_nivcsw, WORKER->preempted);
+	if (opts.forks == 0)
+		SHARED->state = DONE;
+	if (CONTINUOUS) {
+		printf("[%d] Accessed %ld segments of memory.\n", pid,
+		       WORKER->lifetime.count);
+		if (WORKER->lifetime.count > 0) {
+			printf("[%d] Calculating results...\n", pid);
+			print_hist_results(pid, WORKER, &WORKER->total);
+			print_segment_results(pid);
+			print_page_cache_results(pid);
+			if (LAZY_POPULATE)
+				print_populate_results(pid);
+			print_payload_results(pid);
+			print_async_results(pid);
+			if (opts.io.enabled)
+				io_report(pid, &WORKER->io, SHARED->segments);
+			if (opts.churn.rate > 0)
+				churn_report(pid, &WORKER->churn);
+			if (opts.workset.enabled)
+				workset_report(pid, &WORKER->workset);
+			if (opts.verify.enabled)
+				verify_report(pid, &WORKER->verify);
+			if (opts.ksm.enabled)
+				ksm_worker_report(pid, &WORKER->ksm);
+			if (opts.cow.enabled)
+				cow_report(pid, &WORKER->cow, DATA_SIZE);
+			if (opts.swap.enabled)
+				swap_worker_report(pid, &WORKER->swap);
+		}
+		goto free;
+	}
+
 	printf("[%d] Accessed %ld segments of memory.\n", pid, RESULTS_I);
 	if (RESULTS_I == 0) {
 		goto free;
 	}
 
 	printf("[%d] Calculating results...\n", pid);
-	qsort(SAMPLES, RESULTS_I, sizeof(unsigned long), cmpulong);
-	qsort(RESULTS, RESULTS_I, sizeof(unsigned long), cmpulong);
-	qsort(RATES, RESULTS_I, sizeof(unsigned long), cmpulong);
-
-	compute_stats(samples_stats, SAMPLES, RESULTS_I);
-	printf("[%d] Data sample sizes:\n", pid);
-	printf("[%d]     Min: %.3f MB\n", pid, samples_stats->min / (double)MB);
-	printf("[%d]     Max: %.3f MB\n", pid, samples_stats->max / (double)MB);
-	printf("[%d]     Avg: %.3f MB\n", pid, samples_stats->avg / MB);
-	printf("[%d]   Stdev: %.3f MB\n", pid, samples_stats->stdev / MB);
-	printf("[%d]     P99: %.3f MB\n", pid, samples_stats->p99 / MB);
-	printf("[%d]     P95: %.3f MB\n", pid, samples_stats->p95 / MB);
-	printf("[%d]     P90: %.3f MB\n", pid, samples_stats->p90 / MB);
-
-	compute_stats(results_stats, RESULTS, RESULTS_I);
-	printf("[%d] Data operation times:\n", pid);
-	printf("[%d]     Min: %ld ns\n", pid, results_stats->min);
-	printf("[%d]     Max: %ld ns\n", pid, results_stats->max);
-	printf("[%d]     Avg: %.2f ns\n", pid, results_stats->avg);
-	printf("[%d]   Stdev: %.2f ns\n", pid, results_stats->stdev);
-	printf("[%d]     P99: %.2f ns\n", pid, results_stats->p99);
-	printf("[%d]     P95: %.2f ns\n", pid, results_stats->p95);
-	printf("[%d]     P90: %.2f ns\n", pid, results_stats->p90);
-
-	compute_stats(rates_stats, RATES, RESULTS_I);
-	printf("[%d] Data operation throughput:\n", pid);
-	printf("[%d]     Min: %.3f GB/s\n", pid,
-	       rates_stats->min / (double)1024);
-	printf("[%d]     Max: %.3f GB/s\n", pid,
-	       rates_stats->max / (double)1024);
-	printf("[%d]     Avg: %.3f GB/s\n", pid, rates_stats->avg / 1024);
-	printf("[%d]   Stdev: %.3f GB/s\n", pid, rates_stats->stdev / 1024);
-	printf("[%d]     P99: %.3f GB/s\n", pid,
-	       percentile(RATES, RESULTS_I, 1) / 1024);
-	printf("[%d]     P95: %.3f GB/s\n", pid,
-	       percentile(RATES, RESULTS_I, 5) / 1024);
-	printf("[%d]     P90: %.3f GB/s\n", pid,
-	       percentile(RATES, RESULTS_I, 10) / 1024);
+	if (SCENARIO.count > 1) {
+		print_phase_results(pid);
+		printf("[%d] All phases:\n", pid);
+	}
+	print_results(pid, SAMPLES, RESULTS, RATES, RESULTS_I, &WORKER->total);
+	print_segment_results(pid);
+	print_page_cache_results(pid);
+	if (LAZY_POPULATE)
+		print_populate_results(pid);
+	print_payload_results(pid);
+	print_async_results(pid);
+	if (opts.io.enabled)
+		io_report(pid, &WORKER->io, SHARED->segments);
+	if (opts.churn.rate > 0)
+		churn_report(pid, &WORKER->churn);
+	if (opts.workset.enabled)
+		workset_report(pid, &WORKER->workset);
+	if (opts.verify.enabled)
+		verify_report(pid, &WORKER->verify);
+	if (opts.ksm.enabled)
+		ksm_worker_report(pid, &WORKER->ksm);
+	if (opts.cow.enabled)
+		cow_report(pid, &WORKER->cow, DATA_SIZE);
+	if (opts.swap.enabled)
+		swap_worker_report(pid, &WORKER->swap);
+	if (SCENARIO.count == 1)
+		WORKER->phases[0] = WORKER->total;
 
 free:
+	async_stop();
+	io_stop();
+	churn_stop();
+	workset_stop();
+	verify_stop();
+	cow_stop();
+	locality_stop();
+	migration_stop();
+	swap_stop();
+	if (!child)
+		cgroup_sampler_stop();
+	if (!child && SHARED != NULL && SHARED->state == DONE) {
+		ksm_sample(KSM_END);
+		ksm_report();
+		swap_sample(SWAP_END);
+		swap_report();
+		cgroup_sampler_report();
+		startup_report();
+		output_write(&opts);
+	}
+	control_stop();
+	timeline_close();
 	if (opts.ready_file != NULL)
 		remove(opts.ready_file);
-	free(samples_stats);
-	free(results_stats);
-	free(DATA);
+	backing_unmap(DATA, DATA_SIZE);
+	populate_free();
+	verify_free();
+	fingerprint_free();
+	swap_free();
+	free(SAMPLES);
 	free(RESULTS);
+	free(RATES);
+	free(PHASE_IDS);
 	pthread_cond_destroy(&TICK);
 	pthread_mutex_destroy(&TICK_LOCK);
 
@@ -444,6 +1573,8 @@ free:
 
 int main(int argc, char **argv)
 {
+	startup_mark(STARTUP_PROCESS);
+
 	int opt;
 	int data_size = 10;
 	int test_duration = 10;
@@ -452,8 +1583,105 @@ int main(int argc, char **argv)
 	bool quick = false, numa = false;
 	enum MemOp mem_op = READ;
 	char *ready_file = NULL;
+	char *scenario_file = NULL;
+	char *timeline_file = NULL;
+	char *control_socket = NULL;
+	int summary_interval = -1;
+	if (argc > 1 && !strcmp(argv[1], "compare"))
+		return compare_main(argc - 1, argv + 1);
+
+	enum OutputFormat output = OUTPUT_NONE;
+	char *output_file = NULL;
+	enum Placement placement = PLACEMENT_BIND;
+	int data_node = 0;
+	int locality = -1;
+	double relocalize = 0;
+	struct cpulist worker_cpus = { 0 }, tick_cpus = { 0 }, aux_cpus = { 0 };
+	int fifo = 0;
+	bool lock = false;
+	enum ClockSource clock = CLOCK_SOURCE_MONOTONIC;
+	int migration_check = 1;
+	struct backing backing = { 0 };
+	struct io_opts io = { 0 };
+	enum Populate populate = POPULATE_EAGER;
+	struct churn_opts churn = { 0 };
+	struct workset_opts workset = { 0 };
+	struct verify_opts verify = { 0 };
+	int fingerprint_threads = 0;
+	struct payload_mix payload = { .weight[PAYLOAD_ZERO] = 1, .total = 1 };
+	bool payload_set = false;
+	struct sparse_opts sparse = { .count = 8, .pages_pct = 100 };
+	bool sparse_set = false;
+	struct ksm_opts ksm = { 0 };
+	struct cow_opts cow = { 0 };
+	struct swap_opts swap = { 0 };
+	int cgroup_stats_ms = 0;
+	int async_depth = 0;
+	int async_threads = 0;
+
+	// Options without a short form use codes outside of the char range.
+	enum {
+		OPT_OUTPUT = 256,
+		OPT_OUTPUT_FILE,
+		OPT_PLACEMENT,
+		OPT_LOCALITY,
+		OPT_RELOCALIZE,
+		OPT_CPUS,
+		OPT_TICK_CPUS,
+		OPT_AUX_CPUS,
+		OPT_FIFO,
+		OPT_MLOCK,
+		OPT_CLOCK,
+		OPT_MIGRATION_CHECK,
+		OPT_BACKING,
+		OPT_IO,
+		OPT_ASYNC,
+		OPT_CHURN,
+		OPT_WORKING_SET,
+		OPT_POPULATE,
+		OPT_VERIFY,
+		OPT_FINGERPRINT,
+		OPT_PAYLOAD,
+		OPT_SPARSE,
+		OPT_KSM,
+		OPT_COW,
+		OPT_SWAP,
+		OPT_CGROUP_STATS,
+	};
+	static const struct option long_opts[] = {
+		{ "output", required_argument, NULL, OPT_OUTPUT },
+		{ "output-file", required_argument, NULL, OPT_OUTPUT_FILE },
+		{ "placement", required_argument, NULL, OPT_PLACEMENT },
+		{ "locality", required_argument, NULL, OPT_LOCALITY },
+		{ "relocalize", required_argument, NULL, OPT_RELOCALIZE },
+		{ "cpus", required_argument, NULL, OPT_CPUS },
+		{ "tick-cpus", required_argument, NULL, OPT_TICK_CPUS },
+		{ "aux-cpus", required_argument, NULL, OPT_AUX_CPUS },
+		{ "fifo", required_argument, NULL, OPT_FIFO },
+		{ "mlock", no_argument, NULL, OPT_MLOCK },
+		{ "clock", required_argument, NULL, OPT_CLOCK },
+		{ "migration-check", required_argument, NULL,
+		  OPT_MIGRATION_CHECK },
+		{ "backing", required_argument, NULL, OPT_BACKING },
+		{ "io", required_argument, NULL, OPT_IO },
+		{ "async", required_argument, NULL, OPT_ASYNC },
+		{ "churn", required_argument, NULL, OPT_CHURN },
+		{ "working-set", required_argument, NULL, OPT_WORKING_SET },
+		{ "populate", required_argument, NULL, OPT_POPULATE },
+		{ "verify", required_argument, NULL, OPT_VERIFY },
+		{ "fingerprint", optional_argument, NULL, OPT_FINGERPRINT },
+		{ "payload", required_argument, NULL, OPT_PAYLOAD },
+		{ "sparse", required_argument, NULL, OPT_SPARSE },
+		{ "ksm", required_argument, NULL, OPT_KSM },
+		{ "cow", required_argument, NULL, OPT_COW },
+		{ "swap", required_argument, NULL, OPT_SWAP },
+		{ "cgroup-stats", optional_argument, NULL, OPT_CGROUP_STATS },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
 
-	while ((opt = getopt(argc, argv, "t:d:s:r:f:nwqh")) != -1) {
+	while ((opt = getopt_long(argc, argv, "t:d:s:r:f:c:l:u:i:nwqh",
+				  long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 't':
 			test_duration = atoi(optarg);
@@ -473,12 +1701,174 @@ int main(int argc, char **argv)
 		case 'r':
 			ready_file = optarg;
 			break;
+		case 'c':
+			scenario_file = optarg;
+			break;
+		case 'l':
+			timeline_file = optarg;
+			break;
+		case 'u':
+			control_socket = optarg;
+			break;
+		case 'i':
+			summary_interval = atoi(optarg);
+			break;
 		case 'n':
 			numa = true;
 			break;
 		case 'w':
 			mem_op = WRITE;
 			break;
+		case OPT_OUTPUT:
+			if (!strcmp(optarg, "json")) {
+				output = OUTPUT_JSON;
+			} else if (!strcmp(optarg, "csv")) {
+				output = OUTPUT_CSV;
+			} else {
+				printf("Invalid output format: %s.\n", optarg);
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_OUTPUT_FILE:
+			output_file = optarg;
+			break;
+		case OPT_PLACEMENT:
+			if (placement_parse(optarg, &placement, &data_node)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_LOCALITY:
+			locality = atoi(optarg);
+			break;
+		case OPT_RELOCALIZE:
+			relocalize = atof(optarg);
+			break;
+		case OPT_CPUS:
+			if (cpulist_parse(optarg, &worker_cpus))
+				exit(EXIT_FAILURE);
+			break;
+		case OPT_TICK_CPUS:
+			if (cpulist_parse(optarg, &tick_cpus))
+				exit(EXIT_FAILURE);
+			break;
+		case OPT_AUX_CPUS:
+			if (cpulist_parse(optarg, &aux_cpus))
+				exit(EXIT_FAILURE);
+			break;
+		case OPT_FIFO:
+			fifo = atoi(optarg);
+			break;
+		case OPT_MLOCK:
+			lock = true;
+			break;
+		case OPT_BACKING:
+			if (backing_parse(optarg, &backing)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_IO:
+			if (io_parse(optarg, &io)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_ASYNC:
+			if (async_parse(optarg, &async_depth, &async_threads)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_CHURN:
+			if (churn_parse(optarg, &churn)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_WORKING_SET:
+			if (workset_parse(optarg, &workset)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_POPULATE:
+			if (populate_parse(optarg, &populate)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_PAYLOAD:
+			if (payload_parse(optarg, &payload)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			payload_set = true;
+			break;
+		case OPT_SPARSE:
+			if (payload_sparse_parse(optarg, &sparse)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			sparse_set = true;
+			break;
+		case OPT_KSM:
+			if (ksm_parse(optarg, &ksm)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_COW:
+			if (cow_parse(optarg, &cow)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_SWAP:
+			if (swap_parse(optarg, &swap)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_CGROUP_STATS:
+			cgroup_stats_ms = optarg != NULL ? atoi(optarg) : 1000;
+			if (cgroup_stats_ms < 1) {
+				printf("Cgroup sampling interval must be at least 1 ms.\n");
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_FINGERPRINT:
+			fingerprint_threads = optarg != NULL ?
+						      atoi(optarg) :
+						      sysconf(_SC_NPROCESSORS_ONLN);
+			if (fingerprint_threads < 1) {
+				printf("Fingerprint threads must be at least 1.\n");
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_VERIFY:
+			if (verify_parse(optarg, &verify)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case OPT_MIGRATION_CHECK:
+			migration_check = atoi(optarg);
+			break;
+		case OPT_CLOCK:
+			if (!strcmp(optarg, "tsc")) {
+				clock = CLOCK_SOURCE_TSC;
+			} else if (!strcmp(optarg, "monotonic")) {
+				clock = CLOCK_SOURCE_MONOTONIC;
+			} else {
+				printf("Invalid clock: %s.\n", optarg);
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'h':
 			usage();
 			exit(EXIT_SUCCESS);
@@ -493,8 +1883,8 @@ int main(int argc, char **argv)
 		usage();
 		exit(EXIT_FAILURE);
 	}
-	if (test_duration < 1) {
-		printf("Must run for more than one second.\n");
+	if (test_duration < 0) {
+		printf("Duration must be 0 to run continuously or a positive number of seconds.\n");
 		usage();
 		exit(EXIT_FAILURE);
 	}
@@ -504,6 +1894,91 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	// The command line options describe a single phase, which is also
+	// used as the defaults for every phase of a scenario file.
+	struct phase defaults = {
+		.name = "default",
+		.duration = test_duration,
+		.interval_ms = TICK_INTERVAL_MS,
+		.op_size = MEM_OP_MAX_MB * MB,
+		.rate = 0,
+		.write_pct = mem_op == WRITE ? 100 : 0,
+		.pattern = RANDOM,
+		.idle = false,
+	};
+	if (scenario_file == NULL) {
+		SCENARIO.phases[0] = defaults;
+		SCENARIO.count = 1;
+	} else if (scenario_load(&SCENARIO, scenario_file, &defaults)) {
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; scenario_file != NULL && i < SCENARIO.count; i++) {
+		if (SCENARIO.phases[i].duration < 1) {
+			printf("Phase %s must set a duration.\n",
+			       SCENARIO.phases[i].name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (summary_interval < 0)
+		summary_interval = test_duration == 0 ? 10 : 0;
+	if (fifo < 0 || fifo >= sched_get_priority_max(SCHED_FIFO)) {
+		printf("SCHED_FIFO priority must be between 1 and %d.\n",
+		       sched_get_priority_max(SCHED_FIFO) - 1);
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (populate != POPULATE_EAGER && backing.file) {
+		printf("File backed data is populated with the --backing options.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (workset.enabled && workset.shrink == SHRINK_MUNMAP &&
+	    backing.file) {
+		printf("A file backed working set can't shrink with munmap.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (verify.enabled && (populate == POPULATE_LAZY || workset.enabled)) {
+		printf("Verifying requires data that only changes when written, not --populate lazy or --working-set.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	// Every worker keeps its own checksums, so the data it verifies must
+	// only be written by it.
+	if (verify.enabled && backing.file && backing.shared && forks > 1 &&
+	    placement != PLACEMENT_PARTITION) {
+		printf("Verifying shared file backed data written by several forks requires --placement partition.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (ksm.enabled && (backing.file || populate == POPULATE_LAZY ||
+			    populate == POPULATE_NONE)) {
+		printf("KSM only merges anonymous data populated up front, not --backing file or --populate lazy or none.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (cow.enabled && backing.file && backing.shared) {
+		printf("Shared file backed data is never copied on write.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (swap.enabled && backing.file) {
+		printf("File backed data is evicted rather than swapped, its page cache misses are already reported.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	// --sparse alone makes every write sparse.
+	if (sparse_set && !payload_set)
+		payload_parse("sparse", &payload);
+	payload.sparse = sparse;
+	if (relocalize > 0 && locality < 1) {
+		printf("Relocalizing requires periodic --locality scans.\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (output_file != NULL && output == OUTPUT_NONE)
+		output = OUTPUT_JSON;
+
 	struct benchmark_opts opts = {
 		.duration = test_duration,
 		.data_size = data_size,
@@ -511,8 +1986,39 @@ int main(int argc, char **argv)
 		.seed = seed,
 		.quick = quick,
 		.numa = numa,
+		.placement = placement,
+		.data_node = data_node,
+		.locality = locality,
+		.relocalize = relocalize,
+		.worker_cpus = worker_cpus,
+		.tick_cpus = tick_cpus,
+		.aux_cpus = aux_cpus,
+		.fifo = fifo,
+		.mlock = lock,
+		.clock = clock,
+		.migration_check = migration_check,
+		.backing = backing,
+		.populate = populate,
+		.io = io,
+		.churn = churn,
+		.workset = workset,
+		.verify = verify,
+		.fingerprint_threads = fingerprint_threads,
+		.payload = payload,
+		.ksm = ksm,
+		.cow = cow,
+		.swap = swap,
+		.cgroup_stats_ms = cgroup_stats_ms,
+		.async_depth = async_depth,
+		.async_threads = async_threads,
 		.mem_op = mem_op,
 		.ready_file = ready_file,
+		.scenario_file = scenario_file,
+		.timeline_file = timeline_file,
+		.control_socket = control_socket,
+		.summary_interval = summary_interval,
+		.output = output,
+		.output_file = output_file,
 	};
 	return benchmark(opts);
 }
@@ -14,8 +14,267 @@
 	limitations under the License.
 */
 
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "scenario.h"
+#include "placement.h"
+#include "locality.h"
+#include "affinity.h"
+#include "timing.h"
+#include "migration.h"
+#include "backing.h"
+#include "io.h"
+#include "churn.h"
+#include "workset.h"
+#include "populate.h"
+#include "startup.h"
+#include "verify.h"
+#include "fingerprint.h"
+#include "payload.h"
+#include "ksm.h"
+#include "cow.h"
+#include "swap.h"
+#include "cgroup.h"
+
 #define TICK_INTERVAL_MS 33
 #define MEM_OP_MAX_MB 10
 
 #define MB (1024UL * 1024UL)
 #define GB (1024UL * MB)
+
+#define NSEC_PER_SEC 1000000000UL
+
+// WINDOW_SECONDS is how many completed seconds of rolling window histograms
+// are kept, in addition to the second in progress.
+#define WINDOW_SECONDS 60
+#define WINDOW_SLOTS (WINDOW_SECONDS + 1)
+
+enum MemOp {
+	READ,
+	WRITE,
+};
+
+// mem_request is a memory operation planned on a tick. submit_ns is when it
+// was submitted to the async pool, or 0 if it runs synchronously. Writes store
+// payload, copied from source or drawn from seed.
+struct mem_request {
+	int phase;
+	enum MemOp mem_op;
+	unsigned long offset;
+	unsigned long size;
+	unsigned long submit_ns;
+	enum Payload payload;
+	unsigned long source;
+	unsigned long seed;
+};
+
+enum OutputFormat {
+	OUTPUT_NONE,
+	OUTPUT_JSON,
+	OUTPUT_CSV,
+};
+
+// benchmark_opts are the options used to customize a benchmark run.
+struct benchmark_opts {
+	int duration;
+	int data_size;
+	int forks;
+	long seed;
+	bool quick;
+	bool numa;
+	enum Placement placement;
+	int data_node;
+	int locality;
+	double relocalize;
+	struct cpulist worker_cpus;
+	struct cpulist tick_cpus;
+	struct cpulist aux_cpus;
+	int fifo;
+	bool mlock;
+	enum ClockSource clock;
+	int migration_check;
+	struct backing backing;
+	enum Populate populate;
+	struct io_opts io;
+	struct churn_opts churn;
+	struct workset_opts workset;
+	struct verify_opts verify;
+	int fingerprint_threads;
+	struct payload_mix payload;
+	struct ksm_opts ksm;
+	struct cow_opts cow;
+	struct swap_opts swap;
+	int cgroup_stats_ms;
+	int async_depth;
+	int async_threads;
+	enum MemOp mem_op;
+	char *ready_file;
+	char *scenario_file;
+	char *timeline_file;
+	char *control_socket;
+	int summary_interval;
+	enum OutputFormat output;
+	char *output_file;
+};
+
+// stats are statistics values computed from sampled data.
+struct stats {
+	unsigned long min;
+	unsigned long max;
+	double avg;
+	double stdev;
+	double p99;
+	double p95;
+	double p90;
+};
+
+// result holds statistics about a set of memory operations. Throughput
+// percentiles are the slowest ones, so p99 is the 1st percentile.
+struct result {
+	unsigned long ops;
+	unsigned long bytes;
+	struct stats sizes;
+	struct stats times;
+	struct stats rates;
+};
+
+enum RunState {
+	LOADING,
+	READY,
+	RUNNING,
+	DONE,
+};
+
+// worker holds the statistics of a process accessing memory. It lives in
+// memory shared with the parent process so results can be inspected while
+// the benchmark runs.
+struct worker {
+	pid_t pid;
+	// cpu and node are where the worker runs, data_node where the data it
+	// accesses is placed, or -1 if it is interleaved.
+	int cpu;
+	int node;
+	int data_node;
+	// access_offset and access_size are the part of DATA the worker
+	// accesses, locality where its pages were found by the last scan.
+	unsigned long access_offset;
+	unsigned long access_size;
+	struct locality locality;
+	unsigned long relocalized;
+	unsigned long relocalize_ns;
+	// preempted counts operations that were descheduled involuntarily
+	// while being timed, involuntary_switches all such context switches
+	// of the worker.
+	unsigned long preempted;
+	unsigned long involuntary_switches;
+	// timer_jumps and timer_freq_changes count TSC discontinuities.
+	unsigned long timer_jumps;
+	unsigned long timer_freq_changes;
+	// segment_latency holds operation times split at detected migrations.
+	struct hist segment_latency[MAX_SEGMENTS];
+	// page_hits and page_misses count pages of file backed DATA that were
+	// or weren't resident before being accessed, and the latency of
+	// operations is split by whether they accessed only resident pages.
+	unsigned long page_hits;
+	unsigned long page_misses;
+	unsigned long major_faults;
+	struct hist cached_latency;
+	struct hist uncached_latency;
+	// async_saturated counts ticks that found every operation of the async
+	// pool still outstanding, queue_latency and service_latency how long
+	// async operations waited for a thread and then took to run.
+	unsigned long async_saturated;
+	struct hist queue_latency;
+	struct hist service_latency;
+	// io holds the results of the file I/O issued next to memory access.
+	struct io_stats io;
+	// churn holds the results of the allocator churn worker.
+	struct churn_stats churn;
+	// workset holds the results of a working set following a curve.
+	struct workset_stats workset;
+	// verify holds the results of verifying the data against its page
+	// checksums.
+	struct verify_stats verify;
+	// payload_ops and payload_bytes count the writes of every payload and
+	// the data they covered, payload_pages the pages they dirtied and
+	// payload_written the bytes they wrote in them.
+	unsigned long payload_ops[PAYLOADS];
+	unsigned long payload_bytes[PAYLOADS];
+	unsigned long payload_pages[PAYLOADS];
+	unsigned long payload_written[PAYLOADS];
+	// ksm holds the latency of writes to merged pages.
+	struct ksm_stats ksm;
+	// cow holds the time taken by forks of the data and the latency of
+	// writes taking copy-on-write faults.
+	struct cow_stats cow;
+	// swap holds the latency of operations on data that may be swapped
+	// out.
+	struct swap_stats swap;
+	// populate_latency holds the times of operations that populated
+	// memory, by filling pages in lazy mode or taking minor faults, and
+	// steady_latency those of the other operations.
+	unsigned long populated_pages;
+	unsigned long minor_faults;
+	unsigned long last_populate_ns;
+	struct hist populate_latency;
+	struct hist steady_latency;
+	int phase;
+	unsigned long generation;
+	unsigned long ops;
+	// latency holds operation times since the last reset.
+	struct hist latency;
+	// lifetime, sizes and rates hold every operation of the run.
+	struct hist lifetime;
+	struct hist sizes;
+	struct hist rates;
+	// total and phases hold the final results of the worker.
+	struct result total;
+	struct result phases[MAX_PHASES];
+	struct hist phase_latency[MAX_PHASES];
+	// window holds one histogram per second of the last WINDOW_SECONDS,
+	// indexed by the second since the start of the test.
+	unsigned long window_second[WINDOW_SLOTS];
+	struct hist window[WINDOW_SLOTS];
+};
+
+// shared is the state shared between the parent and the worker processes.
+struct shared {
+	volatile sig_atomic_t state;
+	unsigned long start_realtime_ns;
+	volatile sig_atomic_t paused;
+	volatile sig_atomic_t quit;
+	volatile unsigned long generation;
+	unsigned long start_ns;
+	// populate_ns is how long populating DATA took before the test.
+	unsigned long populate_ns;
+	// startup holds when the benchmark got ready and served its first
+	// operations.
+	struct startup startup;
+	// verify_requests counts requests to verify the data, which every
+	// worker handles once.
+	volatile unsigned long verify_requests;
+	// cgroup is the latest sample of the pressure and memory use of the
+	// cgroup, added to every timeline row.
+	struct cgroup_shared cgroup;
+	// segments are the parts of the run between detected migrations.
+	volatile int segments;
+	struct segment segment[MAX_SEGMENTS];
+	int workers_count;
+	struct worker workers[];
+};
+
+extern void *DATA;
+extern volatile sig_atomic_t PROCEED;
+extern struct scenario SCENARIO;
+extern struct shared *SHARED;
+
+unsigned long now_ns(void);
+void window_merge(const struct worker *w, int seconds, struct hist *res);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "affinity.h"
+#include "bench.h"
+#include "cgroup.h"
+#include "env.h"
+#include "output.h"
+#include "timeline.h"
+
+// CGROUP_COLUMNS are the timeline columns holding the latest sample.
+#define CGROUP_COLUMNS                                                      \
+	",memory_some_avg10,memory_full_avg10,memory_some_total_us,"        \
+	"memory_full_total_us,cpu_some_avg10,cpu_some_total_us,"            \
+	"memory_current,anon,file,anon_thp,file_thp,workingset_refault,"    \
+	"pgfault"
+
+// MEMORY_STAT_KEYS are the memory.stat fields sampled. Kernels before 5.9
+// count refaults as workingset_refault, later ones split them.
+static const char *MEMORY_STAT_KEYS[] = {
+	"anon",
+	"file",
+	"anon_thp",
+	"file_thp",
+	"workingset_refault",
+	"workingset_refault_anon",
+	"workingset_refault_file",
+	"pgfault",
+};
+#define MEMORY_STAT_COUNT (sizeof(MEMORY_STAT_KEYS) / sizeof(char *))
+
+static char SAMPLER_CGROUP[CGROUP_PATH_MAX];
+static int SAMPLER_INTERVAL_MS;
+static struct cgroup_shared *LATEST;
+// FIRST and LAST are the first and last samples, PEAK the highest pressure
+// and memory use seen, and SAMPLES how many samples were taken.
+static struct cgroup_sample FIRST;
+static struct cgroup_sample LAST;
+static struct cgroup_sample PEAK;
+static unsigned long SAMPLES;
+
+static pthread_t SAMPLER_TID;
+static bool SAMPLER_RUNNING = false;
+static volatile bool SAMPLER_STOP = false;
+
+// cgroup_self writes the cgroup v2 directory of the process to dir. It looks
+// for the unified hierarchy at /sys/fs/cgroup and, on hybrid hosts, at
+// /sys/fs/cgroup/unified. It returns 0 on success and -1 on failure.
+int cgroup_self(char *dir, size_t size)
+{
+	const char *root = "/sys/fs/cgroup";
+	if (access("/sys/fs/cgroup/cgroup.controllers", F_OK)) {
+		root = "/sys/fs/cgroup/unified";
+		if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK))
+			return -1;
+	}
+
+	FILE *fp = fopen("/proc/self/cgroup", "r");
+	if (fp == NULL)
+		return -1;
+	char line[CGROUP_PATH_MAX];
+	int ret = -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "0::", 3))
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		// The root cgroup is just "/".
+		const char *path = !strcmp(line + 3, "/") ? "" : line + 3;
+		if (snprintf(dir, size, "%s%s", root, path) < size)
+			ret = 0;
+		break;
+	}
+	fclose(fp);
+	return ret;
+}
+
+// cgroup_write writes value to file in the cgroup directory dir. It returns 0
+// on success and -1 on failure, leaving errno set.
+int cgroup_write(const char *dir, const char *file, const char *value)
+{
+	char path[CGROUP_PATH_MAX + 64];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	// Writes to cgroup files fail when they are flushed.
+	int ret = fputs(value, fp) < 0 ? -1 : 0;
+	if (fclose(fp))
+		ret = -1;
+	return ret;
+}
+
+// cgroup_pressure reads the PSI file of resource, such as memory or cpu, in
+// the cgroup directory dir into p. It returns 0 on success and -1 on failure.
+int cgroup_pressure(const char *dir, const char *resource, struct pressure *p)
+{
+	char path[CGROUP_PATH_MAX + 64];
+	snprintf(path, sizeof(path), "%s/%s.pressure", dir, resource);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	memset(p, 0, sizeof(*p));
+	char kind[8];
+	double avg10, avg60, avg300;
+	unsigned long total;
+	int lines = 0;
+	while (fscanf(fp, "%7s avg10=%lf avg60=%lf avg300=%lf total=%lu", kind,
+		      &avg10, &avg60, &avg300, &total) == 5) {
+		if (!strcmp(kind, "some")) {
+			p->some_avg10 = avg10;
+			p->some_total = total;
+		} else if (!strcmp(kind, "full")) {
+			p->full_avg10 = avg10;
+			p->full_total = total;
+		}
+		lines++;
+	}
+	fclose(fp);
+	return lines > 0 ? 0 : -1;
+}
+
+// cgroup_stat returns the value of key in the flat keyed file in the
+// directory dir, such as memory.stat, or -1 if it has none.
+long cgroup_stat(const char *dir, const char *file, const char *key)
+{
+	long value;
+	cgroup_stats(dir, file, &key, &value, 1);
+	return value;
+}
+
+// cgroup_stats reads the values of count keys in the flat keyed file in the
+// directory dir into values, storing -1 for the ones it has none of.
+void cgroup_stats(const char *dir, const char *file, const char **keys,
+		  long *values, int count)
+{
+	for (int i = 0; i < count; i++)
+		values[i] = -1;
+	char path[CGROUP_PATH_MAX + 64];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return;
+
+	char name[64];
+	long value;
+	while (fscanf(fp, "%63s %ld", name, &value) == 2) {
+		for (int i = 0; i < count; i++) {
+			if (!strcmp(name, keys[i]))
+				values[i] = value;
+		}
+	}
+	fclose(fp);
+}
+
+// take_sample reads the pressure and memory use of the sampled cgroup into s.
+static void take_sample(struct cgroup_sample *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->time_ns = now_ns();
+	cgroup_pressure(SAMPLER_CGROUP, "memory", &s->memory);
+	cgroup_pressure(SAMPLER_CGROUP, "cpu", &s->cpu);
+
+	char line[32], path[CGROUP_PATH_MAX + 64];
+	snprintf(path, sizeof(path), "%s/memory.current", SAMPLER_CGROUP);
+	s->current = read_line(path, line, sizeof(line)) ? -1 : atol(line);
+
+	long v[MEMORY_STAT_COUNT];
+	cgroup_stats(SAMPLER_CGROUP, "memory.stat", MEMORY_STAT_KEYS, v,
+		     MEMORY_STAT_COUNT);
+	s->anon = v[0];
+	s->file = v[1];
+	s->anon_thp = v[2];
+	s->file_thp = v[3];
+	s->workingset_refault = v[4];
+	if (v[5] >= 0 && v[6] >= 0)
+		s->workingset_refault = v[5] + v[6];
+	s->pgfault = v[7];
+}
+
+// publish makes s the latest sample.
+static void publish(const struct cgroup_sample *s)
+{
+	__atomic_add_fetch(&LATEST->seq, 1, __ATOMIC_ACQ_REL);
+	LATEST->sample = *s;
+	__atomic_add_fetch(&LATEST->seq, 1, __ATOMIC_RELEASE);
+}
+
+// latest copies the latest sample into s, retrying while it is updated.
+static void latest(struct cgroup_sample *s)
+{
+	unsigned long seq;
+	do {
+		seq = __atomic_load_n(&LATEST->seq, __ATOMIC_ACQUIRE);
+		*s = LATEST->sample;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&LATEST->seq,
+						     __ATOMIC_ACQUIRE));
+}
+
+// column appends value to buf as a column, leaving it empty if it is missing.
+static int column(char *buf, size_t size, long value)
+{
+	if (value < 0)
+		return snprintf(buf, size, ",");
+	return snprintf(buf, size, ",%ld", value);
+}
+
+// sample_columns appends the latest sample to a timeline row.
+static int sample_columns(char *buf, size_t size)
+{
+	struct cgroup_sample s;
+	latest(&s);
+	int n = snprintf(buf, size, ",%.2f,%.2f,%lu,%lu,%.2f,%lu",
+			 s.memory.some_avg10, s.memory.full_avg10,
+			 s.memory.some_total, s.memory.full_total,
+			 s.cpu.some_avg10, s.cpu.some_total);
+	long values[] = { s.current,  s.anon,		    s.file,
+			  s.anon_thp, s.file_thp,	    s.workingset_refault,
+			  s.pgfault };
+	for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		if (n >= size)
+			break;
+		n += column(buf + n, size - n, values[i]);
+	}
+	return n;
+}
+
+// record publishes s, writes it to the timeline and keeps track of the
+// first, last and peak samples.
+static void record(const struct cgroup_sample *s)
+{
+	publish(s);
+	timeline_row(s->time_ns, NULL, "cgroup_sample", NULL, 0, 0);
+	if (SAMPLES++ == 0)
+		FIRST = *s;
+	LAST = *s;
+	if (s->memory.some_avg10 > PEAK.memory.some_avg10)
+		PEAK.memory.some_avg10 = s->memory.some_avg10;
+	if (s->memory.full_avg10 > PEAK.memory.full_avg10)
+		PEAK.memory.full_avg10 = s->memory.full_avg10;
+	if (s->cpu.some_avg10 > PEAK.cpu.some_avg10)
+		PEAK.cpu.some_avg10 = s->cpu.some_avg10;
+	if (s->current > PEAK.current)
+		PEAK.current = s->current;
+}
+
+// sampler_loop samples the cgroup every SAMPLER_INTERVAL_MS until stopped.
+static void *sampler_loop(void *arg)
+{
+	pin_aux_thread();
+	struct timespec step = {
+		.tv_sec = SAMPLER_INTERVAL_MS / 1000,
+		.tv_nsec = SAMPLER_INTERVAL_MS % 1000 * 1000000L,
+	};
+	while (!SAMPLER_STOP) {
+		nanosleep(&step, NULL);
+		struct cgroup_sample s;
+		take_sample(&s);
+		record(&s);
+	}
+	return NULL;
+}
+
+// cgroup_sampler_start samples the pressure and memory use of the cgroup of
+// the process every interval_ms, publishing the latest sample in latest and
+// adding it to every timeline row. It must be called before the timeline is
+// opened. It returns 0 on success and -1 on failure.
+int cgroup_sampler_start(struct cgroup_shared *latest, int interval_ms)
+{
+	if (cgroup_self(SAMPLER_CGROUP, sizeof(SAMPLER_CGROUP))) {
+		printf("Failed to find the cgroup v2 of the process.\n");
+		return -1;
+	}
+	LATEST = latest;
+	SAMPLER_INTERVAL_MS = interval_ms;
+	SAMPLER_STOP = false;
+	PEAK.current = -1;
+
+	// Rows written before the first interval still get a sample.
+	struct cgroup_sample s;
+	take_sample(&s);
+	record(&s);
+	timeline_columns(CGROUP_COLUMNS, sample_columns);
+	if (pthread_create(&SAMPLER_TID, NULL, sampler_loop, NULL)) {
+		printf("Failed to start cgroup sampler thread.\n");
+		return -1;
+	}
+	SAMPLER_RUNNING = true;
+	printf("Sampling cgroup %s every %d ms.\n", SAMPLER_CGROUP,
+	       interval_ms);
+	return 0;
+}
+
+// cgroup_sampler_stop stops sampling the cgroup after a last sample.
+void cgroup_sampler_stop()
+{
+	if (!SAMPLER_RUNNING)
+		return;
+
+	SAMPLER_STOP = true;
+	pthread_join(SAMPLER_TID, NULL);
+	SAMPLER_RUNNING = false;
+	struct cgroup_sample s;
+	take_sample(&s);
+	record(&s);
+}
+
+// cgroup_sampler_get returns the last sample if last is set and the first one
+// otherwise, or NULL if the cgroup wasn't sampled.
+const struct cgroup_sample *cgroup_sampler_get(int last)
+{
+	if (SAMPLES == 0)
+		return NULL;
+	return last ? &LAST : &FIRST;
+}
+
+// delta returns how much a counter grew between the first and last samples,
+// or -1 if it is missing.
+static long delta(long first, long last)
+{
+	return first < 0 || last < 0 ? -1 : last - first;
+}
+
+// cgroup_sampler_report prints the peak pressure and memory use of the cgroup
+// and the faults and refaults it took.
+void cgroup_sampler_report()
+{
+	if (SAMPLES == 0)
+		return;
+
+	printf("Cgroup %s: %lu samples.\n", SAMPLER_CGROUP, SAMPLES);
+	printf("Cgroup pressure: peak memory some %.2f%%, full %.2f%%, cpu some %.2f%%, stalled memory %.3f s, cpu %.3f s.\n",
+	       PEAK.memory.some_avg10, PEAK.memory.full_avg10,
+	       PEAK.cpu.some_avg10,
+	       (LAST.memory.some_total - FIRST.memory.some_total) / 1e6,
+	       (LAST.cpu.some_total - FIRST.cpu.some_total) / 1e6);
+	if (PEAK.current >= 0)
+		printf("Cgroup memory: peak %.3f GB, %ld page faults, %ld refaults.\n",
+		       PEAK.current / (double)GB,
+		       delta(FIRST.pgfault, LAST.pgfault),
+		       delta(FIRST.workingset_refault,
+			     LAST.workingset_refault));
+}
+
+// cgroup_sample_json writes s to fp as a JSON object.
+void cgroup_sample_json(FILE *fp, const struct cgroup_sample *s)
+{
+	fprintf(fp,
+		"{\"time_ns\":%lu,\"memory_some_avg10\":%.2f,"
+		"\"memory_full_avg10\":%.2f,\"memory_some_total_us\":%lu,"
+		"\"memory_full_total_us\":%lu,\"cpu_some_avg10\":%.2f,"
+		"\"cpu_some_total_us\":%lu",
+		s->time_ns, s->memory.some_avg10, s->memory.full_avg10,
+		s->memory.some_total, s->memory.full_total,
+		s->cpu.some_avg10, s->cpu.some_total);
+	const char *names[] = { "memory_current",     "anon",	  "file",
+				"anon_thp",	      "file_thp",
+				"workingset_refault", "pgfault" };
+	long values[] = { s->current,  s->anon,	 s->file,
+			  s->anon_thp, s->file_thp, s->workingset_refault,
+			  s->pgfault };
+	for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		if (values[i] >= 0)
+			fprintf(fp, ",\"%s\":%ld", names[i], values[i]);
+		else
+			fprintf(fp, ",\"%s\":null", names[i]);
+	}
+	fprintf(fp, "}");
+}
+
+// cgroup_sampler_json writes the sampled cgroup, its first and last samples
+// and the peaks between them to fp as a JSON object.
+void cgroup_sampler_json(FILE *fp)
+{
+	if (SAMPLES == 0) {
+		fprintf(fp, "null");
+		return;
+	}
+	fprintf(fp, "{\"path\":");
+	json_string(fp, SAMPLER_CGROUP);
+	fprintf(fp, ",\"interval_ms\":%d,\"samples\":%lu,\"first\":",
+		SAMPLER_INTERVAL_MS, SAMPLES);
+	cgroup_sample_json(fp, &FIRST);
+	fprintf(fp, ",\"last\":");
+	cgroup_sample_json(fp, &LAST);
+	fprintf(fp,
+		",\"peak_memory_some_avg10\":%.2f,"
+		"\"peak_memory_full_avg10\":%.2f,\"peak_cpu_some_avg10\":%.2f,"
+		"\"peak_memory_current\":",
+		PEAK.memory.some_avg10, PEAK.memory.full_avg10,
+		PEAK.cpu.some_avg10);
+	if (PEAK.current >= 0)
+		fprintf(fp, "%ld}", PEAK.current);
+	else
+		fprintf(fp, "null}");
+}
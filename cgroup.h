@@ -0,0 +1,70 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define CGROUP_PATH_MAX 512
+
+// pressure is a line of a PSI file, with the share of time some or all tasks
+// stalled over the last 10 seconds in percent and in total in microseconds.
+struct pressure {
+	double some_avg10;
+	double full_avg10;
+	unsigned long some_total;
+	unsigned long full_total;
+};
+
+// cgroup_sample is a reading of the pressure and memory use of a cgroup.
+// Values missing in the cgroup, such as memory.current of the root, are -1.
+struct cgroup_sample {
+	unsigned long time_ns;
+	struct pressure memory;
+	struct pressure cpu;
+	long current;
+	long anon;
+	long file;
+	long anon_thp;
+	long file_thp;
+	long workingset_refault;
+	long pgfault;
+};
+
+// cgroup_shared holds the latest sample where forked workers can read it.
+// seq is odd while the sample is being updated.
+struct cgroup_shared {
+	volatile unsigned long seq;
+	struct cgroup_sample sample;
+};
+
+int cgroup_self(char *dir, size_t size);
+int cgroup_write(const char *dir, const char *file, const char *value);
+int cgroup_pressure(const char *dir, const char *resource,
+		    struct pressure *p);
+long cgroup_stat(const char *dir, const char *file, const char *key);
+void cgroup_stats(const char *dir, const char *file, const char **keys,
+		  long *values, int count);
+int cgroup_sampler_start(struct cgroup_shared *latest, int interval_ms);
+void cgroup_sampler_stop(void);
+void cgroup_sampler_report(void);
+void cgroup_sampler_json(FILE *fp);
+void cgroup_sample_json(FILE *fp, const struct cgroup_sample *s);
+const struct cgroup_sample *cgroup_sampler_get(int last);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "affinity.h"
+#include "bench.h"
+#include "churn.h"
+#include "env.h"
+#include "timeline.h"
+
+#define CHURN_MAX_OBJECTS (1UL << 22)
+#define CHURN_MAX_SIZE (16 * MB)
+// CHURN_STEP_NS is how often objects are allocated and freed.
+#define CHURN_STEP_NS 1000000
+// Arena objects are rounded up to a power of two size class and carved out
+// of ARENA_CHUNK sized mappings.
+#define ARENA_CHUNK (64 * MB)
+#define ARENA_MIN_CLASS 4
+#define ARENA_CLASSES 25
+
+const char *ALLOCATOR_STRING[] = {
+	"malloc",
+	"arena",
+	"mmap",
+};
+
+// object is a live allocation, freed once expires_ns is reached.
+struct object {
+	char *p;
+	unsigned long size;
+	unsigned long expires_ns;
+};
+
+// arena_free_obj links freed arena objects of a size class together.
+struct arena_free_obj {
+	struct arena_free_obj *next;
+};
+
+static struct churn_opts CHURN;
+static struct churn_stats *STATS;
+static unsigned int CHURN_SEED;
+// HEAP is a min-heap of the live objects ordered by expiry.
+static struct object *HEAP;
+static unsigned long HEAP_LEN;
+static unsigned long HEAP_CAP;
+
+static struct arena_free_obj *ARENA_FREE[ARENA_CLASSES];
+// ARENA_CHUNKS is the last chunk mapped, whose first word points to the one
+// mapped before it.
+static char *ARENA_CHUNKS;
+static char *ARENA_CUR;
+static unsigned long ARENA_LEFT;
+
+static pthread_t CHURN_TID;
+static bool CHURN_RUNNING = false;
+static volatile bool CHURN_STOP = false;
+
+// churn_parse parses a churn workload of the form
+// <allocs per second>[,malloc|,arena|,mmap][,size=<min>-<max>][,lifetime=<ms>].
+// It returns 0 on success and -1 on failure.
+int churn_parse(const char *arg, struct churn_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->min_size = 64;
+	o->max_size = 64 * 1024;
+	o->lifetime_ms = 1000;
+
+	char *end;
+	o->rate = strtoul(arg, &end, 10);
+	while (*end == ',') {
+		const char *opt = end + 1;
+		size_t n = strcspn(opt, ",");
+		end = (char *)opt + n;
+		int allocator = option_match(opt, n, ALLOCATOR_STRING,
+					     ALLOC_MMAP + 1);
+		if (allocator >= 0) {
+			o->allocator = allocator;
+		} else if (!strncmp(opt, "size=", 5)) {
+			o->min_size = strtoul(opt + 5, &end, 10);
+			o->max_size = o->min_size;
+			if (*end == '-')
+				o->max_size = strtoul(end + 1, &end, 10);
+		} else if (!strncmp(opt, "lifetime=", 9)) {
+			o->lifetime_ms = strtoul(opt + 9, &end, 10);
+		} else {
+			end = NULL;
+		}
+		if (end != opt + n) {
+			printf("Invalid churn option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+	}
+
+	if (*end != '\0' || o->rate == 0) {
+		printf("Invalid churn rate: %s.\n", arg);
+		return -1;
+	}
+	if (o->min_size == 0 || o->min_size > o->max_size ||
+	    o->max_size > CHURN_MAX_SIZE) {
+		printf("Churn object sizes must be between 1 and %lu bytes.\n",
+		       CHURN_MAX_SIZE);
+		return -1;
+	}
+	return 0;
+}
+
+// size_class returns the arena size class of size bytes.
+static int size_class(unsigned long size)
+{
+	int c = ARENA_MIN_CLASS;
+	while ((1UL << c) < size)
+		c++;
+	return c - ARENA_MIN_CLASS;
+}
+
+// arena_alloc returns an object of at least size bytes from the arena, reusing
+// freed objects of the same size class first.
+static char *arena_alloc(unsigned long size)
+{
+	int c = size_class(size);
+	if (ARENA_FREE[c] != NULL) {
+		struct arena_free_obj *obj = ARENA_FREE[c];
+		ARENA_FREE[c] = obj->next;
+		return (char *)obj;
+	}
+
+	unsigned long class_size = 1UL << (c + ARENA_MIN_CLASS);
+	if (ARENA_LEFT < class_size) {
+		char *chunk = mmap(NULL, ARENA_CHUNK, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED)
+			return NULL;
+		*(char **)chunk = ARENA_CHUNKS;
+		ARENA_CHUNKS = chunk;
+		// The first page holds the link to the previous chunk.
+		ARENA_CUR = chunk + sysconf(_SC_PAGESIZE);
+		ARENA_LEFT = ARENA_CHUNK - sysconf(_SC_PAGESIZE);
+	}
+	char *p = ARENA_CUR;
+	ARENA_CUR += class_size;
+	ARENA_LEFT -= class_size;
+	return p;
+}
+
+// arena_free returns an object of size bytes to its size class.
+static void arena_free(char *p, unsigned long size)
+{
+	struct arena_free_obj *obj = (struct arena_free_obj *)p;
+	int c = size_class(size);
+	obj->next = ARENA_FREE[c];
+	ARENA_FREE[c] = obj;
+}
+
+// arena_release unmaps every chunk of the arena.
+static void arena_release()
+{
+	while (ARENA_CHUNKS != NULL) {
+		char *prev = *(char **)ARENA_CHUNKS;
+		munmap(ARENA_CHUNKS, ARENA_CHUNK);
+		ARENA_CHUNKS = prev;
+	}
+	memset(ARENA_FREE, 0, sizeof(ARENA_FREE));
+	ARENA_CUR = NULL;
+	ARENA_LEFT = 0;
+}
+
+static char *obj_alloc(unsigned long size)
+{
+	switch (CHURN.allocator) {
+	case ALLOC_ARENA:
+		return arena_alloc(size);
+	case ALLOC_MMAP: {
+		char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return p == MAP_FAILED ? NULL : p;
+	}
+	default:
+		return malloc(size);
+	}
+}
+
+static void obj_free(char *p, unsigned long size)
+{
+	switch (CHURN.allocator) {
+	case ALLOC_ARENA:
+		arena_free(p, size);
+		break;
+	case ALLOC_MMAP:
+		munmap(p, size);
+		break;
+	default:
+		free(p);
+	}
+}
+
+// uniform returns a random number in [0, 1).
+static double uniform()
+{
+	return rand_r(&CHURN_SEED) / ((double)RAND_MAX + 1);
+}
+
+// heap_push adds obj to HEAP.
+static void heap_push(struct object obj)
+{
+	unsigned long i = HEAP_LEN++;
+	while (i > 0 && HEAP[(i - 1) / 2].expires_ns > obj.expires_ns) {
+		HEAP[i] = HEAP[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	HEAP[i] = obj;
+}
+
+// heap_pop removes and returns the object of HEAP expiring first.
+static struct object heap_pop()
+{
+	struct object top = HEAP[0];
+	struct object last = HEAP[--HEAP_LEN];
+	unsigned long i = 0;
+	while (2 * i + 1 < HEAP_LEN) {
+		unsigned long c = 2 * i + 1;
+		if (c + 1 < HEAP_LEN &&
+		    HEAP[c + 1].expires_ns < HEAP[c].expires_ns)
+			c++;
+		if (HEAP[c].expires_ns >= last.expires_ns)
+			break;
+		HEAP[i] = HEAP[c];
+		i = c;
+	}
+	HEAP[i] = last;
+	return top;
+}
+
+// free_object frees the object expiring first and records how long it took.
+static void free_object()
+{
+	struct object obj = heap_pop();
+	unsigned long start = now_ns();
+	obj_free(obj.p, obj.size);
+	hist_record(&STATS->free_latency, now_ns() - start);
+	STATS->frees++;
+	STATS->live_objects--;
+	STATS->live_bytes -= obj.size;
+}
+
+// alloc_object allocates an object with a log-uniform size and an exponential
+// lifetime, and writes to it so its pages become resident.
+static void alloc_object(unsigned long now)
+{
+	double lo = log(CHURN.min_size), hi = log(CHURN.max_size);
+	unsigned long size = exp(lo + uniform() * (hi - lo));
+	if (size < CHURN.min_size)
+		size = CHURN.min_size;
+	unsigned long lifetime =
+		-log(1 - uniform()) * CHURN.lifetime_ms * 1000000;
+
+	if (HEAP_LEN == HEAP_CAP)
+		free_object();
+	unsigned long start = now_ns();
+	char *p = obj_alloc(size);
+	unsigned long elapsed = now_ns() - start;
+	if (p == NULL) {
+		STATS->failures++;
+		return;
+	}
+	memset(p, 0xa5, size);
+
+	hist_record(&STATS->alloc_latency, elapsed);
+	heap_push((struct object){ p, size, now + lifetime });
+	STATS->allocs++;
+	STATS->live_objects++;
+	STATS->live_bytes += size;
+	if (STATS->live_bytes > STATS->peak_live_bytes)
+		STATS->peak_live_bytes = STATS->live_bytes;
+}
+
+// churn_loop allocates objects at the target rate, frees them as they expire
+// and records the resident set size every second, until stopped.
+static void *churn_loop(void *arg)
+{
+	pin_aux_thread();
+	struct timespec step = { .tv_nsec = CHURN_STEP_NS };
+	unsigned long last = now_ns();
+	unsigned long next_sample = last;
+	double due = 0;
+
+	while (!CHURN_STOP) {
+		nanosleep(&step, NULL);
+		unsigned long now = now_ns();
+		if (SHARED->paused) {
+			last = now;
+			continue;
+		}
+
+		while (HEAP_LEN > 0 && HEAP[0].expires_ns <= now)
+			free_object();
+		due += (now - last) * (double)CHURN.rate / NSEC_PER_SEC;
+		last = now;
+		for (; due >= 1; due--)
+			alloc_object(now);
+
+		if (now >= next_sample) {
+			unsigned long rss = resident_bytes();
+			if (rss > STATS->peak_rss)
+				STATS->peak_rss = rss;
+			timeline_row(now, NULL, "churn_rss", NULL,
+				     STATS->live_bytes, rss);
+			next_sample = now + NSEC_PER_SEC;
+		}
+	}
+	return NULL;
+}
+
+// churn_start starts allocating and freeing objects as described by o,
+// recording results in s. It returns 0 on success and -1 on failure.
+int churn_start(const struct churn_opts *o, struct churn_stats *s,
+		unsigned int seed)
+{
+	CHURN = *o;
+	STATS = s;
+	CHURN_SEED = seed;
+	CHURN_STOP = false;
+
+	// Leave room for four times the expected number of live objects.
+	HEAP_CAP = CHURN.rate * CHURN.lifetime_ms / 1000 * 4 + 1024;
+	if (HEAP_CAP > CHURN_MAX_OBJECTS)
+		HEAP_CAP = CHURN_MAX_OBJECTS;
+	HEAP_LEN = 0;
+	HEAP = calloc(HEAP_CAP, sizeof(struct object));
+	if (HEAP == NULL) {
+		printf("Failed to allocate the churn heap.\n");
+		return -1;
+	}
+	if (pthread_create(&CHURN_TID, NULL, churn_loop, NULL)) {
+		printf("Failed to start churn thread.\n");
+		free(HEAP);
+		HEAP = NULL;
+		return -1;
+	}
+	CHURN_RUNNING = true;
+	printf("[%d] Allocating %lu objects of %lu to %lu bytes per second with %s, living %lums.\n",
+	       getpid(), CHURN.rate, CHURN.min_size, CHURN.max_size,
+	       ALLOCATOR_STRING[CHURN.allocator], CHURN.lifetime_ms);
+	return 0;
+}
+
+// churn_stop stops the churn thread and frees the objects still alive.
+void churn_stop()
+{
+	if (!CHURN_RUNNING)
+		return;
+
+	CHURN_STOP = true;
+	pthread_join(CHURN_TID, NULL);
+	CHURN_RUNNING = false;
+
+	// Keep the live statistics of the end of the run.
+	for (unsigned long i = 0; i < HEAP_LEN; i++)
+		obj_free(HEAP[i].p, HEAP[i].size);
+	free(HEAP);
+	HEAP = NULL;
+	HEAP_LEN = 0;
+	arena_release();
+}
+
+// churn_report prints the results of the churn worker.
+void churn_report(pid_t pid, const struct churn_stats *s)
+{
+	printf("[%d] Churn: %lu allocations, %lu frees, %lu failures, %lu objects (%.3f MB) live, %.3f MB at peak.\n",
+	       pid, s->allocs, s->frees, s->failures, s->live_objects,
+	       s->live_bytes / (double)MB, s->peak_live_bytes / (double)MB);
+	printf("[%d] Peak RSS: %.3f MB.\n", pid, s->peak_rss / (double)MB);
+	const struct hist *h[] = { &s->alloc_latency, &s->free_latency };
+	const char *name[] = { "Allocation", "Free" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s latency: p50 %.2f ns, p99 %.2f ns, max %lu ns.\n",
+		       pid, name[i], hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99), h[i]->max);
+	}
+}
+
+// churn_json writes s to fp as a JSON object.
+void churn_json(FILE *fp, const struct churn_stats *s)
+{
+	fprintf(fp,
+		"{\"allocs\":%lu,\"frees\":%lu,\"failures\":%lu,"
+		"\"live_objects\":%lu,\"live_bytes\":%lu,"
+		"\"peak_live_bytes\":%lu,\"peak_rss_bytes\":%lu,"
+		"\"alloc_latency_ns\":",
+		s->allocs, s->frees, s->failures, s->live_objects,
+		s->live_bytes, s->peak_live_bytes, s->peak_rss);
+	hist_json(fp, &s->alloc_latency);
+	fprintf(fp, ",\"free_latency_ns\":");
+	hist_json(fp, &s->free_latency);
+	fprintf(fp, "}");
+}
@@ -0,0 +1,68 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef CHURN_H
+#define CHURN_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "hist.h"
+
+// Allocator is how the churn worker allocates its objects.
+enum Allocator {
+	// ALLOC_MALLOC uses the glibc malloc and free.
+	ALLOC_MALLOC,
+	// ALLOC_ARENA uses a built-in allocator carving objects out of large
+	// chunks that are never returned to the kernel.
+	ALLOC_ARENA,
+	// ALLOC_MMAP maps every object separately.
+	ALLOC_MMAP,
+};
+
+extern const char *ALLOCATOR_STRING[];
+
+// churn_opts describe a heap of objects that are allocated at rate per second
+// and freed after lifetime_ms on average.
+struct churn_opts {
+	unsigned long rate;
+	enum Allocator allocator;
+	unsigned long min_size;
+	unsigned long max_size;
+	unsigned long lifetime_ms;
+};
+
+// churn_stats are the results of the churn worker of a process.
+struct churn_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long failures;
+	unsigned long live_objects;
+	unsigned long live_bytes;
+	unsigned long peak_live_bytes;
+	unsigned long peak_rss;
+	struct hist alloc_latency;
+	struct hist free_latency;
+};
+
+int churn_parse(const char *arg, struct churn_opts *o);
+int churn_start(const struct churn_opts *o, struct churn_stats *s,
+		unsigned int seed);
+void churn_stop(void);
+void churn_report(pid_t pid, const struct churn_stats *s);
+void churn_json(FILE *fp, const struct churn_stats *s);
+
+#endif
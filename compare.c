@@ -0,0 +1,375 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "bench.h"
+#include "hist.h"
+#include "json.h"
+#include "output.h"
+#include "compare.h"
+
+// metric is a latency statistic that can be compared between results.
+struct metric {
+	const char *name;
+	double percentile;
+};
+
+// A negative percentile selects a statistic that isn't a percentile.
+static const struct metric METRICS[] = {
+	{ "avg", -1 }, { "p50", 50 },	{ "p90", 90 },	{ "p95", 95 },
+	{ "p99", 99 }, { "p999", 99.9 }, { "max", -2 },
+};
+#define METRICS_COUNT (sizeof(METRICS) / sizeof(METRICS[0]))
+
+// compare_opts configures when a difference counts as a regression.
+struct compare_opts {
+	const struct metric *metric;
+	double threshold;
+	double alpha;
+};
+
+// mann_whitney holds the result of a Mann-Whitney U test.
+struct mann_whitney {
+	double z;
+	double p;
+	double p_greater;
+};
+
+static void compare_usage()
+{
+	printf("Usage:\n"
+	       "  bench compare [-h] [-t <percent>] [-a <alpha>] [-m <metric>] <base.json> <new.json>\n"
+	       "  bench compare [-h] [-t <percent>] [-a <alpha>] [-m <metric>] <result.json>\n"
+	       "\nOptions:\n"
+	       "  -h  Display this help message.\n"
+	       "  -t  Increase of the metric in percent that counts as a regression [default: 10].\n"
+	       "  -a  Significance level of the Mann-Whitney U test [default: 0.01].\n"
+	       "  -m  Latency metric to check, one of avg, p50, p90, p95, p99, p999, max [default: p99].\n");
+}
+
+// load_hist fills h with the latency histogram v written by hist_json. The sums
+// are rebuilt from the average and standard deviation.
+static int load_hist(const struct json *v, struct hist *h)
+{
+	hist_reset(h);
+	struct json *buckets = json_get(v, "buckets");
+	if (buckets == NULL || buckets->type != JSON_ARRAY)
+		return -1;
+
+	for (int i = 0; i < buckets->count; i++) {
+		struct json *b = &buckets->items[i];
+		if (b->type != JSON_ARRAY || b->count != 3)
+			return -1;
+		int index = hist_bucket_index(b->items[0].number);
+		h->buckets[index] += b->items[2].number;
+	}
+	h->count = json_number(v, "count");
+	h->min = json_number(v, "min");
+	h->max = json_number(v, "max");
+	double avg = json_number(v, "avg"), stdev = json_number(v, "stdev");
+	h->sum = avg * h->count;
+	h->sum_sq = h->sum * avg;
+	if (h->count > 1)
+		h->sum_sq += stdev * stdev * (h->count - 1);
+	return 0;
+}
+
+// metric_value returns the statistic m of h.
+static double metric_value(const struct hist *h, const struct metric *m)
+{
+	if (m->percentile == -1)
+		return h->count ? h->sum / h->count : 0;
+	if (m->percentile == -2)
+		return h->max;
+	return hist_percentile(h, m->percentile);
+}
+
+// mann_whitney_test compares the distributions of base and new. Values in the
+// same bucket are treated as ties, which only makes the test more
+// conservative.
+static void mann_whitney_test(const struct hist *base, const struct hist *new,
+			      struct mann_whitney *res)
+{
+	double n1 = base->count, n2 = new->count, n = n1 + n2;
+	double below = 0, rank_sum = 0, ties = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		double t = (double)base->buckets[i] + new->buckets[i];
+		if (t == 0)
+			continue;
+		rank_sum += new->buckets[i] * (below + (t + 1) / 2);
+		ties += t * t * t - t;
+		below += t;
+	}
+
+	double u = rank_sum - n2 * (n2 + 1) / 2;
+	double mean = n1 * n2 / 2;
+	double var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+	res->p_greater = u / (n1 * n2);
+	res->z = 0;
+	res->p = 1;
+	if (var > 0) {
+		res->z = (u - mean) / sqrt(var);
+		res->p = erfc(fabs(res->z) / sqrt(2));
+	}
+}
+
+// compare_hists prints the differences between two latency histograms and
+// returns whether new is a significant regression over base.
+static bool compare_hists(const char *name, const struct hist *base,
+			  const struct hist *new,
+			  const struct compare_opts *opts)
+{
+	printf("%s:\n", name);
+	printf("  %-8s %14s %14s %10s\n", "Metric", "Base", "New", "Delta");
+	printf("  %-8s %14lu %14lu %+9.2f%%\n", "ops", base->count, new->count,
+	       base->count ? ((double)new->count / base->count - 1) * 100 : 0);
+	for (int i = 0; i < METRICS_COUNT; i++) {
+		double b = metric_value(base, &METRICS[i]);
+		double n = metric_value(new, &METRICS[i]);
+		printf("  %-8s %11.2f ns %11.2f ns %+9.2f%%\n", METRICS[i].name,
+		       b, n, b > 0 ? (n / b - 1) * 100 : 0);
+	}
+
+	if (base->count < 2 || new->count < 2) {
+		printf("  Not enough operations to compare.\n\n");
+		return false;
+	}
+
+	struct mann_whitney mw;
+	mann_whitney_test(base, new, &mw);
+	printf("  Mann-Whitney U: z = %.3f, p = %.4g, P(new > base) = %.3f\n",
+	       mw.z, mw.p, mw.p_greater);
+
+	double b = metric_value(base, opts->metric);
+	double n = metric_value(new, opts->metric);
+	double delta = b > 0 ? (n / b - 1) * 100 : 0;
+	bool significant = mw.p < opts->alpha && mw.p_greater > 0.5;
+	bool regression = significant && delta > opts->threshold;
+	printf("  %s %+.2f%% (threshold %.2f%%), %s.\n\n", opts->metric->name,
+	       delta, opts->threshold,
+	       regression  ? "regression" :
+	       significant ? "significant but within threshold" :
+			     "no significant difference");
+	return regression;
+}
+
+// phase_hist returns the merged latency histogram of phase name in the
+// results, or NULL if the phase doesn't exist.
+static struct json *phase_hist(const struct json *total, const char *name)
+{
+	struct json *phases = json_get(total, "phases");
+	for (int i = 0; phases != NULL && i < phases->count; i++) {
+		const char *phase = json_str(&phases->items[i], "name");
+		if (phase != NULL && !strcmp(phase, name))
+			return json_get(&phases->items[i], "latency_ns");
+	}
+	return NULL;
+}
+
+// warn_differences points out settings that differ between the runs, since
+// they make the comparison less meaningful.
+static void warn_differences(const struct json *base, const struct json *new)
+{
+	static const char *const keys[][2] = {
+		{ "config", "data_size_bytes" },
+		{ "config", "forks" },
+		{ "environment", "cpu_model" },
+		{ "environment", "kernel" },
+		{ "environment", "thp_enabled" },
+		{ "environment", "numa_nodes" },
+	};
+
+	for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		struct json *b = json_get(json_get(base, keys[i][0]), keys[i][1]);
+		struct json *n = json_get(json_get(new, keys[i][0]), keys[i][1]);
+		if (b == NULL || n == NULL || b->type != n->type)
+			continue;
+		if (b->type == JSON_STRING && strcmp(b->string, n->string))
+			printf("Warning: %s differs: %s vs %s.\n", keys[i][1],
+			       b->string, n->string);
+		else if (b->type == JSON_NUMBER && b->number != n->number)
+			printf("Warning: %s differs: %.0f vs %.0f.\n",
+			       keys[i][1], b->number, n->number);
+	}
+}
+
+// load_results reads a result file written with --output json.
+static struct json *load_results(const char *path)
+{
+	struct json *v = json_load(path);
+	if (v == NULL)
+		return NULL;
+
+	int version = json_number(v, "schema_version");
+	if (version < 1 || version > OUTPUT_SCHEMA_VERSION ||
+	    json_get(json_get(v, "total"), "latency_ns") == NULL) {
+		printf("%s: not a result file of a supported version.\n", path);
+		json_free(v);
+		return NULL;
+	}
+
+	struct json *workers = json_get(v, "workers");
+	printf("%s: %d workers, %.0f operations.\n", path,
+	       workers != NULL ? workers->count : 0,
+	       json_number(json_get(v, "total"), "ops"));
+	return v;
+}
+
+// compare_segments compares the latency before the first and after the last
+// migration detected in a single result file.
+static int compare_segments(const char *path, const struct compare_opts *opts)
+{
+	int ret = EXIT_FAILURE;
+	struct hist *h = malloc(2 * sizeof(struct hist));
+	struct json *v = load_results(path);
+	if (h == NULL || v == NULL)
+		goto free;
+
+	struct json *segments = json_get(v, "segments");
+	if (segments == NULL || segments->type != JSON_ARRAY ||
+	    segments->count < 2) {
+		printf("No migration was detected in %s.\n", path);
+		goto free;
+	}
+	struct json *pre = &segments->items[0];
+	struct json *post = &segments->items[segments->count - 1];
+	if (load_hist(json_get(pre, "latency_ns"), &h[0]) ||
+	    load_hist(json_get(post, "latency_ns"), &h[1])) {
+		printf("Invalid latency histogram.\n");
+		goto free;
+	}
+
+	const char *reasons = json_str(post, "reasons");
+	printf("Segment %d started at %.3f s, detected by %s.\n\n",
+	       segments->count - 1, json_number(post, "start_ns") / 1e9,
+	       reasons != NULL ? reasons : "unknown");
+	bool regression = compare_hists("Pre-migration vs post-migration",
+					&h[0], &h[1], opts);
+	printf("%s\n", regression ? "Regression detected." :
+				    "No regression detected.");
+	ret = regression ? EXIT_REGRESSION : EXIT_SUCCESS;
+
+free:
+	json_free(v);
+	free(h);
+	return ret;
+}
+
+// compare_main implements the compare sub-command, which compares the latency
+// of two result files written with --output json. Results of multiple forks
+// are compared using the histograms merged across all workers.
+int compare_main(int argc, char **argv)
+{
+	int opt;
+	struct compare_opts opts = {
+		.metric = &METRICS[4],
+		.threshold = 10,
+		.alpha = 0.01,
+	};
+
+	optind = 1;
+	while ((opt = getopt(argc, argv, "t:a:m:h")) != -1) {
+		switch (opt) {
+		case 't':
+			opts.threshold = atof(optarg);
+			break;
+		case 'a':
+			opts.alpha = atof(optarg);
+			break;
+		case 'm':
+			opts.metric = NULL;
+			for (int i = 0; i < METRICS_COUNT; i++) {
+				if (!strcmp(optarg, METRICS[i].name))
+					opts.metric = &METRICS[i];
+			}
+			if (opts.metric == NULL) {
+				printf("Invalid metric: %s.\n", optarg);
+				compare_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			compare_usage();
+			return EXIT_SUCCESS;
+		default:
+			compare_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (opts.alpha <= 0 || opts.alpha >= 1) {
+		printf("Significance level must be between 0 and 1.\n");
+		return EXIT_FAILURE;
+	}
+	if (argc - optind == 1)
+		return compare_segments(argv[optind], &opts);
+	if (argc - optind != 2) {
+		compare_usage();
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_FAILURE;
+	struct hist *h = malloc(2 * sizeof(struct hist));
+	struct json *base = load_results(argv[optind]);
+	struct json *new = load_results(argv[optind + 1]);
+	if (h == NULL || base == NULL || new == NULL)
+		goto free;
+	warn_differences(base, new);
+	printf("\n");
+
+	struct json *base_total = json_get(base, "total");
+	struct json *new_total = json_get(new, "total");
+	if (load_hist(json_get(base_total, "latency_ns"), &h[0]) ||
+	    load_hist(json_get(new_total, "latency_ns"), &h[1])) {
+		printf("Invalid latency histogram.\n");
+		goto free;
+	}
+	bool regression = compare_hists("All phases", &h[0], &h[1], &opts);
+
+	// Compare the phases both runs have in common when there are several.
+	struct json *phases = json_get(base_total, "phases");
+	for (int i = 0; phases != NULL && phases->count > 1 &&
+			i < phases->count;
+	     i++) {
+		const char *name = json_str(&phases->items[i], "name");
+		if (name == NULL)
+			continue;
+		struct json *b = phase_hist(base_total, name);
+		struct json *n = phase_hist(new_total, name);
+		if (b == NULL || n == NULL || load_hist(b, &h[0]) ||
+		    load_hist(n, &h[1]))
+			continue;
+
+		char title[PHASE_NAME_MAX + 8];
+		snprintf(title, sizeof(title), "Phase %s", name);
+		regression |= compare_hists(title, &h[0], &h[1], &opts);
+	}
+
+	printf("%s\n", regression ? "Regression detected." :
+				    "No regression detected.");
+	ret = regression ? EXIT_REGRESSION : EXIT_SUCCESS;
+
+free:
+	json_free(base);
+	json_free(new);
+	free(h);
+	return ret;
+}
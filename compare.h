@@ -0,0 +1,26 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+// EXIT_REGRESSION is returned by compare_main when a significant regression
+// is found, to tell it apart from failures to read the results.
+#define EXIT_REGRESSION 2
+
+int compare_main(int argc, char **argv);
+
+#endif
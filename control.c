@@ -0,0 +1,361 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "bench.h"
+#include "affinity.h"
+#include "control.h"
+#include "timeline.h"
+#include "locality.h"
+
+// The control socket accepts newline terminated commands and answers every
+// command with a single line. Commands are:
+//
+//	status          Report the benchmark state as JSON.
+//	start           Start the test, or resume it after stop.
+//	stop            Pause memory accesses.
+//	mark <label>    Record a timestamped mark in the timeline.
+//	snapshot        Report the current latency histograms as JSON.
+//	reset           Clear the histograms reported by snapshot.
+//	locality        Scan the NUMA nodes of the data of every worker.
+//	relocalize      Move the data of every worker back to its node.
+//	quit            End the test early.
+#define CONTROL_LINE_MAX 256
+
+static const char *RUN_STATE_STRING[] = {
+	"loading",
+	"ready",
+	"running",
+	"done",
+};
+
+static int CONTROL_FD = -1;
+static char CONTROL_PATH[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t CONTROL_TID;
+static pthread_t MAIN_TID;
+static pid_t CONTROL_PID;
+
+// current_phase returns the name of the phase the first worker is running.
+static const char *current_phase()
+{
+	if (SHARED->state != RUNNING)
+		return NULL;
+	return SCENARIO.phases[SHARED->workers[0].phase].name;
+}
+
+// elapsed_ns returns the time since the test started.
+static unsigned long elapsed_ns()
+{
+	if (SHARED->state < RUNNING)
+		return 0;
+	return now_ns() - SHARED->start_ns;
+}
+
+// wake_main interrupts the main thread while it waits for SIGUSR1.
+static void wake_main()
+{
+	PROCEED = 1;
+	pthread_kill(MAIN_TID, SIGUSR1);
+}
+
+// cmd_snapshot writes the latency histograms of every worker, including its
+// rolling windows, and of all workers combined as a single line of JSON.
+static void cmd_snapshot(FILE *out)
+{
+	static const int windows[] = { 1, 10, 60 };
+	struct hist *total = calloc(1, sizeof(struct hist));
+	struct hist *window = calloc(1, sizeof(struct hist));
+	if (total == NULL || window == NULL) {
+		fprintf(out, "error out of memory\n");
+		free(total);
+		free(window);
+		return;
+	}
+
+	fprintf(out,
+		"{\"time_ns\":%lu,\"state\":\"%s\",\"generation\":%lu,"
+		"\"workers\":[",
+		elapsed_ns(), RUN_STATE_STRING[SHARED->state],
+		SHARED->generation);
+	for (int i = 0; i < SHARED->workers_count; i++) {
+		struct worker *w = &SHARED->workers[i];
+		fprintf(out,
+			"%s{\"worker\":%d,\"pid\":%d,\"phase\":\"%s\","
+			"\"ops\":%lu,\"latency_ns\":",
+			i ? "," : "", i, w->pid, SCENARIO.phases[w->phase].name,
+			w->ops);
+		hist_json(out, &w->latency);
+		for (int j = 0; j < sizeof(windows) / sizeof(windows[0]); j++) {
+			hist_reset(window);
+			window_merge(w, windows[j], window);
+			fprintf(out, ",\"window_%ds_ns\":", windows[j]);
+			hist_json(out, window);
+		}
+		fprintf(out, "}");
+		hist_merge(total, &w->latency);
+	}
+	fprintf(out, "],\"total\":{\"latency_ns\":");
+	hist_json(out, total);
+	fprintf(out, "}}\n");
+	free(total);
+	free(window);
+}
+
+// cmd_locality scans the data of every worker, optionally moving it back to
+// the node it was placed on first, and reports the result as JSON.
+static void cmd_locality(FILE *out, bool relocalize)
+{
+	if (SHARED->state != RUNNING) {
+		fprintf(out, "error not running\n");
+		return;
+	}
+
+	fprintf(out, "{\"time_ns\":%lu,\"workers\":[", elapsed_ns());
+	for (int i = 0; i < SHARED->workers_count; i++) {
+		struct worker *w = &SHARED->workers[i];
+		long moved = 0;
+		unsigned long start = now_ns();
+		if (relocalize) {
+			moved = locality_relocalize(w);
+			timeline_row(start, current_phase(), "relocalize", NULL,
+				     moved > 0 ? moved : 0, now_ns() - start);
+		}
+		fprintf(out, "%s{\"worker\":%d,\"pid\":%d,\"data_node\":%d,",
+			i ? "," : "", i, w->pid, w->data_node);
+		if (relocalize)
+			fprintf(out, "\"moved\":%ld,\"move_ns\":%lu,", moved,
+				now_ns() - start);
+		fprintf(out, "\"locality\":");
+		if (locality_scan(w) == 0)
+			locality_json(out, &w->locality);
+		else
+			fprintf(out, "null");
+		fprintf(out, "}");
+	}
+	fprintf(out, "]}\n");
+}
+
+// cmd_mark records label in the timeline. Characters that would break the CSV
+// format are replaced.
+static void cmd_mark(FILE *out, char *label)
+{
+	if (*label == '\0') {
+		fprintf(out, "error mark requires a label\n");
+		return;
+	}
+	for (char *c = label; *c != '\0'; c++) {
+		if (*c == ',' || *c == '"' || !isprint((unsigned char)*c))
+			*c = '_';
+	}
+
+	unsigned long t = now_ns();
+	timeline_row(t, current_phase(), "mark", label, 0, 0);
+	timeline_flush();
+	printf("Mark %s at %.3f s.\n", label,
+	       SHARED->state == RUNNING ? (t - SHARED->start_ns) /
+						  (double)NSEC_PER_SEC :
+					  0.0);
+	fflush(stdout);
+	fprintf(out, "ok %lu\n", elapsed_ns());
+}
+
+// handle_command executes a single control command and writes its reply to
+// out. It returns false if the connection should be closed.
+static bool handle_command(char *line, FILE *out)
+{
+	char *cmd = line;
+	char *arg = strchr(line, ' ');
+	if (arg != NULL) {
+		*arg++ = '\0';
+		while (*arg == ' ')
+			arg++;
+	} else {
+		arg = "";
+	}
+
+	if (!strcmp(cmd, "status")) {
+		const char *phase = current_phase();
+		fprintf(out,
+			"{\"state\":\"%s\",\"paused\":%s,\"phase\":\"%s\","
+			"\"elapsed_ns\":%lu}\n",
+			RUN_STATE_STRING[SHARED->state],
+			SHARED->paused ? "true" : "false", phase ? phase : "",
+			elapsed_ns());
+	} else if (!strcmp(cmd, "start")) {
+		if (SHARED->state < READY) {
+			fprintf(out, "error not ready\n");
+			return true;
+		}
+		SHARED->paused = 0;
+		if (SHARED->state == READY)
+			wake_main();
+		timeline_row(now_ns(), current_phase(), "start", NULL, 0, 0);
+		fprintf(out, "ok\n");
+	} else if (!strcmp(cmd, "stop")) {
+		SHARED->paused = 1;
+		timeline_row(now_ns(), current_phase(), "stop", NULL, 0, 0);
+		fprintf(out, "ok\n");
+	} else if (!strcmp(cmd, "mark")) {
+		cmd_mark(out, arg);
+	} else if (!strcmp(cmd, "snapshot")) {
+		cmd_snapshot(out);
+	} else if (!strcmp(cmd, "reset")) {
+		SHARED->generation++;
+		timeline_row(now_ns(), current_phase(), "reset", NULL, 0, 0);
+		fprintf(out, "ok\n");
+	} else if (!strcmp(cmd, "locality")) {
+		cmd_locality(out, false);
+	} else if (!strcmp(cmd, "relocalize")) {
+		cmd_locality(out, true);
+	} else if (!strcmp(cmd, "verify")) {
+		if (verify_request())
+			fprintf(out, "error verify not enabled\n");
+		else
+			fprintf(out, "ok\n");
+	} else if (!strcmp(cmd, "quit")) {
+		SHARED->quit = 1;
+		if (SHARED->state == READY)
+			wake_main();
+		fprintf(out, "ok\n");
+		return false;
+	} else {
+		fprintf(out, "error unknown command %s\n", cmd);
+	}
+	return true;
+}
+
+// serve handles commands from a single client until it disconnects.
+static void serve(int fd)
+{
+	FILE *in = fdopen(fd, "r");
+	FILE *out = fdopen(dup(fd), "w");
+	if (in == NULL || out == NULL) {
+		if (in != NULL)
+			fclose(in);
+		else
+			close(fd);
+		if (out != NULL)
+			fclose(out);
+		return;
+	}
+
+	char line[CONTROL_LINE_MAX];
+	while (fgets(line, sizeof(line), in) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+		bool more = handle_command(line, out);
+		// A client that went away ends its session.
+		if (fflush(out) || ferror(out) || !more)
+			break;
+	}
+	fclose(out);
+	fclose(in);
+}
+
+// control_loop accepts control connections until the process exits.
+static void *control_loop(void *arg)
+{
+	pin_aux_thread();
+	while (true) {
+		int fd = accept(CONTROL_FD, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			printf("WARN: Control socket failed: %s\n",
+			       strerror(errno));
+			return NULL;
+		}
+		serve(fd);
+	}
+	return NULL;
+}
+
+// control_start listens for control commands on a Unix domain socket at path.
+// It must be called from the main thread. It returns 0 on success and -1 on
+// failure.
+int control_start(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Control socket path is too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	CONTROL_FD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (CONTROL_FD == -1) {
+		printf("Failed to create control socket: %s\n",
+		       strerror(errno));
+		return -1;
+	}
+	if (unlink(path) && errno != ENOENT) {
+		printf("Failed to delete control socket: %s\n",
+		       strerror(errno));
+		goto fail;
+	}
+	if (bind(CONTROL_FD, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(CONTROL_FD, 4)) {
+		printf("Failed to listen on control socket %s: %s\n", path,
+		       strerror(errno));
+		goto fail;
+	}
+	strcpy(CONTROL_PATH, path);
+	CONTROL_PID = getpid();
+	// Replies to a client that disconnected fail with EPIPE instead of
+	// killing the benchmark.
+	signal(SIGPIPE, SIG_IGN);
+
+	// Keep SIGUSR1 out of the control thread so it always reaches the
+	// main thread while it waits to start.
+	sigset_t set, old_set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	MAIN_TID = pthread_self();
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+	int err = pthread_create(&CONTROL_TID, NULL, control_loop, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	if (err) {
+		printf("Failed to start control thread: %s\n", strerror(err));
+		goto fail;
+	}
+
+	printf("Listening for control commands on %s.\n", path);
+	return 0;
+
+fail:
+	close(CONTROL_FD);
+	CONTROL_FD = -1;
+	return -1;
+}
+
+// control_stop removes the control socket. Forked workers leave it alone.
+void control_stop()
+{
+	if (CONTROL_FD == -1 || getpid() != CONTROL_PID)
+		return;
+	unlink(CONTROL_PATH);
+}
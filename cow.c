@@ -0,0 +1,292 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "affinity.h"
+#include "bench.h"
+#include "cow.h"
+#include "pagemap.h"
+#include "timeline.h"
+
+// COW_POLL_NS is how often the storm thread checks whether it was stopped
+// while waiting for the next storm.
+#define COW_POLL_NS (100 * 1000000UL)
+
+static struct cow_opts COW;
+static struct cow_stats *STATS;
+static char *COW_DATA;
+static unsigned long COW_SIZE;
+static unsigned int COW_SEED;
+static pid_t CHILDREN[COW_MAX_CHILDREN];
+
+static pthread_t COW_TID;
+static bool COW_RUNNING = false;
+static volatile bool COW_STOP = false;
+
+// cow_parse parses a fork storm of the form
+// <children>[,at=<s>][,every=<s>][,hold=<s>][,rate=<writes/s>]. It returns 0
+// on success and -1 on failure.
+int cow_parse(const char *arg, struct cow_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->enabled = true;
+	o->at = 1;
+	o->hold = 5;
+	o->rate = 1000;
+
+	char *end;
+	long rate = o->rate;
+	o->children = strtol(arg, &end, 10);
+	if (end == arg) {
+		printf("Invalid fork storm children: %s.\n", arg);
+		return -1;
+	}
+	while (*end == ',') {
+		const char *opt = end + 1;
+		size_t n = strcspn(opt, ",");
+		end = (char *)opt + n;
+		if (!strncmp(opt, "at=", 3))
+			o->at = strtol(opt + 3, &end, 10);
+		else if (!strncmp(opt, "every=", 6))
+			o->every = strtol(opt + 6, &end, 10);
+		else if (!strncmp(opt, "hold=", 5))
+			o->hold = strtol(opt + 5, &end, 10);
+		else if (!strncmp(opt, "rate=", 5))
+			rate = strtol(opt + 5, &end, 10);
+		else
+			end = NULL;
+		if (end != opt + n) {
+			printf("Invalid fork storm option: %.*s.\n", (int)n,
+			       opt);
+			return -1;
+		}
+	}
+
+	// Children write at most once per nanosecond, or they never wait.
+	if (*end != '\0' || o->children < 0 ||
+	    o->children > COW_MAX_CHILDREN || o->at < 0 || o->every < 0 ||
+	    o->hold < 1 || rate < 1 || rate > NSEC_PER_SEC) {
+		printf("Invalid fork storm: %s.\n", arg);
+		return -1;
+	}
+	o->rate = rate;
+	return 0;
+}
+
+// shared_entry returns whether the page described by the pagemap entry is
+// present but mapped more than once.
+static bool shared_entry(uint64_t entry)
+{
+	return (entry & PM_PRESENT) && !(entry & PM_EXCLUSIVE);
+}
+
+// cow_shared_pages returns how many of the pages of the size bytes at addr are
+// present but mapped more than once, so writing them takes a copy-on-write
+// fault.
+unsigned long cow_shared_pages(void *addr, unsigned long size)
+{
+	return pagemap_count(addr, size, shared_entry);
+}
+
+// child_loop writes to random pages of the data at the storm rate until hold
+// seconds passed or the worker stops, then adds its results to those of the
+// worker. Only async-signal-safe calls are made, as the child of a threaded
+// process.
+static void child_loop(int child)
+{
+	static struct hist cow_latency, steady_latency;
+	hist_reset(&cow_latency);
+	hist_reset(&steady_latency);
+
+	// Without its own pagemap, writes only count as steady.
+	pagemap_open();
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	unsigned long pages = COW_SIZE / page;
+	uint64_t x = COW_SEED * 0x9e3779b97f4a7c15UL + child + 1;
+	unsigned long interval = NSEC_PER_SEC / COW.rate;
+	unsigned long next = now_ns();
+	unsigned long end = next + COW.hold * NSEC_PER_SEC;
+
+	while (!STATS->stop && !SHARED->quit && next < end) {
+		next += interval;
+		struct timespec ts = { .tv_sec = next / NSEC_PER_SEC,
+				       .tv_nsec = next % NSEC_PER_SEC };
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if (SHARED->paused)
+			continue;
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		volatile char *p = COW_DATA + x % pages * page;
+		bool shared = cow_shared_pages((char *)p, 1) > 0;
+		unsigned long start = now_ns();
+		(*p)++;
+		hist_record(shared ? &cow_latency : &steady_latency,
+			    now_ns() - start);
+	}
+
+	while (__atomic_test_and_set(&STATS->lock, __ATOMIC_ACQUIRE))
+		;
+	hist_merge(&STATS->child_cow_latency, &cow_latency);
+	hist_merge(&STATS->child_steady_latency, &steady_latency);
+	__atomic_clear(&STATS->lock, __ATOMIC_RELEASE);
+	_exit(0);
+}
+
+// storm forks the children, timing every fork, and waits for them to exit.
+static void storm()
+{
+	int forked = 0;
+	for (int i = 0; i < COW.children; i++) {
+		unsigned long start = now_ns();
+		pid_t pid = fork();
+		if (pid == 0)
+			child_loop(i);
+		unsigned long stop = now_ns();
+		if (pid == -1) {
+			printf("WARN: Failed to fork storm child: %s\n",
+			       strerror(errno));
+			break;
+		}
+		CHILDREN[forked++] = pid;
+		STATS->forks++;
+		hist_record(&STATS->fork_latency, stop - start);
+		timeline_row(stop, NULL, "cow_fork", NULL, pid, stop - start);
+	}
+
+	for (int i = 0; i < forked;) {
+		if (waitpid(CHILDREN[i], NULL, 0) != -1 || errno != EINTR)
+			i++;
+	}
+}
+
+// cow_loop runs a storm at the configured time, and repeats it if requested,
+// until stopped. The storm children inherit its CPUs.
+static void *cow_loop(void *arg)
+{
+	pin_aux_thread();
+	struct timespec poll = { .tv_nsec = COW_POLL_NS };
+	unsigned long next = SHARED->start_ns + COW.at * NSEC_PER_SEC;
+	while (!COW_STOP) {
+		if (now_ns() < next) {
+			nanosleep(&poll, NULL);
+			continue;
+		}
+		storm();
+		if (COW.every == 0)
+			break;
+		next += COW.every * NSEC_PER_SEC;
+	}
+	return NULL;
+}
+
+// cow_start starts fork storms as described by o over the size bytes of data,
+// recording results in s. It returns 0 on success and -1 on failure.
+int cow_start(const struct cow_opts *o, struct cow_stats *s, char *data,
+	      unsigned long size, unsigned int seed)
+{
+	COW = *o;
+	STATS = s;
+	COW_DATA = data;
+	COW_SIZE = size;
+	COW_SEED = seed;
+	COW_STOP = false;
+	STATS->stop = 0;
+	if (COW.children == 0)
+		return 0;
+
+	if (pthread_create(&COW_TID, NULL, cow_loop, NULL)) {
+		printf("Failed to start fork storm thread.\n");
+		return -1;
+	}
+	COW_RUNNING = true;
+	if (COW.every > 0)
+		printf("[%d] Forking %d children %d s into the test and every %d s after, writing %d pages per second for %d s.\n",
+		       getpid(), COW.children, COW.at, COW.every, COW.rate,
+		       COW.hold);
+	else
+		printf("[%d] Forking %d children %d s into the test, writing %d pages per second for %d s.\n",
+		       getpid(), COW.children, COW.at, COW.rate, COW.hold);
+	return 0;
+}
+
+// cow_stop tells the storm children to exit and waits for them.
+void cow_stop()
+{
+	if (!COW_RUNNING)
+		return;
+
+	COW_STOP = true;
+	STATS->stop = 1;
+	pthread_join(COW_TID, NULL);
+	COW_RUNNING = false;
+}
+
+// cow_report prints how long forks of the data_size bytes of data took and
+// the latency of writes taking copy-on-write faults next to the other ones.
+void cow_report(pid_t pid, const struct cow_stats *s, unsigned long data_size)
+{
+	if (s->forks > 0)
+		printf("[%d] Forks: %lu, p50 %.3f ms, max %.3f ms, %.3f ms per GB of data.\n",
+		       pid, s->forks, hist_percentile(&s->fork_latency, 50) / 1e6,
+		       s->fork_latency.max / 1e6,
+		       s->fork_latency.sum / s->forks / 1e6 /
+			       (data_size / (double)GB));
+	printf("[%d] Copy-on-write: %lu writes to %lu shared pages.\n", pid,
+	       s->cow_writes, s->cow_pages);
+	const struct hist *h[] = { &s->cow_latency, &s->steady_latency,
+				   &s->child_cow_latency,
+				   &s->child_steady_latency };
+	const char *name[] = { "Copy-on-write writes", "Steady writes",
+			       "Storm copy-on-write writes",
+			       "Storm steady writes" };
+	for (int i = 0; i < 4; i++) {
+		// Workers forked by -f have no storm children.
+		if (i >= 2 && h[2]->count + h[3]->count == 0)
+			break;
+		printf("[%d] %s: %lu, p50 %.2f ns, p99 %.2f ns.\n", pid,
+		       name[i], h[i]->count, hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99));
+	}
+}
+
+// cow_json writes s to fp as a JSON object.
+void cow_json(FILE *fp, const struct cow_stats *s)
+{
+	fprintf(fp, "{\"forks\":%lu,\"fork_latency_ns\":", s->forks);
+	hist_json(fp, &s->fork_latency);
+	fprintf(fp, ",\"cow_writes\":%lu,\"cow_pages\":%lu,\"cow_latency_ns\":",
+		s->cow_writes, s->cow_pages);
+	hist_json(fp, &s->cow_latency);
+	fprintf(fp, ",\"steady_latency_ns\":");
+	hist_json(fp, &s->steady_latency);
+	fprintf(fp, ",\"child_cow_latency_ns\":");
+	hist_json(fp, &s->child_cow_latency);
+	fprintf(fp, ",\"child_steady_latency_ns\":");
+	hist_json(fp, &s->child_steady_latency);
+	fprintf(fp, "}");
+}
@@ -0,0 +1,71 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef COW_H
+#define COW_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "hist.h"
+
+// COW_MAX_CHILDREN is the most children a storm forks at once.
+#define COW_MAX_CHILDREN 64
+
+// cow_opts describe a fork storm, in which every worker forks children at
+// seconds into the test, and again every every seconds if set. The children
+// write a byte to random pages of the data of their worker rate times per
+// second for hold seconds, breaking the sharing of the pages they hit. With
+// no children, only writes of the workers themselves are classified.
+struct cow_opts {
+	bool enabled;
+	int children;
+	int at;
+	int every;
+	int hold;
+	int rate;
+};
+
+// cow_stats are the results of forks sharing the data of a worker. Writes of
+// the worker are split by whether they hit pages still shared with another
+// process, and so took copy-on-write faults, and the same is done for the
+// writes of the storm children.
+struct cow_stats {
+	unsigned long forks;
+	struct hist fork_latency;
+	unsigned long cow_writes;
+	unsigned long cow_pages;
+	struct hist cow_latency;
+	struct hist steady_latency;
+	struct hist child_cow_latency;
+	struct hist child_steady_latency;
+	// stop tells the storm children to exit, and lock serializes them
+	// adding their results.
+	volatile int stop;
+	int lock;
+};
+
+int cow_parse(const char *arg, struct cow_opts *o);
+int cow_start(const struct cow_opts *o, struct cow_stats *s, char *data,
+	      unsigned long size, unsigned int seed);
+void cow_stop(void);
+unsigned long cow_shared_pages(void *addr, unsigned long size);
+void cow_report(pid_t pid, const struct cow_stats *s,
+		unsigned long data_size);
+void cow_json(FILE *fp, const struct cow_stats *s);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <numa.h>
+
+#include "bench.h"
+#include "env.h"
+
+// read_line reads the first line of the file at path into buf without the
+// trailing newline. It returns 0 on success and -1 on failure.
+int read_line(const char *path, char *buf, int size)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	int ret = fgets(buf, size, fp) == NULL ? -1 : 0;
+	fclose(fp);
+	if (ret == 0)
+		buf[strcspn(buf, "\n")] = '\0';
+	return ret;
+}
+
+// option_match returns the index of the n characters at s in strings, or -1.
+// It matches the names of options given as <name>[,<option>...].
+int option_match(const char *s, size_t n, const char **strings, int count)
+{
+	for (int i = 0; i < count; i++) {
+		if (strlen(strings[i]) == n && !strncmp(s, strings[i], n))
+			return i;
+	}
+	return -1;
+}
+
+// read_selected reads a sysfs setting such as "always [madvise] never" and
+// stores the selected value in buf.
+static void read_selected(const char *path, char *buf, int size)
+{
+	char line[ENV_STRING_MAX];
+	snprintf(buf, size, "unknown");
+	if (read_line(path, line, sizeof(line)))
+		return;
+
+	char *start = strchr(line, '[');
+	char *end = start ? strchr(start, ']') : NULL;
+	if (start == NULL || end == NULL)
+		return;
+	*end = '\0';
+	snprintf(buf, size, "%s", start + 1);
+}
+
+// read_cpuinfo copies the value of the first key entry of /proc/cpuinfo into
+// buf.
+static void read_cpuinfo(const char *key, char *buf, int size)
+{
+	snprintf(buf, size, "unknown");
+	FILE *fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+		return;
+
+	char line[4096];
+	size_t len = strlen(key);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, key, len) || strchr(line, ':') == NULL)
+			continue;
+		char *value = strchr(line, ':') + 1;
+		while (*value == ' ')
+			value++;
+		value[strcspn(value, "\n")] = '\0';
+		snprintf(buf, size, "%s", value);
+		break;
+	}
+	fclose(fp);
+}
+
+// hash returns the FNV-1a hash of s.
+static unsigned long hash(const char *s)
+{
+	unsigned long h = 14695981039346656037UL;
+	for (; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211UL;
+	return h;
+}
+
+// env_read collects information about the host.
+void env_read(struct env *e)
+{
+	memset(e, 0, sizeof(*e));
+
+	struct utsname u;
+	if (uname(&u) == 0) {
+		snprintf(e->kernel, sizeof(e->kernel), "%s", u.release);
+		snprintf(e->kernel_version, sizeof(e->kernel_version), "%s",
+			 u.version);
+		snprintf(e->machine, sizeof(e->machine), "%s", u.machine);
+		snprintf(e->hostname, sizeof(e->hostname), "%s", u.nodename);
+	}
+
+	read_cpuinfo("model name", e->cpu_model, sizeof(e->cpu_model));
+	read_cpuinfo("microcode", e->microcode, sizeof(e->microcode));
+	char flags[4096];
+	read_cpuinfo("flags", flags, sizeof(flags));
+	e->cpu_flags = hash(flags);
+	if (read_line("/proc/sys/kernel/random/boot_id", e->boot_id,
+		      sizeof(e->boot_id)))
+		snprintf(e->boot_id, sizeof(e->boot_id), "unknown");
+	read_selected("/sys/kernel/mm/transparent_hugepage/enabled",
+		      e->thp_enabled, sizeof(e->thp_enabled));
+	read_selected("/sys/kernel/mm/transparent_hugepage/defrag",
+		      e->thp_defrag, sizeof(e->thp_defrag));
+
+	e->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	e->numa_nodes = numa_available() != -1 ? numa_max_node() + 1 : 1;
+	e->page_size = sysconf(_SC_PAGESIZE);
+
+	struct timespec res;
+	clock_getres(CLOCK_MONOTONIC, &res);
+	e->clock_resolution_ns = res.tv_sec * 1000000000L + res.tv_nsec;
+}
+
+// clock_offset returns how far clock is ahead of CLOCK_MONOTONIC.
+static long clock_offset(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (long)(ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec - now_ns());
+}
+
+// read_start_time returns when the process started in clock ticks since boot,
+// or 0 if it can't be read.
+static unsigned long long read_start_time()
+{
+	char line[1024];
+	if (read_line("/proc/self/stat", line, sizeof(line)))
+		return 0;
+
+	// Fields after the command name, which may contain spaces, start
+	// with the state, the 3rd field, and the start time is the 22nd.
+	char *p = strrchr(line, ')');
+	if (p == NULL)
+		return 0;
+	p++;
+	for (int field = 3; field < 22 && p != NULL; field++)
+		p = strchr(p + 1, ' ');
+	return p != NULL ? strtoull(p + 1, NULL, 10) : 0;
+}
+
+// host_read takes a snapshot of the host and how far its clocks are from
+// CLOCK_MONOTONIC.
+void host_read(struct host *h)
+{
+	env_read(&h->env);
+	h->start_time = read_start_time();
+	h->time_ns = now_ns();
+	h->realtime_offset = clock_offset(CLOCK_REALTIME);
+	h->boottime_offset = clock_offset(CLOCK_BOOTTIME);
+}
+
+// host_clock_reasons adds to reasons whether CLOCK_REALTIME stepped, or
+// CLOCK_BOOTTIME moved ahead as after a suspend, by more than step_ns relative
+// to CLOCK_MONOTONIC between prev and cur.
+void host_clock_reasons(const struct host *prev, const struct host *cur,
+			long step_ns, char *reasons, size_t size)
+{
+	if (labs(cur->realtime_offset - prev->realtime_offset) > step_ns)
+		add_reason(reasons, size, "realtime_step");
+	if (cur->boottime_offset - prev->boottime_offset > step_ns)
+		add_reason(reasons, size, "suspend");
+}
+
+// add_reason appends reason to the '+' separated list in reasons, which holds
+// size bytes.
+void add_reason(char *reasons, size_t size, const char *reason)
+{
+	size_t len = strlen(reasons);
+	snprintf(reasons + len, size - len, "%s%s", len ? "+" : "", reason);
+}
@@ -0,0 +1,63 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef ENV_H
+#define ENV_H
+
+#include <stddef.h>
+
+#define ENV_STRING_MAX 128
+
+// env describes the host the benchmark runs on.
+struct env {
+	char kernel[ENV_STRING_MAX];
+	char kernel_version[ENV_STRING_MAX];
+	char machine[ENV_STRING_MAX];
+	char hostname[ENV_STRING_MAX];
+	char cpu_model[ENV_STRING_MAX];
+	char microcode[ENV_STRING_MAX];
+	char boot_id[ENV_STRING_MAX];
+	char thp_enabled[ENV_STRING_MAX];
+	char thp_defrag[ENV_STRING_MAX];
+	// cpu_flags is a hash of the CPU feature flags.
+	unsigned long cpu_flags;
+	int cpus;
+	int numa_nodes;
+	long page_size;
+	long clock_resolution_ns;
+};
+
+// host is a snapshot of the host and its clocks, compared across a wait or
+// between checks to detect a restore or a migration.
+struct host {
+	struct env env;
+	// start_time is when the process started in clock ticks since boot,
+	// which changes when it is restored by CRIU.
+	unsigned long long start_time;
+	unsigned long time_ns;
+	long realtime_offset;
+	long boottime_offset;
+};
+
+void env_read(struct env *e);
+int read_line(const char *path, char *buf, int size);
+int option_match(const char *s, size_t n, const char **strings, int count);
+void host_read(struct host *h);
+void host_clock_reasons(const struct host *prev, const struct host *cur,
+			long step_ns, char *reasons, size_t size);
+void add_reason(char *reasons, size_t size, const char *reason);
+
+#endif
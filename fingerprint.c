@@ -0,0 +1,282 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+#include "affinity.h"
+#include "fingerprint.h"
+
+// FINGERPRINT_LEAF is how much of DATA the hashes of the tree are computed
+// over, split between threads.
+#define FINGERPRINT_LEAF MB
+
+#define PRIME64_1 0x9e3779b185ebca87UL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fUL
+#define PRIME64_3 0x165667b19e3779f9UL
+#define PRIME64_4 0x85ebca77c2b2ae63UL
+#define PRIME64_5 0x27d4eb2f165667c5UL
+
+const char *FINGERPRINT_POINT_STRING[] = {
+	"ready",
+	"start",
+};
+
+static char *FINGERPRINT_DATA;
+static unsigned long FINGERPRINT_SIZE;
+static int FINGERPRINT_THREADS;
+static struct fingerprint FINGERPRINTS[FINGERPRINT_POINTS];
+
+// pass is a fingerprint computation split into leaves between threads.
+struct pass {
+	uint64_t *leaves;
+	unsigned long count;
+	unsigned long next;
+};
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+// xxh64 returns the XXH64 hash of the len bytes at buf. Its four independent
+// accumulators let the CPU work on several words at once.
+uint64_t xxh64(const void *buf, size_t len, uint64_t seed)
+{
+	const unsigned char *p = buf;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+		const unsigned char *limit = end - 32;
+		do {
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = xxh_merge(h, v1);
+		h = xxh_merge(h, v2);
+		h = xxh_merge(h, v3);
+		h = xxh_merge(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh_round(0, read64(p));
+		h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= read32(p) * PRIME64_1;
+		h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * PRIME64_5;
+		h = rotl(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static void *pass_loop(void *arg)
+{
+	struct pass *p = arg;
+	pin_aux_thread();
+
+	unsigned long leaf;
+	while ((leaf = __sync_fetch_and_add(&p->next, 1)) < p->count) {
+		unsigned long offset = leaf * FINGERPRINT_LEAF;
+		unsigned long len = FINGERPRINT_LEAF;
+		if (offset + len > FINGERPRINT_SIZE)
+			len = FINGERPRINT_SIZE - offset;
+		p->leaves[leaf] = xxh64(FINGERPRINT_DATA + offset, len, 0);
+	}
+	return NULL;
+}
+
+// fingerprint_setup prepares fingerprinting the size bytes of data on threads
+// threads.
+void fingerprint_setup(void *data, unsigned long size, int threads)
+{
+	FINGERPRINT_DATA = data;
+	FINGERPRINT_SIZE = size;
+	FINGERPRINT_THREADS = threads;
+}
+
+// compute hashes the leaves of DATA in parallel and builds the tree of f out
+// of them. It returns 0 on success and -1 on failure.
+static int compute(struct fingerprint *f)
+{
+	struct pass p = {
+		.count = (FINGERPRINT_SIZE + FINGERPRINT_LEAF - 1) /
+			 FINGERPRINT_LEAF,
+	};
+	f->count = (FINGERPRINT_SIZE + GB - 1) / GB;
+	p.leaves = malloc(p.count * sizeof(uint64_t));
+	f->gb = malloc(f->count * sizeof(uint64_t));
+	pthread_t *tids = calloc(FINGERPRINT_THREADS, sizeof(pthread_t));
+	if (p.leaves == NULL || f->gb == NULL || tids == NULL) {
+		printf("Failed to allocate fingerprint.\n");
+		free(p.leaves);
+		free(f->gb);
+		f->gb = NULL;
+		free(tids);
+		return -1;
+	}
+
+	unsigned long start = now_ns();
+	int started = 0;
+	while (started < FINGERPRINT_THREADS &&
+	       pthread_create(&tids[started], NULL, pass_loop, &p) == 0)
+		started++;
+	if (started == 0)
+		pass_loop(&p);
+	for (int i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	unsigned long per_gb = GB / FINGERPRINT_LEAF;
+	for (int i = 0; i < f->count; i++) {
+		unsigned long n = per_gb;
+		if ((i + 1) * per_gb > p.count)
+			n = p.count - i * per_gb;
+		f->gb[i] = xxh64(&p.leaves[i * per_gb], n * sizeof(uint64_t),
+				 0);
+	}
+	f->root = xxh64(f->gb, f->count * sizeof(uint64_t), 0);
+	f->ns = now_ns() - start;
+	free(p.leaves);
+	free(tids);
+	return 0;
+}
+
+// fingerprint_take fingerprints DATA at point and prints its root and per GB
+// hashes. The fingerprint on start is compared with the one on ready, listing
+// the GBs that changed. It returns 0 on success and -1 on failure.
+int fingerprint_take(enum FingerprintPoint point)
+{
+	struct fingerprint *f = &FINGERPRINTS[point];
+	if (compute(f))
+		return -1;
+
+	printf("Fingerprint on %s: %016lx (%.3f GB in %.3f s, %.2f GB/s, %d threads)\n",
+	       FINGERPRINT_POINT_STRING[point], f->root,
+	       FINGERPRINT_SIZE / (double)GB, f->ns / (double)NSEC_PER_SEC,
+	       FINGERPRINT_SIZE / (double)GB / (f->ns / (double)NSEC_PER_SEC),
+	       FINGERPRINT_THREADS);
+	const struct fingerprint *ref = &FINGERPRINTS[FINGERPRINT_READY];
+	bool compare = point != FINGERPRINT_READY && ref->gb != NULL;
+	for (int i = 0; i < f->count; i++)
+		printf("  GB %d: %016lx%s\n", i, f->gb[i],
+		       compare && f->gb[i] != ref->gb[i] ? " (changed)" : "");
+	if (compare)
+		printf("Fingerprint %s the one on ready.\n",
+		       f->root == ref->root ? "matches" : "differs from");
+	return 0;
+}
+
+// fingerprint_get returns the fingerprint taken at point, or NULL if there is
+// none.
+const struct fingerprint *fingerprint_get(enum FingerprintPoint point)
+{
+	return FINGERPRINTS[point].gb != NULL ? &FINGERPRINTS[point] : NULL;
+}
+
+static void json_fingerprint(FILE *fp, const struct fingerprint *f)
+{
+	if (f->gb == NULL) {
+		fprintf(fp, "null");
+		return;
+	}
+	fprintf(fp, "{\"root\":\"%016lx\",\"gb\":[", f->root);
+	for (int i = 0; i < f->count; i++)
+		fprintf(fp, "%s\"%016lx\"", i ? "," : "", f->gb[i]);
+	fprintf(fp, "],\"ns\":%lu}", f->ns);
+}
+
+// fingerprint_json writes the fingerprints to fp as a JSON object, with
+// whether the one on start matches the one on ready.
+void fingerprint_json(FILE *fp)
+{
+	const struct fingerprint *ready = &FINGERPRINTS[FINGERPRINT_READY];
+	const struct fingerprint *start = &FINGERPRINTS[FINGERPRINT_START];
+	fprintf(fp, "{");
+	for (int i = 0; i < FINGERPRINT_POINTS; i++) {
+		fprintf(fp, "%s\"%s\":", i ? "," : "",
+			FINGERPRINT_POINT_STRING[i]);
+		json_fingerprint(fp, &FINGERPRINTS[i]);
+	}
+	fprintf(fp, ",\"match\":");
+	if (ready->gb != NULL && start->gb != NULL)
+		fprintf(fp, ready->root == start->root ? "true" : "false");
+	else
+		fprintf(fp, "null");
+	fprintf(fp, "}");
+}
+
+// fingerprint_free releases the fingerprints.
+void fingerprint_free()
+{
+	for (int i = 0; i < FINGERPRINT_POINTS; i++) {
+		free(FINGERPRINTS[i].gb);
+		FINGERPRINTS[i].gb = NULL;
+	}
+}
@@ -0,0 +1,49 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// FingerprintPoint is when DATA is fingerprinted: once it is ready, and again
+// when the signal to start is received, which may be after a restore.
+enum FingerprintPoint {
+	FINGERPRINT_READY,
+	FINGERPRINT_START,
+	FINGERPRINT_POINTS,
+};
+
+extern const char *FINGERPRINT_POINT_STRING[];
+
+// fingerprint is a tree hash of DATA: the XXH64 hash of the hashes of every
+// GB, which are the hashes of the hashes of every FINGERPRINT_LEAF of it.
+struct fingerprint {
+	uint64_t root;
+	uint64_t *gb;
+	int count;
+	unsigned long ns;
+};
+
+uint64_t xxh64(const void *buf, size_t len, uint64_t seed);
+void fingerprint_setup(void *data, unsigned long size, int threads);
+int fingerprint_take(enum FingerprintPoint point);
+const struct fingerprint *fingerprint_get(enum FingerprintPoint point);
+void fingerprint_json(FILE *fp);
+void fingerprint_free(void);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "bench.h"
+#include "hist.h"
+
+// hist_bucket_index returns the bucket v is counted in.
+int hist_bucket_index(unsigned long v)
+{
+	int shift = 0;
+	if (v >= HIST_SUB_COUNT)
+		shift = 63 - __builtin_clzl(v) - HIST_SUB_BITS;
+	int i = shift * HIST_SUB_COUNT + (v >> shift);
+	return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+// hist_bucket_low returns the smallest value counted in bucket i.
+unsigned long hist_bucket_low(int i)
+{
+	int shift = i / HIST_SUB_COUNT - 1;
+	if (shift < 0)
+		shift = 0;
+	return (unsigned long)(i - shift * HIST_SUB_COUNT) << shift;
+}
+
+// hist_bucket_high returns the largest value counted in bucket i.
+unsigned long hist_bucket_high(int i)
+{
+	int shift = i / HIST_SUB_COUNT - 1;
+	if (shift < 0)
+		shift = 0;
+	return hist_bucket_low(i) + (1UL << shift) - 1;
+}
+
+// hist_reset clears all values recorded in h.
+void hist_reset(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+// hist_record adds value v to h.
+void hist_record(struct hist *h, unsigned long v)
+{
+	if (h->count == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->sum_sq += (double)v * v;
+	h->buckets[hist_bucket_index(v)]++;
+}
+
+// hist_merge adds all values recorded in src to dst.
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	dst->sum_sq += src->sum_sq;
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+// hist_percentile returns an estimate of the k-th percentile of the values
+// recorded in h.
+double hist_percentile(const struct hist *h, double k)
+{
+	if (h->count == 0)
+		return 0;
+
+	unsigned long rank = ceil(k / 100 * h->count);
+	if (rank == 0)
+		rank = 1;
+
+	unsigned long seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen < rank)
+			continue;
+
+		// Report the middle of the bucket, bounded by the exact
+		// extremes.
+		double v = (hist_bucket_low(i) + hist_bucket_high(i)) / 2.0;
+		if (v < h->min)
+			v = h->min;
+		if (v > h->max)
+			v = h->max;
+		return v;
+	}
+	return h->max;
+}
+
+// hist_stats computes statistics about the values recorded in h.
+void hist_stats(const struct hist *h, struct stats *res)
+{
+	memset(res, 0, sizeof(*res));
+	if (h->count == 0)
+		return;
+
+	res->min = h->min;
+	res->max = h->max;
+	res->avg = h->sum / h->count;
+	if (h->count > 1) {
+		double var = (h->sum_sq - h->sum * res->avg) / (h->count - 1);
+		res->stdev = var > 0 ? sqrt(var) : 0;
+	}
+	res->p99 = hist_percentile(h, 99);
+	res->p95 = hist_percentile(h, 95);
+	res->p90 = hist_percentile(h, 90);
+}
+
+// hist_json writes h to fp as a JSON object with summary statistics and the
+// non-empty buckets as [low, high, count] triples.
+void hist_json(FILE *fp, const struct hist *h)
+{
+	struct stats s;
+	hist_stats(h, &s);
+	fprintf(fp,
+		"{\"count\":%lu,\"min\":%lu,\"max\":%lu,\"avg\":%.2f,"
+		"\"stdev\":%.2f,\"p50\":%.2f,\"p90\":%.2f,\"p95\":%.2f,"
+		"\"p99\":%.2f,\"p999\":%.2f,\"buckets\":[",
+		h->count, s.min, s.max, s.avg, s.stdev,
+		hist_percentile(h, 50), s.p90, s.p95, s.p99,
+		hist_percentile(h, 99.9));
+	bool first = true;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		if (h->buckets[i] == 0)
+			continue;
+		fprintf(fp, "%s[%lu,%lu,%lu]", first ? "" : ",",
+			hist_bucket_low(i), hist_bucket_high(i), h->buckets[i]);
+		first = false;
+	}
+	fprintf(fp, "]}");
+}
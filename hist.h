@@ -0,0 +1,54 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdio.h>
+
+// Histograms use log-linear buckets: values are grouped by their most
+// significant bit and each group is split into HIST_SUB_COUNT linear buckets,
+// giving a relative error of about 3%. Values above 2^HIST_MAX_BITS are
+// clamped into the last bucket.
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 44
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+// hist is a fixed size histogram. It contains no pointers so it can be placed
+// in memory shared between processes.
+struct hist {
+	unsigned long count;
+	unsigned long min;
+	unsigned long max;
+	double sum;
+	double sum_sq;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+struct stats;
+
+void hist_reset(struct hist *h);
+void hist_record(struct hist *h, unsigned long v);
+void hist_merge(struct hist *dst, const struct hist *src);
+int hist_bucket_index(unsigned long v);
+unsigned long hist_bucket_low(int i);
+unsigned long hist_bucket_high(int i);
+double hist_percentile(const struct hist *h, double k);
+void hist_stats(const struct hist *h, struct stats *res);
+void hist_json(FILE *fp, const struct hist *h);
+
+#endif
@@ -0,0 +1,669 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "bench.h"
+#include "io.h"
+#include "timeline.h"
+
+#define IO_ALIGN 4096
+#define IO_DEFAULT_BLOCK_SIZE 4096
+#define IO_DEFAULT_FILE_SIZE (1024 * MB)
+#define IO_MAX_DEPTH 4096
+
+const char *IO_ENGINE_STRING[] = {
+	"psync",
+	"uring",
+};
+
+// ring is an io_uring set up with raw system calls, so no library is needed.
+struct ring {
+	int fd;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+};
+
+// IO_WAKE is the user data of the operation that wakes up the reaper to stop.
+#define IO_WAKE ((__u64)-1)
+
+// io_op is an operation of the batch in progress, or in async mode a slot for
+// an operation in flight.
+struct io_op {
+	bool write;
+	unsigned long offset;
+	unsigned long submit_ns;
+	const struct phase *phase;
+	bool busy;
+};
+
+static struct io_opts IO;
+static struct io_stats *STATS;
+static struct ring RING = { .fd = -1 };
+static int IO_FD = -1;
+static char *IO_BUF;
+static struct io_op *IO_OPS;
+// IO_OFFSET and IO_SIZE are the part of the file the worker accesses.
+static unsigned long IO_OFFSET;
+static unsigned long IO_SIZE;
+static unsigned long IO_SEQ_OFFSET;
+static unsigned int IO_SEED;
+// In async mode, IO_INFLIGHT operations are kept in flight across ticks and
+// their completions are reaped by a separate thread as soon as they arrive.
+static bool IO_ASYNC = false;
+static int IO_INFLIGHT;
+static pthread_t IO_REAPER_TID;
+
+static pthread_t IO_TID;
+static pthread_mutex_t IO_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t IO_COND = PTHREAD_COND_INITIALIZER;
+static bool IO_RUNNING = false;
+static bool IO_STOP = false;
+// IO_PHASE is the phase of the pending tick, or NULL if there is none.
+static const struct phase *IO_PHASE;
+
+// io_parse parses an I/O workload of the form
+// <path>[,psync|,uring][,direct][,depth=<n>][,bs=<bytes>][,size=<megabytes>].
+// It returns 0 on success and -1 on failure.
+int io_parse(const char *arg, struct io_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->enabled = true;
+	o->depth = 1;
+	o->block_size = IO_DEFAULT_BLOCK_SIZE;
+	o->file_size = IO_DEFAULT_FILE_SIZE;
+
+	size_t len = strcspn(arg, ",");
+	if (len == 0 || len >= IO_PATH_MAX) {
+		printf("Invalid I/O file path: %s.\n", arg);
+		return -1;
+	}
+	memcpy(o->path, arg, len);
+
+	const char *opt = arg + len;
+	while (*opt == ',') {
+		opt++;
+		size_t n = strcspn(opt, ",");
+		char *end = NULL;
+		if (n == 5 && !strncmp(opt, "psync", n)) {
+			o->engine = IO_PSYNC;
+		} else if (n == 5 && !strncmp(opt, "uring", n)) {
+			o->engine = IO_URING;
+		} else if (n == 6 && !strncmp(opt, "direct", n)) {
+			o->direct = true;
+		} else if (!strncmp(opt, "depth=", 6)) {
+			o->depth = strtol(opt + 6, &end, 10);
+		} else if (!strncmp(opt, "bs=", 3)) {
+			o->block_size = strtoul(opt + 3, &end, 10);
+		} else if (!strncmp(opt, "size=", 5)) {
+			o->file_size = strtoul(opt + 5, &end, 10) * MB;
+		} else {
+			printf("Invalid I/O option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+		if (end != NULL && end != opt + n) {
+			printf("Invalid I/O option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+		opt += n;
+	}
+
+	if (o->depth < 1 || o->depth > IO_MAX_DEPTH) {
+		printf("I/O depth must be between 1 and %d.\n", IO_MAX_DEPTH);
+		return -1;
+	}
+	if (o->block_size == 0 || o->block_size > o->file_size) {
+		printf("I/O block size must be between 1 and the file size.\n");
+		return -1;
+	}
+	// O_DIRECT needs buffers, offsets and sizes aligned to the logical
+	// block size of the device.
+	if (o->direct && o->block_size % 512) {
+		printf("I/O block size must be a multiple of 512 with direct.\n");
+		return -1;
+	}
+	return 0;
+}
+
+// io_prepare creates the file of o, filling it with random data if it is
+// shorter than the requested size. It returns 0 on success and -1 on failure.
+int io_prepare(const struct io_opts *o)
+{
+	int fd = open(o->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st)) {
+		printf("Failed to open I/O file %s: %s\n", o->path,
+		       strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	int ret = 0;
+	if (st.st_size < o->file_size) {
+		printf("Filling %s with %.3f GB of data...\n", o->path,
+		       (o->file_size - st.st_size) / (double)GB);
+		ret = fill_file(fd, st.st_size, o->file_size);
+	}
+	close(fd);
+	return ret;
+}
+
+// map_ring maps the part of an io_uring at offset, returning NULL on failure.
+static void *map_ring(int fd, size_t len, off_t offset)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, offset);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+// ring_free releases the mappings and file descriptor of r.
+static void ring_free(struct ring *r)
+{
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr != NULL)
+		munmap(r->sq_ptr, r->sq_len);
+	if (r->fd != -1)
+		close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+// ring_setup creates an io_uring with room for entries operations. It returns
+// 0 on success and -1 on failure.
+static int ring_setup(struct ring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		r->fd = -1;
+		return -1;
+	}
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_len = p.cq_off.cqes +
+		    p.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single && r->cq_len > r->sq_len)
+		r->sq_len = r->cq_len;
+	r->sq_ptr = map_ring(r->fd, r->sq_len, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == NULL)
+		goto fail;
+	r->cq_ptr = single ? r->sq_ptr :
+			     map_ring(r->fd, r->cq_len, IORING_OFF_CQ_RING);
+	if (r->cq_ptr == NULL)
+		goto fail;
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = map_ring(r->fd, r->sqes_len, IORING_OFF_SQES);
+	if (r->sqes == NULL)
+		goto fail;
+
+	char *sq = r->sq_ptr, *cq = r->cq_ptr;
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	ring_free(r);
+	return -1;
+}
+
+// ring_enter submits n queued operations and waits for at least min to
+// complete.
+static int ring_enter(struct ring *r, unsigned int n, unsigned int min)
+{
+	return syscall(__NR_io_uring_enter, r->fd, n, min,
+		       min > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// complete records an operation that returned res after being issued at
+// submit_ns and completed at complete_ns.
+static void complete(const struct phase *phase, const struct io_op *op,
+		     unsigned long complete_ns, long res)
+{
+	unsigned long diff = complete_ns - op->submit_ns;
+	if (res < 0) {
+		// The reaper and a failed async submit both count errors.
+		__atomic_fetch_add(&STATS->errors, 1, __ATOMIC_RELAXED);
+		timeline_row(op->submit_ns, phase->name, "io_error",
+			     strerror(-res), op->offset, diff);
+		return;
+	}
+
+	STATS->bytes += res;
+	hist_record(op->write ? &STATS->write_latency : &STATS->read_latency,
+		    diff);
+	hist_record(&STATS->segment_latency[SHARED->segments - 1], diff);
+	timeline_row(op->submit_ns, phase->name,
+		     op->write ? "io_write" : "io_read", NULL, res, diff);
+}
+
+// plan_io picks the offset and kind of op as described by phase.
+static void plan_io(const struct phase *phase, struct io_op *op)
+{
+	unsigned long blocks = IO_SIZE / IO.block_size;
+	unsigned long block;
+	if (phase->pattern == SEQUENTIAL) {
+		block = IO_SEQ_OFFSET;
+		IO_SEQ_OFFSET = (IO_SEQ_OFFSET + 1) % blocks;
+	} else {
+		block = (unsigned long)rand_r(&IO_SEED) << 31 |
+			rand_r(&IO_SEED);
+		block %= blocks;
+	}
+	op->offset = IO_OFFSET + block * IO.block_size;
+	op->write = rand_r(&IO_SEED) % 100 < phase->write_pct;
+	op->phase = phase;
+}
+
+// queue_sqe adds operation i to the submission queue at tail.
+static void queue_sqe(unsigned int tail, int i)
+{
+	unsigned int idx = tail & *RING.sq_mask;
+	struct io_uring_sqe *sqe = &RING.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IO_OPS[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = IO_FD;
+	sqe->off = IO_OPS[i].offset;
+	sqe->addr = (unsigned long)(IO_BUF + i * IO.block_size);
+	sqe->len = IO.block_size;
+	sqe->user_data = i;
+	RING.sq_array[idx] = idx;
+}
+
+// run_psync issues the operations of a batch one after the other.
+static void run_psync(const struct phase *phase)
+{
+	for (int i = 0; i < IO.depth; i++) {
+		struct io_op *op = &IO_OPS[i];
+		char *buf = IO_BUF + i * IO.block_size;
+		op->submit_ns = now_ns();
+		long res = op->write ?
+				   pwrite(IO_FD, buf, IO.block_size, op->offset) :
+				   pread(IO_FD, buf, IO.block_size, op->offset);
+		unsigned long complete_ns = now_ns();
+		complete(phase, op, complete_ns, res < 0 ? -errno : res);
+	}
+}
+
+// run_uring submits the operations of a batch at once and times each of them
+// until its completion is reaped.
+static void run_uring(const struct phase *phase)
+{
+	unsigned int tail = *RING.sq_tail;
+	for (int i = 0; i < IO.depth; i++)
+		queue_sqe(tail++, i);
+	__atomic_store_n(RING.sq_tail, tail, __ATOMIC_RELEASE);
+
+	unsigned long submit_ns = now_ns();
+	for (int i = 0; i < IO.depth; i++)
+		IO_OPS[i].submit_ns = submit_ns;
+	int submitted = ring_enter(&RING, IO.depth, 0);
+	if (submitted < IO.depth) {
+		// Take back what the kernel didn't consume, so it isn't
+		// submitted again with the next batch.
+		const char *err = submitted < 0 ? strerror(errno) :
+						  "partial submit";
+		if (submitted < 0)
+			submitted = 0;
+		__atomic_store_n(RING.sq_tail, tail - (IO.depth - submitted),
+				 __ATOMIC_RELEASE);
+		STATS->errors += IO.depth - submitted;
+		timeline_row(submit_ns, phase->name, "io_error", err, 0, 0);
+	}
+
+	unsigned int head = *RING.cq_head;
+	for (int done = 0; done < submitted;) {
+		unsigned int ready = __atomic_load_n(RING.cq_tail,
+						     __ATOMIC_ACQUIRE);
+		if (head == ready) {
+			if (ring_enter(&RING, 0, 1) < 0 && errno != EINTR)
+				break;
+			continue;
+		}
+		unsigned long complete_ns = now_ns();
+		for (; head != ready; head++, done++) {
+			struct io_uring_cqe *cqe =
+				&RING.cqes[head & *RING.cq_mask];
+			complete(phase, &IO_OPS[cqe->user_data], complete_ns,
+				 cqe->res);
+		}
+		__atomic_store_n(RING.cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+// run_async tops up the operations in flight to the queue depth, leaving
+// their completions to the reaper.
+static void run_async(const struct phase *phase)
+{
+	unsigned int tail = *RING.sq_tail;
+	unsigned long submit_ns = now_ns();
+	int n = 0;
+	for (int i = 0; i < IO.depth; i++) {
+		struct io_op *op = &IO_OPS[i];
+		if (__atomic_load_n(&op->busy, __ATOMIC_ACQUIRE))
+			continue;
+		plan_io(phase, op);
+		op->submit_ns = submit_ns;
+		op->busy = true;
+		queue_sqe(tail++, i);
+		n++;
+	}
+	if (n == 0) {
+		STATS->saturated_ticks++;
+		return;
+	}
+	__atomic_store_n(RING.sq_tail, tail, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&IO_INFLIGHT, n, __ATOMIC_RELAXED);
+	int submitted = ring_enter(&RING, n, 0);
+	if (submitted < n) {
+		// Free the slots of the operations the kernel didn't consume,
+		// which are the last ones queued, and take them back out of
+		// the ring.
+		const char *err = submitted < 0 ? strerror(errno) :
+						  "partial submit";
+		int failed = n - (submitted < 0 ? 0 : submitted);
+		tail -= failed;
+		for (int i = 0; i < failed; i++) {
+			unsigned int idx = (tail + i) & *RING.sq_mask;
+			struct io_op *op = &IO_OPS[RING.sqes[idx].user_data];
+			__atomic_store_n(&op->busy, false, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(RING.sq_tail, tail, __ATOMIC_RELEASE);
+		__atomic_fetch_sub(&IO_INFLIGHT, failed, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&STATS->errors, failed, __ATOMIC_RELAXED);
+		timeline_row(submit_ns, phase->name, "io_error", err, 0, 0);
+	}
+}
+
+// io_reap records the completions of async operations until it is woken up to
+// stop and nothing is in flight anymore.
+static void *io_reap(void *arg)
+{
+	unsigned int head = *RING.cq_head;
+	bool stop = false;
+	while (!stop || __atomic_load_n(&IO_INFLIGHT, __ATOMIC_RELAXED) > 0) {
+		unsigned int ready = __atomic_load_n(RING.cq_tail,
+						     __ATOMIC_ACQUIRE);
+		if (head == ready) {
+			if (ring_enter(&RING, 0, 1) < 0 && errno != EINTR)
+				break;
+			continue;
+		}
+		unsigned long complete_ns = now_ns();
+		for (; head != ready; head++) {
+			struct io_uring_cqe *cqe =
+				&RING.cqes[head & *RING.cq_mask];
+			if (cqe->user_data == IO_WAKE) {
+				stop = true;
+				continue;
+			}
+			struct io_op *op = &IO_OPS[cqe->user_data];
+			complete(op->phase, op, complete_ns, cqe->res);
+			__atomic_store_n(&op->busy, false, __ATOMIC_RELEASE);
+			__atomic_fetch_sub(&IO_INFLIGHT, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(RING.cq_head, head, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+// stop_reaper submits a no-op to wake up the reaper and waits for it to
+// finish.
+static void stop_reaper()
+{
+	unsigned int tail = *RING.sq_tail;
+	unsigned int idx = tail & *RING.sq_mask;
+	struct io_uring_sqe *sqe = &RING.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_NOP;
+	sqe->user_data = IO_WAKE;
+	RING.sq_array[idx] = idx;
+	__atomic_store_n(RING.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring_enter(&RING, 1, 0);
+	pthread_join(IO_REAPER_TID, NULL);
+}
+
+// run_batch issues one tick worth of operations as described by phase.
+static void run_batch(const struct phase *phase)
+{
+	if (IO_ASYNC) {
+		run_async(phase);
+		return;
+	}
+
+	for (int i = 0; i < IO.depth; i++)
+		plan_io(phase, &IO_OPS[i]);
+	if (STATS->engine == IO_URING)
+		run_uring(phase);
+	else
+		run_psync(phase);
+}
+
+// io_loop runs a batch of operations for every tick until stopped. It holds
+// IO_LOCK while a batch runs, so ticks arriving meanwhile are missed.
+static void *io_loop(void *arg)
+{
+	pthread_mutex_lock(&IO_LOCK);
+	while (!IO_STOP) {
+		if (IO_PHASE == NULL) {
+			pthread_cond_wait(&IO_COND, &IO_LOCK);
+			continue;
+		}
+		const struct phase *phase = IO_PHASE;
+		IO_PHASE = NULL;
+		run_batch(phase);
+	}
+	pthread_mutex_unlock(&IO_LOCK);
+	return NULL;
+}
+
+// io_start opens the file of o and starts issuing operations on the part of it
+// belonging to worker out of workers on every tick, recording results in s.
+// With async, io_uring operations are kept in flight instead of waiting for a
+// batch to complete. It returns 0 on success and -1 on failure.
+int io_start(const struct io_opts *o, struct io_stats *s, int worker,
+	     int workers, unsigned int seed, bool async)
+{
+	IO = *o;
+	STATS = s;
+	IO_ASYNC = false;
+	IO_INFLIGHT = 0;
+	STATS->engine = IO.engine;
+	IO_SEED = seed;
+
+	unsigned long blocks = IO.file_size / IO.block_size / workers;
+	if (blocks == 0) {
+		printf("I/O file %s is too small for %d workers.\n", IO.path,
+		       workers);
+		return -1;
+	}
+	IO_OFFSET = blocks * IO.block_size * worker;
+	IO_SIZE = blocks * IO.block_size;
+
+	int flags = O_RDWR | O_CLOEXEC | (IO.direct ? O_DIRECT : 0);
+	IO_FD = open(IO.path, flags);
+	if (IO_FD == -1) {
+		printf("Failed to open I/O file %s: %s\n", IO.path,
+		       strerror(errno));
+		return -1;
+	}
+	IO_OPS = calloc(IO.depth, sizeof(struct io_op));
+	if (IO_OPS == NULL ||
+	    posix_memalign((void **)&IO_BUF, IO_ALIGN,
+			   IO.depth * IO.block_size)) {
+		printf("Failed to allocate I/O buffers.\n");
+		goto fail;
+	}
+	for (unsigned long i = 0; i < IO.depth * IO.block_size; i++)
+		IO_BUF[i] = rand_r(&IO_SEED);
+
+	if (IO.engine == IO_URING && ring_setup(&RING, IO.depth)) {
+		printf("[%d] WARN: io_uring is unavailable (%s), using psync.\n",
+		       getpid(), strerror(errno));
+		STATS->engine = IO_PSYNC;
+	}
+
+	// Only io_uring can keep operations in flight between ticks.
+	if (async && STATS->engine == IO_URING) {
+		IO_ASYNC = true;
+		if (pthread_create(&IO_REAPER_TID, NULL, io_reap, NULL)) {
+			printf("Failed to start I/O reaper thread.\n");
+			goto fail;
+		}
+	}
+
+	IO_STOP = false;
+	IO_PHASE = NULL;
+	if (pthread_create(&IO_TID, NULL, io_loop, NULL)) {
+		printf("Failed to start I/O thread.\n");
+		if (IO_ASYNC)
+			stop_reaper();
+		goto fail;
+	}
+	IO_RUNNING = true;
+	printf("[%d] %s %d %s operations of %lu bytes %s on %.3f GB of %s%s.\n",
+	       getpid(), IO_ASYNC ? "Keeping" : "Issuing", IO.depth,
+	       IO_ENGINE_STRING[STATS->engine], IO.block_size,
+	       IO_ASYNC ? "in flight" : "per tick", IO_SIZE / (double)GB,
+	       IO.path, IO.direct ? " with O_DIRECT" : "");
+	return 0;
+
+fail:
+	ring_free(&RING);
+	close(IO_FD);
+	IO_FD = -1;
+	free(IO_OPS);
+	free(IO_BUF);
+	IO_OPS = NULL;
+	IO_BUF = NULL;
+	return -1;
+}
+
+// io_tick asks the I/O thread to run a batch of operations for phase. The tick
+// is missed if the previous batch is still running.
+void io_tick(const struct phase *phase)
+{
+	if (!IO_RUNNING)
+		return;
+	if (pthread_mutex_trylock(&IO_LOCK)) {
+		STATS->missed_ticks++;
+		return;
+	}
+	IO_PHASE = phase;
+	pthread_cond_signal(&IO_COND);
+	pthread_mutex_unlock(&IO_LOCK);
+}
+
+// io_stop waits for the batch in progress, if any, and stops the I/O thread.
+void io_stop(void)
+{
+	if (!IO_RUNNING)
+		return;
+
+	pthread_mutex_lock(&IO_LOCK);
+	IO_STOP = true;
+	pthread_cond_signal(&IO_COND);
+	pthread_mutex_unlock(&IO_LOCK);
+	pthread_join(IO_TID, NULL);
+	IO_RUNNING = false;
+	if (IO_ASYNC)
+		stop_reaper();
+
+	ring_free(&RING);
+	close(IO_FD);
+	IO_FD = -1;
+	free(IO_OPS);
+	free(IO_BUF);
+	IO_OPS = NULL;
+	IO_BUF = NULL;
+}
+
+// io_report prints the I/O results of s, split in segments if the run was.
+void io_report(pid_t pid, const struct io_stats *s, int segments)
+{
+	printf("[%d] I/O: %lu reads, %lu writes, %.3f MB, %lu errors, %lu ticks missed, %lu saturated.\n",
+	       pid, s->read_latency.count, s->write_latency.count,
+	       s->bytes / (double)MB, s->errors, s->missed_ticks,
+	       s->saturated_ticks);
+	const struct hist *h[] = { &s->read_latency, &s->write_latency };
+	const char *name[] = { "read", "write" };
+	for (int i = 0; i < 2; i++) {
+		if (h[i]->count == 0)
+			continue;
+		printf("[%d] I/O %s latency: p50 %.2f ns, p99 %.2f ns, max %lu ns.\n",
+		       pid, name[i], hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99), h[i]->max);
+	}
+	for (int g = 0; g < segments && segments > 1; g++) {
+		const struct hist *seg = &s->segment_latency[g];
+		printf("[%d] I/O segment %d: %lu operations, p50 %.2f ns, p99 %.2f ns.\n",
+		       pid, g, seg->count, hist_percentile(seg, 50),
+		       hist_percentile(seg, 99));
+	}
+}
+
+// io_json writes s to fp as a JSON object.
+void io_json(FILE *fp, const struct io_stats *s, int segments)
+{
+	fprintf(fp,
+		"{\"engine\":\"%s\",\"bytes\":%lu,\"errors\":%lu,"
+		"\"missed_ticks\":%lu,\"saturated_ticks\":%lu,"
+		"\"read_latency_ns\":",
+		IO_ENGINE_STRING[s->engine], s->bytes, s->errors,
+		s->missed_ticks, s->saturated_ticks);
+	hist_json(fp, &s->read_latency);
+	fprintf(fp, ",\"write_latency_ns\":");
+	hist_json(fp, &s->write_latency);
+	fprintf(fp, ",\"segments\":[");
+	for (int g = 0; g < segments; g++) {
+		fprintf(fp, "%s", g ? "," : "");
+		hist_json(fp, &s->segment_latency[g]);
+	}
+	fprintf(fp, "]}");
+}
@@ -0,0 +1,81 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef IO_H
+#define IO_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "migration.h"
+#include "scenario.h"
+
+#define IO_PATH_MAX 4096
+
+// IoEngine is how the I/O worker issues its operations.
+enum IoEngine {
+	// IO_PSYNC issues one pread or pwrite at a time.
+	IO_PSYNC,
+	// IO_URING submits a batch of operations to an io_uring.
+	IO_URING,
+};
+
+extern const char *IO_ENGINE_STRING[];
+
+// io_opts describe the file I/O issued next to the memory operations.
+struct io_opts {
+	bool enabled;
+	enum IoEngine engine;
+	bool direct;
+	// depth is how many operations are issued every tick, and kept in
+	// flight at once by io_uring.
+	int depth;
+	unsigned long block_size;
+	unsigned long file_size;
+	char path[IO_PATH_MAX];
+};
+
+// io_stats are the results of the I/O worker of a process.
+struct io_stats {
+	// engine is the engine used, which may differ from the requested one
+	// if io_uring is unavailable.
+	int engine;
+	unsigned long bytes;
+	unsigned long errors;
+	// missed_ticks counts ticks skipped because the previous batch was
+	// still running.
+	unsigned long missed_ticks;
+	// saturated_ticks counts ticks of the async mode that found every
+	// operation still in flight.
+	unsigned long saturated_ticks;
+	struct hist read_latency;
+	struct hist write_latency;
+	// segment_latency holds operation times split at detected migrations.
+	struct hist segment_latency[MAX_SEGMENTS];
+};
+
+int io_parse(const char *arg, struct io_opts *o);
+int io_prepare(const struct io_opts *o);
+int io_start(const struct io_opts *o, struct io_stats *s, int worker,
+	     int workers, unsigned int seed, bool async);
+void io_tick(const struct phase *phase);
+void io_stop(void);
+void io_report(pid_t pid, const struct io_stats *s, int segments);
+void io_json(FILE *fp, const struct io_stats *s, int segments);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include "json.h"
+
+#define JSON_MAX_DEPTH 64
+
+// parser holds the state of a document being parsed.
+struct parser {
+	const char *buf;
+	size_t pos;
+	size_t len;
+	const char *error;
+};
+
+static int parse_value(struct parser *p, struct json *v, int depth);
+
+static void skip_space(struct parser *p)
+{
+	while (p->pos < p->len && strchr(" \t\r\n", p->buf[p->pos]) != NULL)
+		p->pos++;
+}
+
+static int fail(struct parser *p, const char *error)
+{
+	if (p->error == NULL)
+		p->error = error;
+	return -1;
+}
+
+// parse_string parses a quoted string into a newly allocated buffer. Escaped
+// characters outside of ASCII are replaced with '?' since the benchmark never
+// writes them.
+static int parse_string(struct parser *p, char **res)
+{
+	if (p->pos >= p->len || p->buf[p->pos] != '"')
+		return fail(p, "expected string");
+	p->pos++;
+
+	size_t start = p->pos;
+	while (p->pos < p->len && p->buf[p->pos] != '"') {
+		if (p->buf[p->pos] == '\\')
+			p->pos++;
+		p->pos++;
+	}
+	if (p->pos >= p->len)
+		return fail(p, "unterminated string");
+
+	char *s = malloc(p->pos - start + 1);
+	if (s == NULL)
+		return fail(p, "out of memory");
+	size_t n = 0;
+	for (size_t i = start; i < p->pos; i++) {
+		char c = p->buf[i];
+		if (c != '\\') {
+			s[n++] = c;
+			continue;
+		}
+		c = p->buf[++i];
+		switch (c) {
+		case 'n':
+			s[n++] = '\n';
+			break;
+		case 't':
+			s[n++] = '\t';
+			break;
+		case 'r':
+			s[n++] = '\r';
+			break;
+		case 'b':
+			s[n++] = '\b';
+			break;
+		case 'f':
+			s[n++] = '\f';
+			break;
+		case 'u': {
+			char hex[5] = { 0 };
+			if (i + 4 >= p->pos) {
+				free(s);
+				return fail(p, "invalid escape");
+			}
+			memcpy(hex, &p->buf[i + 1], 4);
+			long code = strtol(hex, NULL, 16);
+			s[n++] = code < 0x80 ? code : '?';
+			i += 4;
+			break;
+		}
+		default:
+			s[n++] = c;
+		}
+	}
+	s[n] = '\0';
+	p->pos++;
+	*res = s;
+	return 0;
+}
+
+// parse_members parses the members of an array or object up to the closing
+// character.
+static int parse_members(struct parser *p, struct json *v, char close,
+			 int depth)
+{
+	int cap = 0;
+	p->pos++;
+	skip_space(p);
+	if (p->pos < p->len && p->buf[p->pos] == close) {
+		p->pos++;
+		return 0;
+	}
+
+	while (true) {
+		if (v->count == cap) {
+			cap = cap ? cap * 2 : 8;
+			struct json *items =
+				realloc(v->items, cap * sizeof(struct json));
+			if (items == NULL)
+				return fail(p, "out of memory");
+			v->items = items;
+		}
+		struct json *item = &v->items[v->count];
+		memset(item, 0, sizeof(*item));
+		v->count++;
+
+		skip_space(p);
+		if (v->type == JSON_OBJECT) {
+			if (parse_string(p, &item->key))
+				return -1;
+			skip_space(p);
+			if (p->pos >= p->len || p->buf[p->pos] != ':')
+				return fail(p, "expected ':'");
+			p->pos++;
+		}
+		if (parse_value(p, item, depth + 1))
+			return -1;
+
+		skip_space(p);
+		if (p->pos >= p->len)
+			return fail(p, "unexpected end of document");
+		if (p->buf[p->pos] == close) {
+			p->pos++;
+			return 0;
+		}
+		if (p->buf[p->pos] != ',')
+			return fail(p, "expected ','");
+		p->pos++;
+	}
+}
+
+static int parse_value(struct parser *p, struct json *v, int depth)
+{
+	if (depth > JSON_MAX_DEPTH)
+		return fail(p, "document nested too deeply");
+
+	skip_space(p);
+	if (p->pos >= p->len)
+		return fail(p, "unexpected end of document");
+
+	const char *s = &p->buf[p->pos];
+	size_t left = p->len - p->pos;
+	switch (*s) {
+	case '{':
+		v->type = JSON_OBJECT;
+		return parse_members(p, v, '}', depth);
+	case '[':
+		v->type = JSON_ARRAY;
+		return parse_members(p, v, ']', depth);
+	case '"':
+		v->type = JSON_STRING;
+		return parse_string(p, &v->string);
+	}
+
+	if (left >= 4 && !strncmp(s, "null", 4)) {
+		v->type = JSON_NULL;
+		p->pos += 4;
+	} else if (left >= 4 && !strncmp(s, "true", 4)) {
+		v->type = JSON_BOOL;
+		v->number = 1;
+		p->pos += 4;
+	} else if (left >= 5 && !strncmp(s, "false", 5)) {
+		v->type = JSON_BOOL;
+		p->pos += 5;
+	} else {
+		// The document is terminated by the caller, so strtod can't
+		// read past its end.
+		char *end;
+		v->type = JSON_NUMBER;
+		v->number = strtod(s, &end);
+		if (end == s)
+			return fail(p, "unexpected character");
+		p->pos += end - s;
+	}
+	return 0;
+}
+
+// json_load parses the JSON document at path. It returns NULL and prints the
+// reason if the file can't be read or isn't valid JSON.
+struct json *json_load(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Failed to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	size_t cap = 1 << 16, len = 0, n;
+	char *buf = malloc(cap);
+	while (buf != NULL && (n = fread(buf + len, 1, cap - len - 1, fp)) > 0) {
+		len += n;
+		if (len + 1 == cap) {
+			cap *= 2;
+			char *grown = realloc(buf, cap);
+			if (grown == NULL)
+				free(buf);
+			buf = grown;
+		}
+	}
+	fclose(fp);
+	if (buf == NULL) {
+		printf("Failed to read %s: out of memory\n", path);
+		return NULL;
+	}
+	buf[len] = '\0';
+
+	struct parser p = { .buf = buf, .len = len };
+	struct json *v = calloc(1, sizeof(struct json));
+	if (v == NULL || parse_value(&p, v, 0) == 0) {
+		skip_space(&p);
+		if (p.pos < p.len)
+			fail(&p, "trailing characters");
+	}
+	free(buf);
+	if (v == NULL || p.error != NULL) {
+		printf("%s: offset %ld: %s.\n", path, p.pos,
+		       v == NULL ? "out of memory" : p.error);
+		json_free(v);
+		return NULL;
+	}
+	return v;
+}
+
+static void free_members(struct json *v)
+{
+	for (int i = 0; i < v->count; i++)
+		free_members(&v->items[i]);
+	free(v->items);
+	free(v->string);
+	free(v->key);
+}
+
+// json_free releases v and all of its members.
+void json_free(struct json *v)
+{
+	if (v == NULL)
+		return;
+	free_members(v);
+	free(v);
+}
+
+// json_get returns the member key of object v, or NULL if it doesn't exist.
+struct json *json_get(const struct json *v, const char *key)
+{
+	if (v == NULL || v->type != JSON_OBJECT)
+		return NULL;
+	for (int i = 0; i < v->count; i++) {
+		if (!strcmp(v->items[i].key, key))
+			return &v->items[i];
+	}
+	return NULL;
+}
+
+// json_number returns the numeric member key of v, or 0 if it doesn't exist.
+double json_number(const struct json *v, const char *key)
+{
+	struct json *m = json_get(v, key);
+	return m != NULL && m->type == JSON_NUMBER ? m->number : 0;
+}
+
+// json_str returns the string member key of v, or NULL if it doesn't exist.
+const char *json_str(const struct json *v, const char *key)
+{
+	struct json *m = json_get(v, key);
+	return m != NULL && m->type == JSON_STRING ? m->string : NULL;
+}
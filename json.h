@@ -0,0 +1,46 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef JSON_H
+#define JSON_H
+
+enum JsonType {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+// json is a parsed JSON value. Arrays and objects keep their members in
+// items, with the name of object members stored in key.
+struct json {
+	enum JsonType type;
+	double number;
+	char *string;
+	char *key;
+	struct json *items;
+	int count;
+};
+
+struct json *json_load(const char *path);
+void json_free(struct json *v);
+struct json *json_get(const struct json *v, const char *key);
+double json_number(const struct json *v, const char *key);
+const char *json_str(const struct json *v, const char *key);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+#include "env.h"
+#include "ksm.h"
+#include "pagemap.h"
+
+// KSM_SYS_COUNTERS is how many of KSM_COUNTER_STRING are read from
+// /sys/kernel/mm/ksm, the rest are per process ones from /proc/self/ksm_stat.
+#define KSM_SYS_COUNTERS 6
+// KSM_MERGING_PAGES is the index of ksm_merging_pages in KSM_COUNTER_STRING,
+// the pages of the process merged by KSM.
+#define KSM_MERGING_PAGES 7
+// KSM_POLL_NS is how often setup checks whether pages were merged.
+#define KSM_POLL_NS (100 * 1000000UL)
+// KPF_KSM is the kpageflags bit of pages merged by KSM.
+#define KPF_KSM (1UL << 21)
+
+const char *KSM_POINT_STRING[] = {
+	"before",
+	"start",
+	"end",
+};
+
+const char *KSM_COUNTER_STRING[] = {
+	"pages_shared",	  "pages_sharing",  "pages_unshared",
+	"pages_volatile", "full_scans",	    "general_profit",
+	"ksm_rmap_items", "ksm_merging_pages", "ksm_process_profit",
+};
+
+static struct ksm_opts KSM;
+static char *KSM_DATA;
+static unsigned long KSM_REGION;
+static long COUNTERS[KSM_POINTS][KSM_COUNTERS];
+static bool SAMPLED[KSM_POINTS];
+// KPAGEFLAGS_FD is /proc/kpageflags, which tells merged pages apart from ones
+// shared with a forked process. It needs CAP_SYS_ADMIN, as do the frame
+// numbers in pagemap.
+static int KPAGEFLAGS_FD = -1;
+
+// ksm_parse parses KSM options of the form
+// <dup_pct>[,region=<pct>][,wait=<s>]. It returns 0 on success and -1 on
+// failure.
+int ksm_parse(const char *arg, struct ksm_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->enabled = true;
+	o->region_pct = 100;
+
+	size_t len = strcspn(arg, ",");
+	char *end;
+	o->dup_pct = strtol(arg, &end, 10);
+	if (end != arg + len || o->dup_pct < 0 || o->dup_pct > 100) {
+		printf("Invalid duplicate page percentage: %.*s.\n", (int)len,
+		       arg);
+		return -1;
+	}
+
+	const char *opt = arg + len;
+	while (*opt == ',') {
+		opt++;
+		size_t n = strcspn(opt, ",");
+		end = (char *)opt + n;
+		if (!strncmp(opt, "region=", 7))
+			o->region_pct = strtol(opt + 7, &end, 10);
+		else if (!strncmp(opt, "wait=", 5))
+			o->wait = strtol(opt + 5, &end, 10);
+		else
+			end = NULL;
+		if (end != opt + n) {
+			printf("Invalid KSM option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+		opt += n;
+	}
+
+	if (o->region_pct < 1 || o->region_pct > 100 || o->wait < 0) {
+		printf("Invalid KSM options: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// read_counters reads the KSM counters into values, storing -1 for the ones
+// this kernel doesn't have.
+static void read_counters(long *values)
+{
+	char path[256], line[ENV_STRING_MAX];
+	for (int i = 0; i < KSM_COUNTERS; i++)
+		values[i] = -1;
+	for (int i = 0; i < KSM_SYS_COUNTERS; i++) {
+		snprintf(path, sizeof(path), "/sys/kernel/mm/ksm/%s",
+			 KSM_COUNTER_STRING[i]);
+		if (read_line(path, line, sizeof(line)) == 0)
+			values[i] = atol(line);
+	}
+
+	FILE *fp = fopen("/proc/self/ksm_stat", "r");
+	if (fp == NULL)
+		return;
+	char key[64];
+	long value;
+	while (fscanf(fp, "%63s %ld", key, &value) == 2) {
+		for (int i = KSM_SYS_COUNTERS; i < KSM_COUNTERS; i++) {
+			if (!strcmp(key, KSM_COUNTER_STRING[i]))
+				values[i] = value;
+		}
+	}
+	fclose(fp);
+}
+
+// ksm_sample reads the KSM counters at point.
+void ksm_sample(enum KsmPoint point)
+{
+	if (!KSM.enabled)
+		return;
+	read_counters(COUNTERS[point]);
+	SAMPLED[point] = true;
+}
+
+// ksm_counters returns the KSM counters read at point, or NULL if they
+// weren't.
+const long *ksm_counters(enum KsmPoint point)
+{
+	return SAMPLED[point] ? COUNTERS[point] : NULL;
+}
+
+// duplicate returns whether page i of the mergeable region is made identical
+// to the others.
+static bool duplicate(unsigned long i)
+{
+	unsigned long h = (i + 1) * 0x9e3779b97f4a7c15UL;
+	h ^= h >> 31;
+	return h % 100 < (unsigned long)KSM.dup_pct;
+}
+
+// ksm_setup makes the requested share of the pages of the mergeable part of
+// the size bytes of data identical, then marks that part MADV_MERGEABLE and
+// optionally waits for the duplicates to be merged. It returns 0 on success
+// and -1 on failure.
+int ksm_setup(const struct ksm_opts *o, void *data, unsigned long size)
+{
+	KSM = *o;
+	KSM_DATA = data;
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	KSM_REGION = size / 100 * o->region_pct / page * page;
+	KPAGEFLAGS_FD = open("/proc/kpageflags", O_RDONLY | O_CLOEXEC);
+	ksm_sample(KSM_BEFORE);
+
+	// Duplicates hold a non-zero pattern, so they aren't merged into the
+	// zero page instead.
+	unsigned long dups = 0;
+	for (unsigned long i = 0; i < KSM_REGION / page; i++) {
+		if (!duplicate(i))
+			continue;
+		memset(KSM_DATA + i * page, 0xa5, page);
+		dups++;
+	}
+	if (madvise(KSM_DATA, KSM_REGION, MADV_MERGEABLE)) {
+		printf("Failed to mark data mergeable: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("Marked %.3f GB mergeable, %lu duplicate pages (%d%%).\n",
+	       KSM_REGION / (double)GB, dups, o->dup_pct);
+
+	char run[ENV_STRING_MAX];
+	if (read_line("/sys/kernel/mm/ksm/run", run, sizeof(run)) ||
+	    strcmp(run, "1")) {
+		printf("WARN: KSM isn't running, pages won't be merged.\n");
+		return 0;
+	}
+	if (o->wait == 0 || dups == 0)
+		return 0;
+
+	// Identical pages all merge into one, so wait for every other one to
+	// share it.
+	unsigned long start = now_ns(), deadline = start + o->wait * NSEC_PER_SEC;
+	struct timespec poll = { .tv_nsec = KSM_POLL_NS };
+	long values[KSM_COUNTERS];
+	read_counters(values);
+	long *merging = &values[KSM_MERGING_PAGES];
+	while (*merging < (long)dups - 1 && now_ns() < deadline) {
+		nanosleep(&poll, NULL);
+		read_counters(values);
+	}
+	printf("Merged %ld pages in %.3f s.\n", *merging > 0 ? *merging : 0,
+	       (now_ns() - start) / (double)NSEC_PER_SEC);
+	return 0;
+}
+
+// merged returns whether the page described by the pagemap entry is merged.
+// Without kpageflags, pages mapped more than once count as merged.
+static bool merged(uint64_t entry)
+{
+	if (!(entry & PM_PRESENT))
+		return false;
+	uint64_t pfn = entry & PM_PFN, flags;
+	if (KPAGEFLAGS_FD == -1 || pfn == 0)
+		return !(entry & PM_EXCLUSIVE);
+	if (pread(KPAGEFLAGS_FD, &flags, sizeof(flags), pfn * sizeof(flags)) !=
+	    sizeof(flags))
+		return !(entry & PM_EXCLUSIVE);
+	return flags & KPF_KSM;
+}
+
+// ksm_merged_pages returns how many of the pages of the size bytes at addr
+// are merged.
+unsigned long ksm_merged_pages(void *addr, unsigned long size)
+{
+	if (!KSM.enabled || size == 0)
+		return 0;
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	unsigned long first = ((uintptr_t)addr - (uintptr_t)KSM_DATA) / page;
+	unsigned long last = ((uintptr_t)addr - (uintptr_t)KSM_DATA + size -
+			      1) / page;
+	if (first >= KSM_REGION / page)
+		return 0;
+	if (last >= KSM_REGION / page)
+		last = KSM_REGION / page - 1;
+
+	return pagemap_count(KSM_DATA + first * page, (last - first + 1) * page,
+			     merged);
+}
+
+// ksm_report prints how the KSM counters changed from before marking the data
+// mergeable to the start and end of the test.
+void ksm_report()
+{
+	if (!KSM.enabled)
+		return;
+
+	printf("KSM counters (before, start, end):\n");
+	for (int i = 0; i < KSM_COUNTERS; i++) {
+		printf("  %-20s", KSM_COUNTER_STRING[i]);
+		for (int p = 0; p < KSM_POINTS; p++) {
+			if (SAMPLED[p] && COUNTERS[p][i] >= 0)
+				printf(" %12ld", COUNTERS[p][i]);
+			else
+				printf(" %12s", "-");
+		}
+		printf("\n");
+	}
+}
+
+// ksm_worker_report prints the latency of writes to merged pages of a worker
+// next to that of its other writes.
+void ksm_worker_report(pid_t pid, const struct ksm_stats *s)
+{
+	printf("[%d] KSM: %lu writes to %lu merged pages.\n", pid,
+	       s->merged_writes, s->merged_pages);
+	const struct hist *h[] = { &s->merged_latency, &s->unmerged_latency };
+	const char *name[] = { "Merged", "Unmerged" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s writes: %ld, p50 %.2f ns, p99 %.2f ns.\n", pid,
+		       name[i], h[i]->count, hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99));
+	}
+}
+
+// ksm_json writes the KSM counters to fp as a JSON object with one object per
+// point they were read at.
+void ksm_json(FILE *fp)
+{
+	fprintf(fp, "{");
+	for (int p = 0; p < KSM_POINTS; p++) {
+		fprintf(fp, "%s\"%s\":", p ? "," : "", KSM_POINT_STRING[p]);
+		if (!SAMPLED[p]) {
+			fprintf(fp, "null");
+			continue;
+		}
+		fprintf(fp, "{");
+		for (int i = 0; i < KSM_COUNTERS; i++) {
+			fprintf(fp, "%s\"%s\":", i ? "," : "",
+				KSM_COUNTER_STRING[i]);
+			if (COUNTERS[p][i] >= 0)
+				fprintf(fp, "%ld", COUNTERS[p][i]);
+			else
+				fprintf(fp, "null");
+		}
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "}");
+}
+
+// ksm_stats_json writes s to fp as a JSON object.
+void ksm_stats_json(FILE *fp, const struct ksm_stats *s)
+{
+	fprintf(fp,
+		"{\"merged_writes\":%lu,\"merged_pages\":%lu,"
+		"\"merged_latency_ns\":",
+		s->merged_writes, s->merged_pages);
+	hist_json(fp, &s->merged_latency);
+	fprintf(fp, ",\"unmerged_latency_ns\":");
+	hist_json(fp, &s->unmerged_latency);
+	fprintf(fp, "}");
+}
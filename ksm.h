@@ -0,0 +1,70 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef KSM_H
+#define KSM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "hist.h"
+
+// KsmPoint is when the KSM counters are read.
+enum KsmPoint {
+	KSM_BEFORE,
+	KSM_START,
+	KSM_END,
+	KSM_POINTS,
+};
+
+// KSM_COUNTERS is the number of system wide and per process KSM counters.
+#define KSM_COUNTERS 9
+
+extern const char *KSM_POINT_STRING[];
+extern const char *KSM_COUNTER_STRING[];
+
+// ksm_opts describe how DATA takes part in kernel samepage merging. The first
+// region_pct percent of it is marked mergeable, dup_pct percent of the pages
+// in that region are made identical, and setup waits up to wait seconds for
+// them to be merged.
+struct ksm_opts {
+	bool enabled;
+	int region_pct;
+	int dup_pct;
+	int wait;
+};
+
+// ksm_stats are the results of writes of a worker to merged pages, which
+// break their sharing, compared to writes to other pages.
+struct ksm_stats {
+	unsigned long merged_writes;
+	unsigned long merged_pages;
+	struct hist merged_latency;
+	struct hist unmerged_latency;
+};
+
+int ksm_parse(const char *arg, struct ksm_opts *o);
+int ksm_setup(const struct ksm_opts *o, void *data, unsigned long size);
+unsigned long ksm_merged_pages(void *addr, unsigned long size);
+void ksm_sample(enum KsmPoint point);
+void ksm_report(void);
+void ksm_worker_report(pid_t pid, const struct ksm_stats *s);
+void ksm_json(FILE *fp);
+void ksm_stats_json(FILE *fp, const struct ksm_stats *s);
+const long *ksm_counters(enum KsmPoint point);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <numaif.h>
+
+#include "bench.h"
+#include "affinity.h"
+#include "locality.h"
+#include "timeline.h"
+
+// Scans and relocalizations share the page and status buffers, so only one
+// runs at a time.
+static pthread_mutex_t MOVE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static void *PAGES[LOCALITY_SAMPLES];
+static int NODES[LOCALITY_SAMPLES];
+static int STATUS[LOCALITY_SAMPLES];
+
+static pthread_t LOCALITY_TID;
+static pthread_mutex_t LOCALITY_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t LOCALITY_COND = PTHREAD_COND_INITIALIZER;
+static bool LOCALITY_RUNNING = false;
+static bool LOCALITY_STOP = false;
+static int LOCALITY_INTERVAL;
+static double LOCALITY_THRESHOLD;
+
+// target_pid returns the pid to pass to move_pages for w.
+static pid_t target_pid(const struct worker *w)
+{
+	return w->pid == getpid() ? 0 : w->pid;
+}
+
+// locality_scan samples the pages of DATA accessed by w and stores which NUMA
+// node they are on in w->locality. w may be a worker of another process. It
+// returns 0 on success and -1 on failure.
+int locality_scan(struct worker *w)
+{
+	if (w->pid == 0 || w->access_size == 0)
+		return -1;
+
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long pages = w->access_size / page;
+	unsigned long step = pages / LOCALITY_SAMPLES + 1;
+	char *base = (char *)DATA + w->access_offset;
+	struct locality l = { .time_ns = now_ns() };
+
+	pthread_mutex_lock(&MOVE_LOCK);
+	for (unsigned long i = 0; i < pages && l.sampled < LOCALITY_SAMPLES;
+	     i += step)
+		PAGES[l.sampled++] = base + i * page;
+	if (move_pages(target_pid(w), l.sampled, PAGES, NULL, STATUS, 0)) {
+		pthread_mutex_unlock(&MOVE_LOCK);
+		return -1;
+	}
+	for (unsigned long i = 0; i < l.sampled; i++) {
+		if (STATUS[i] >= 0 && STATUS[i] < LOCALITY_MAX_NODES)
+			l.nodes[STATUS[i]]++;
+		else
+			l.missing++;
+	}
+	pthread_mutex_unlock(&MOVE_LOCK);
+
+	w->locality = l;
+	return 0;
+}
+
+// locality_remote_pct returns the percentage of resident sampled pages of w
+// that aren't on the node its data was placed on.
+double locality_remote_pct(const struct worker *w)
+{
+	const struct locality *l = &w->locality;
+	unsigned long present = l->sampled - l->missing;
+	if (w->data_node < 0 || present == 0)
+		return 0;
+	return (present - l->nodes[w->data_node]) * 100.0 / present;
+}
+
+// move_batch moves the first n pages of PAGES that aren't on node yet to it.
+// It returns the number of pages moved, or -1 on failure.
+static long move_batch(pid_t pid, unsigned long n, int node)
+{
+	if (move_pages(pid, n, PAGES, NULL, STATUS, 0))
+		return -1;
+
+	unsigned long count = 0;
+	for (unsigned long i = 0; i < n; i++) {
+		if (STATUS[i] >= 0 && STATUS[i] != node) {
+			PAGES[count] = PAGES[i];
+			NODES[count++] = node;
+		}
+	}
+	if (count == 0)
+		return 0;
+
+	// Pages still shared with the parent after fork can only be moved
+	// with MPOL_MF_MOVE_ALL, which requires CAP_SYS_NICE.
+	if (move_pages(pid, count, PAGES, NODES, STATUS, MPOL_MF_MOVE_ALL) &&
+	    (errno != EPERM ||
+	     move_pages(pid, count, PAGES, NODES, STATUS, MPOL_MF_MOVE)))
+		return -1;
+
+	long moved = 0;
+	for (unsigned long i = 0; i < count; i++)
+		moved += STATUS[i] == node;
+	return moved;
+}
+
+// locality_relocalize moves every page of DATA accessed by w back to the node
+// its data was placed on. It returns the number of pages moved, or -1 on
+// failure.
+long locality_relocalize(struct worker *w)
+{
+	if (w->pid == 0 || w->access_size == 0 || w->data_node < 0)
+		return -1;
+
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long pages = w->access_size / page;
+	char *base = (char *)DATA + w->access_offset;
+	long moved = 0;
+	unsigned long start = now_ns();
+
+	pthread_mutex_lock(&MOVE_LOCK);
+	for (unsigned long i = 0; i < pages; i += LOCALITY_SAMPLES) {
+		unsigned long n = pages - i < LOCALITY_SAMPLES ?
+					  pages - i :
+					  LOCALITY_SAMPLES;
+		for (unsigned long j = 0; j < n; j++)
+			PAGES[j] = base + (i + j) * page;
+		long res = move_batch(target_pid(w), n, w->data_node);
+		if (res == -1) {
+			moved = -1;
+			break;
+		}
+		moved += res;
+	}
+	pthread_mutex_unlock(&MOVE_LOCK);
+
+	if (moved > 0) {
+		w->relocalized += moved;
+		w->relocalize_ns += now_ns() - start;
+	}
+	return moved;
+}
+
+// locality_json writes l to fp as a JSON object.
+void locality_json(FILE *fp, const struct locality *l)
+{
+	fprintf(fp, "{\"sampled\":%lu,\"missing\":%lu,\"nodes\":[", l->sampled,
+		l->missing);
+	int last = 0;
+	for (int i = 0; i < LOCALITY_MAX_NODES; i++) {
+		if (l->nodes[i] > 0)
+			last = i;
+	}
+	for (int i = 0; i <= last; i++)
+		fprintf(fp, "%s%lu", i ? "," : "", l->nodes[i]);
+	fprintf(fp, "]}");
+}
+
+// locality_report prints the last scan of worker i and records it in the
+// timeline.
+void locality_report(int i)
+{
+	struct worker *w = &SHARED->workers[i];
+	const struct locality *l = &w->locality;
+	const char *phase = SCENARIO.phases[w->phase].name;
+	char label[32];
+
+	printf("[%d] Data locality:", w->pid);
+	for (int n = 0; n < LOCALITY_MAX_NODES; n++) {
+		if (l->nodes[n] == 0)
+			continue;
+		printf(" node %d %.1f%%,", n, l->nodes[n] * 100.0 / l->sampled);
+		snprintf(label, sizeof(label), "worker%d:node%d", i, n);
+		timeline_row(l->time_ns, phase, "locality", label, l->sampled,
+			     l->nodes[n]);
+	}
+	printf(" missing %.1f%% of %lu sampled pages.\n",
+	       l->missing * 100.0 / l->sampled, l->sampled);
+	snprintf(label, sizeof(label), "worker%d:missing", i);
+	timeline_row(l->time_ns, phase, "locality", label, l->sampled,
+		     l->missing);
+}
+
+// relocalize moves the data of worker i back to its node, and prints the
+// latency before it did so it can be compared with the following summaries.
+static void relocalize(int i)
+{
+	struct worker *w = &SHARED->workers[i];
+	struct hist *h = calloc(1, sizeof(struct hist));
+	if (h == NULL)
+		return;
+	window_merge(w, 10, h);
+
+	printf("[%d] %.1f%% of data is off node %d, relocalizing (10s p99 %.2f ns)...\n",
+	       w->pid, locality_remote_pct(w), w->data_node,
+	       hist_percentile(h, 99));
+	unsigned long start = now_ns();
+	long moved = locality_relocalize(w);
+	unsigned long took = now_ns() - start;
+	if (moved == -1) {
+		printf("[%d] Failed to relocalize data: %s\n", w->pid,
+		       strerror(errno));
+	} else {
+		printf("[%d] Moved %ld pages to node %d in %.3f ms.\n", w->pid,
+		       moved, w->data_node, took / 1e6);
+		char label[32];
+		snprintf(label, sizeof(label), "worker%d", i);
+		timeline_row(start, SCENARIO.phases[w->phase].name,
+			     "relocalize", label, moved, took);
+	}
+	free(h);
+}
+
+static void *locality_loop(void *arg)
+{
+	pin_aux_thread();
+	pthread_mutex_lock(&LOCALITY_LOCK);
+	while (!LOCALITY_STOP) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += LOCALITY_INTERVAL;
+		while (!LOCALITY_STOP &&
+		       pthread_cond_timedwait(&LOCALITY_COND, &LOCALITY_LOCK,
+					      &deadline) != ETIMEDOUT)
+			;
+		if (LOCALITY_STOP || SHARED->state != RUNNING)
+			continue;
+
+		for (int i = 0; i < SHARED->workers_count; i++) {
+			if (locality_scan(&SHARED->workers[i]))
+				continue;
+			locality_report(i);
+			if (LOCALITY_THRESHOLD > 0 &&
+			    locality_remote_pct(&SHARED->workers[i]) >
+				    LOCALITY_THRESHOLD)
+				relocalize(i);
+		}
+		fflush(stdout);
+	}
+	pthread_mutex_unlock(&LOCALITY_LOCK);
+	return NULL;
+}
+
+// locality_start scans the data of every worker every interval seconds in a
+// background thread. When more than threshold percent of the data of a worker
+// is off its node, the data is moved back. It returns 0 on success and -1 on
+// failure.
+int locality_start(int interval, double threshold)
+{
+	if (interval <= 0)
+		return 0;
+
+	LOCALITY_INTERVAL = interval;
+	LOCALITY_THRESHOLD = threshold;
+	LOCALITY_STOP = false;
+	if (pthread_create(&LOCALITY_TID, NULL, locality_loop, NULL)) {
+		printf("Failed to start locality scans.\n");
+		return -1;
+	}
+	LOCALITY_RUNNING = true;
+	return 0;
+}
+
+// locality_stop stops the background scans.
+void locality_stop()
+{
+	if (!LOCALITY_RUNNING)
+		return;
+
+	pthread_mutex_lock(&LOCALITY_LOCK);
+	LOCALITY_STOP = true;
+	pthread_cond_signal(&LOCALITY_COND);
+	pthread_mutex_unlock(&LOCALITY_LOCK);
+	pthread_join(LOCALITY_TID, NULL);
+	LOCALITY_RUNNING = false;
+}
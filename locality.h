@@ -0,0 +1,46 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef LOCALITY_H
+#define LOCALITY_H
+
+#include <stdio.h>
+
+// LOCALITY_SAMPLES is the largest number of pages checked by a scan. Pages are
+// sampled evenly across the data a worker accesses.
+#define LOCALITY_SAMPLES 16384
+#define LOCALITY_MAX_NODES 64
+
+// locality is the NUMA node distribution of sampled pages of DATA. Pages that
+// were never touched or were swapped out are counted as missing.
+struct locality {
+	unsigned long time_ns;
+	unsigned long sampled;
+	unsigned long missing;
+	unsigned long nodes[LOCALITY_MAX_NODES];
+};
+
+struct worker;
+
+int locality_scan(struct worker *w);
+double locality_remote_pct(const struct worker *w);
+long locality_relocalize(struct worker *w);
+void locality_report(int i);
+void locality_json(FILE *fp, const struct locality *l);
+int locality_start(int interval, double threshold);
+void locality_stop(void);
+
+#endif
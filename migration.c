@@ -0,0 +1,188 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bench.h"
+#include "env.h"
+#include "affinity.h"
+#include "timeline.h"
+#include "migration.h"
+
+// MIGRATION_CLOCK_STEP_NS is how far CLOCK_REALTIME or CLOCK_BOOTTIME may move
+// relative to CLOCK_MONOTONIC between two checks before it counts as a clock
+// step.
+#define MIGRATION_CLOCK_STEP_NS (10 * 1000 * 1000L)
+// PAUSE_NS is how much longer than the interval a check may take before the
+// benchmark is considered to have been paused.
+#define PAUSE_NS NSEC_PER_SEC
+
+static pthread_t MIGRATION_TID;
+static pthread_mutex_t MIGRATION_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t MIGRATION_COND;
+static bool MIGRATION_RUNNING = false;
+static bool MIGRATION_STOP = false;
+static int MIGRATION_INTERVAL;
+
+// check is what is compared between checks to detect a migration.
+struct check {
+	struct host host;
+	unsigned long timer_jumps;
+};
+
+static void read_check(struct check *c)
+{
+	host_read(&c->host);
+	c->timer_jumps = 0;
+	for (int i = 0; i < SHARED->workers_count; i++)
+		c->timer_jumps += SHARED->workers[i].timer_jumps;
+}
+
+// compare_checks stores why cur looks like a different host than prev, or
+// like the benchmark was paused, in reasons.
+static void compare_checks(const struct check *prev, const struct check *cur,
+			   char *reasons)
+{
+	const struct env *a = &prev->host.env, *b = &cur->host.env;
+	size_t size = SEGMENT_REASONS_MAX;
+	reasons[0] = '\0';
+	if (strcmp(a->cpu_model, b->cpu_model))
+		add_reason(reasons, size, "cpu_model");
+	if (strcmp(a->microcode, b->microcode))
+		add_reason(reasons, size, "microcode");
+	if (a->cpu_flags != b->cpu_flags)
+		add_reason(reasons, size, "cpu_flags");
+	if (strcmp(a->boot_id, b->boot_id))
+		add_reason(reasons, size, "boot_id");
+	if (a->numa_nodes != b->numa_nodes)
+		add_reason(reasons, size, "numa_nodes");
+	if (a->cpus != b->cpus)
+		add_reason(reasons, size, "cpus");
+	host_clock_reasons(&prev->host, &cur->host, MIGRATION_CLOCK_STEP_NS,
+			   reasons, size);
+	if (cur->host.time_ns - prev->host.time_ns >
+	    MIGRATION_INTERVAL * NSEC_PER_SEC + PAUSE_NS)
+		add_reason(reasons, size, "pause");
+	if (cur->timer_jumps != prev->timer_jumps)
+		add_reason(reasons, size, "tsc_jump");
+}
+
+// start_segment splits the statistics of every worker at the current time.
+static void start_segment(const char *reasons)
+{
+	unsigned long t = now_ns();
+	int n = SHARED->segments;
+	const char *phase = SCENARIO.phases[SHARED->workers[0].phase].name;
+	timeline_row(t, phase, "migration", reasons, n, 0);
+	// Check that the data survived the migration.
+	verify_request();
+
+	if (n == MAX_SEGMENTS) {
+		printf("Migration detected at %.3f s (%s), counted in segment %d.\n",
+		       (t - SHARED->start_ns) / (double)NSEC_PER_SEC, reasons,
+		       n - 1);
+		return;
+	}
+
+	SHARED->segment[n].start_ns = t - SHARED->start_ns;
+	snprintf(SHARED->segment[n].reasons, SEGMENT_REASONS_MAX, "%s",
+		 reasons);
+	__sync_synchronize();
+	SHARED->segments = n + 1;
+	printf("Migration detected at %.3f s (%s), starting segment %d.\n",
+	       (t - SHARED->start_ns) / (double)NSEC_PER_SEC, reasons, n);
+}
+
+static void *migration_loop(void *arg)
+{
+	pin_aux_thread();
+	struct check *checks = malloc(2 * sizeof(struct check));
+	if (checks == NULL)
+		return NULL;
+	struct check *prev = &checks[0], *cur = &checks[1];
+	read_check(prev);
+
+	pthread_mutex_lock(&MIGRATION_LOCK);
+	while (!MIGRATION_STOP) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += MIGRATION_INTERVAL;
+		while (!MIGRATION_STOP &&
+		       pthread_cond_timedwait(&MIGRATION_COND, &MIGRATION_LOCK,
+					      &deadline) != ETIMEDOUT)
+			;
+		if (MIGRATION_STOP)
+			break;
+
+		char reasons[SEGMENT_REASONS_MAX];
+		read_check(cur);
+		compare_checks(prev, cur, reasons);
+		if (reasons[0] != '\0' && SHARED->state == RUNNING) {
+			start_segment(reasons);
+			fflush(stdout);
+		}
+		struct check *tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+	pthread_mutex_unlock(&MIGRATION_LOCK);
+	free(checks);
+	return NULL;
+}
+
+// migration_start checks every interval seconds whether the benchmark moved
+// to another host, or its clocks stepped, in a background thread. Every
+// detection starts a new segment of the statistics. It returns 0 on success
+// and -1 on failure.
+int migration_start(int interval)
+{
+	if (interval <= 0)
+		return 0;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&MIGRATION_COND, &attr);
+	pthread_condattr_destroy(&attr);
+
+	MIGRATION_INTERVAL = interval;
+	MIGRATION_STOP = false;
+	if (pthread_create(&MIGRATION_TID, NULL, migration_loop, NULL)) {
+		printf("Failed to start migration checks.\n");
+		return -1;
+	}
+	MIGRATION_RUNNING = true;
+	return 0;
+}
+
+// migration_stop stops the background checks.
+void migration_stop()
+{
+	if (!MIGRATION_RUNNING)
+		return;
+
+	pthread_mutex_lock(&MIGRATION_LOCK);
+	MIGRATION_STOP = true;
+	pthread_cond_signal(&MIGRATION_COND);
+	pthread_mutex_unlock(&MIGRATION_LOCK);
+	pthread_join(MIGRATION_TID, NULL);
+	MIGRATION_RUNNING = false;
+}
@@ -0,0 +1,35 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef MIGRATION_H
+#define MIGRATION_H
+
+// MAX_SEGMENTS is the number of parts the statistics are split into by
+// detected migrations. Operations after the last one are counted in the last
+// segment.
+#define MAX_SEGMENTS 8
+#define SEGMENT_REASONS_MAX 128
+
+// segment is a part of the run on a single host.
+struct segment {
+	unsigned long start_ns;
+	char reasons[SEGMENT_REASONS_MAX];
+};
+
+int migration_start(int interval);
+void migration_stop(void);
+
+#endif
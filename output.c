@@ -0,0 +1,1109 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bench.h"
+#include "env.h"
+#include "output.h"
+#include "locality.h"
+#include "migration.h"
+
+// Throughput is stored as size * 1024 / nanoseconds, so this converts it to
+// bytes per second.
+#define RATE_TO_BYTES_PER_SEC (NSEC_PER_SEC / 1024.0)
+
+static FILE *OUTPUT_FP;
+
+// output_open prepares the destination of the machine readable output. When
+// it goes to stdout, the human readable report is moved to stderr so the two
+// don't mix. It returns 0 on success and -1 on failure.
+int output_open(const struct benchmark_opts *opts)
+{
+	if (opts->output == OUTPUT_NONE)
+		return 0;
+
+	if (opts->output_file == NULL || !strcmp(opts->output_file, "-")) {
+		int fd = dup(STDOUT_FILENO);
+		if (fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+			printf("Failed to redirect output: %s\n",
+			       strerror(errno));
+			return -1;
+		}
+		OUTPUT_FP = fdopen(fd, "w");
+	} else {
+		OUTPUT_FP = fopen(opts->output_file, "w");
+	}
+	if (OUTPUT_FP == NULL) {
+		printf("Failed to open output file: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// json_string writes s to fp as a quoted JSON string.
+void json_string(FILE *fp, const char *s)
+{
+	if (s == NULL) {
+		fprintf(fp, "null");
+		return;
+	}
+
+	fputc('"', fp);
+	for (; *s != '\0'; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+// csv_string writes s to fp as a CSV field, quoting it if needed.
+static void csv_string(FILE *fp, const char *s)
+{
+	if (s == NULL)
+		return;
+	if (strpbrk(s, ",\"\n") == NULL) {
+		fputs(s, fp);
+		return;
+	}
+
+	fputc('"', fp);
+	for (; *s != '\0'; s++) {
+		if (*s == '"')
+			fputc('"', fp);
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+// merge_hists combines the lifetime histograms of all workers.
+static void merge_hists(struct hist *times, struct hist *sizes,
+			struct hist *rates)
+{
+	for (int i = 0; i < SHARED->workers_count; i++) {
+		hist_merge(times, &SHARED->workers[i].lifetime);
+		hist_merge(sizes, &SHARED->workers[i].sizes);
+		hist_merge(rates, &SHARED->workers[i].rates);
+	}
+}
+
+static void json_stats(FILE *fp, const struct stats *s, double scale)
+{
+	fprintf(fp,
+		"{\"min\":%.2f,\"max\":%.2f,\"avg\":%.2f,\"stdev\":%.2f,"
+		"\"p90\":%.2f,\"p95\":%.2f,\"p99\":%.2f}",
+		s->min * scale, s->max * scale, s->avg * scale,
+		s->stdev * scale, s->p90 * scale, s->p95 * scale,
+		s->p99 * scale);
+}
+
+// json_rates writes throughput statistics. Throughput percentiles are the
+// slowest ones, so they are named after the low percentile they represent.
+static void json_rates(FILE *fp, const struct stats *s)
+{
+	double scale = RATE_TO_BYTES_PER_SEC;
+	fprintf(fp,
+		"{\"min\":%.2f,\"max\":%.2f,\"avg\":%.2f,\"stdev\":%.2f,"
+		"\"p10\":%.2f,\"p5\":%.2f,\"p1\":%.2f}",
+		s->min * scale, s->max * scale, s->avg * scale,
+		s->stdev * scale, s->p90 * scale, s->p95 * scale,
+		s->p99 * scale);
+}
+
+static void json_result(FILE *fp, const struct result *r)
+{
+	fprintf(fp, "{\"ops\":%lu,\"bytes\":%lu,\"size_bytes\":", r->ops,
+		r->bytes);
+	json_stats(fp, &r->sizes, 1);
+	fprintf(fp, ",\"latency_ns\":");
+	json_stats(fp, &r->times, 1);
+	fprintf(fp, ",\"throughput_bytes_per_sec\":");
+	json_rates(fp, &r->rates);
+	fprintf(fp, "}");
+}
+
+static void json_config(FILE *fp, const struct benchmark_opts *opts)
+{
+	fprintf(fp,
+		"\"config\":{\"duration_s\":%d,\"continuous\":%s,"
+		"\"data_size_bytes\":%lu,\"forks\":%d,\"seed\":%ld,"
+		"\"quick\":%s,\"numa\":%s,\"placement\":\"%s\","
+		"\"data_node\":%d,",
+		opts->duration, opts->duration == 0 ? "true" : "false",
+		opts->data_size * GB, opts->forks, opts->seed,
+		opts->quick ? "true" : "false", opts->numa ? "true" : "false",
+		PLACEMENT_STRING[opts->placement], opts->data_node);
+	fprintf(fp,
+		"\"locality_interval_s\":%d,\"relocalize_pct\":%.2f,"
+		"\"fifo_priority\":%d,\"mlock\":%s,\"clock\":\"%s\","
+		"\"backing\":{\"file\":%s,\"shared\":%s,"
+		"\"prefault\":\"%s\",\"path\":",
+		opts->locality, opts->relocalize, opts->fifo,
+		opts->mlock ? "true" : "false", CLOCK_SOURCE_STRING[opts->clock],
+		opts->backing.file ? "true" : "false",
+		opts->backing.shared ? "true" : "false",
+		PREFAULT_STRING[opts->backing.prefault]);
+	json_string(fp, opts->backing.file ? opts->backing.path : NULL);
+	fprintf(fp, "},\"populate\":\"%s\",\"io\":",
+		POPULATE_STRING[opts->populate]);
+	if (opts->io.enabled) {
+		fprintf(fp, "{\"path\":");
+		json_string(fp, opts->io.path);
+		fprintf(fp,
+			",\"engine\":\"%s\",\"direct\":%s,\"depth\":%d,"
+			"\"block_size_bytes\":%lu,\"file_size_bytes\":%lu}",
+			IO_ENGINE_STRING[opts->io.engine],
+			opts->io.direct ? "true" : "false", opts->io.depth,
+			opts->io.block_size, opts->io.file_size);
+	} else {
+		fprintf(fp, "null");
+	}
+	fprintf(fp, ",\"async_depth\":%d,\"async_threads\":%d",
+		opts->async_depth, opts->async_threads);
+	fprintf(fp, ",\"churn\":");
+	if (opts->churn.rate > 0)
+		fprintf(fp,
+			"{\"rate\":%lu,\"allocator\":\"%s\","
+			"\"min_size_bytes\":%lu,\"max_size_bytes\":%lu,"
+			"\"lifetime_ms\":%lu}",
+			opts->churn.rate,
+			ALLOCATOR_STRING[opts->churn.allocator],
+			opts->churn.min_size, opts->churn.max_size,
+			opts->churn.lifetime_ms);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"working_set\":");
+	if (opts->workset.enabled)
+		fprintf(fp,
+			"{\"curve\":\"%s\",\"min_pct\":%d,\"max_pct\":%d,"
+			"\"period_s\":%d,\"shrink\":\"%s\"}",
+			CURVE_STRING[opts->workset.curve],
+			opts->workset.min_pct, opts->workset.max_pct,
+			opts->workset.period,
+			SHRINK_STRING[opts->workset.shrink]);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"verify\":");
+	if (opts->verify.enabled)
+		fprintf(fp, "{\"sample_pct\":%d,\"threads\":%d}",
+			opts->verify.sample_pct, opts->verify.threads);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"fingerprint_threads\":%d,\"payload\":{",
+		opts->fingerprint_threads);
+	for (int p = 0; p < PAYLOADS; p++)
+		fprintf(fp, "%s\"%s\":%d", p ? "," : "", PAYLOAD_STRING[p],
+			opts->payload.weight[p]);
+	fprintf(fp,
+		"},\"sparse\":{\"count\":%d,\"unit\":\"%s\",\"pages_pct\":%d}",
+		opts->payload.sparse.count,
+		opts->payload.sparse.lines ? "lines" : "bytes",
+		opts->payload.sparse.pages_pct);
+	fprintf(fp, ",\"ksm\":");
+	if (opts->ksm.enabled)
+		fprintf(fp, "{\"dup_pct\":%d,\"region_pct\":%d,\"wait\":%d}",
+			opts->ksm.dup_pct, opts->ksm.region_pct, opts->ksm.wait);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"cow\":");
+	if (opts->cow.enabled)
+		fprintf(fp,
+			"{\"children\":%d,\"at\":%d,\"every\":%d,"
+			"\"hold\":%d,\"rate\":%d}",
+			opts->cow.children, opts->cow.at, opts->cow.every,
+			opts->cow.hold, opts->cow.rate);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"swap\":");
+	if (opts->swap.enabled) {
+		fprintf(fp, "{\"limit_pct\":%d,\"high\":%s,\"cgroup\":",
+			opts->swap.limit_pct, opts->swap.high ? "true" : "false");
+		json_string(fp, opts->swap.cgroup);
+		fprintf(fp, "}");
+	} else {
+		fprintf(fp, "null");
+	}
+	fprintf(fp, ",\"cgroup_stats_ms\":%d", opts->cgroup_stats_ms);
+	fprintf(fp, ",\"scenario_file\":");
+	json_string(fp, opts->scenario_file);
+	fprintf(fp, ",\"phases\":[");
+	for (int i = 0; i < SCENARIO.count; i++) {
+		const struct phase *p = &SCENARIO.phases[i];
+		fprintf(fp, "%s{\"name\":", i ? "," : "");
+		json_string(fp, p->name);
+		fprintf(fp,
+			",\"duration_s\":%d,\"interval_ms\":%d,"
+			"\"op_size_bytes\":%lu,\"rate_bytes_per_sec\":%lu,"
+			"\"write_pct\":%d,\"pattern\":\"%s\",\"idle\":%s}",
+			p->duration, p->interval_ms, p->op_size, p->rate,
+			p->write_pct, PATTERN_STRING[p->pattern],
+			p->idle ? "true" : "false");
+	}
+	fprintf(fp, "]}");
+}
+
+static void json_env(FILE *fp, const struct env *e)
+{
+	fprintf(fp, "\"environment\":{\"kernel\":");
+	json_string(fp, e->kernel);
+	fprintf(fp, ",\"kernel_version\":");
+	json_string(fp, e->kernel_version);
+	fprintf(fp, ",\"machine\":");
+	json_string(fp, e->machine);
+	fprintf(fp, ",\"hostname\":");
+	json_string(fp, e->hostname);
+	fprintf(fp, ",\"cpu_model\":");
+	json_string(fp, e->cpu_model);
+	fprintf(fp, ",\"microcode\":");
+	json_string(fp, e->microcode);
+	fprintf(fp, ",\"boot_id\":");
+	json_string(fp, e->boot_id);
+	fprintf(fp, ",\"cpus\":%d,\"numa_nodes\":%d,\"thp_enabled\":", e->cpus,
+		e->numa_nodes);
+	json_string(fp, e->thp_enabled);
+	fprintf(fp, ",\"thp_defrag\":");
+	json_string(fp, e->thp_defrag);
+	fprintf(fp,
+		",\"page_size_bytes\":%ld,\"clock_resolution_ns\":%ld,"
+		"\"invariant_tsc\":%s,\"timer\":{\"source\":\"%s\","
+		"\"ticks_per_ns\":%.6f,\"overhead_ns\":%lu}}",
+		e->page_size, e->clock_resolution_ns,
+		tsc_invariant() ? "true" : "false",
+		CLOCK_SOURCE_STRING[CLOCK_SOURCE], TSC_PER_NS,
+		TIMER_OVERHEAD_NS);
+}
+
+static void write_json(FILE *fp, const struct benchmark_opts *opts,
+		       const struct env *e)
+{
+	bool continuous = opts->duration == 0;
+
+	fprintf(fp, "{\"schema_version\":%d,", OUTPUT_SCHEMA_VERSION);
+	json_config(fp, opts);
+	fprintf(fp, ",");
+	json_env(fp, e);
+
+	fprintf(fp, ",\"timeline\":{\"path\":");
+	json_string(fp, opts->timeline_file);
+	fprintf(fp, ",\"start_monotonic_ns\":%lu,\"start_realtime_ns\":%lu}",
+		SHARED->start_ns, SHARED->start_realtime_ns);
+	fprintf(fp, ",\"populate_ns\":%lu,\"startup\":", SHARED->populate_ns);
+	startup_json(fp);
+	fprintf(fp, ",\"fingerprint\":");
+	if (opts->fingerprint_threads > 0)
+		fingerprint_json(fp);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"ksm\":");
+	if (opts->ksm.enabled)
+		ksm_json(fp);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"swap\":");
+	if (opts->swap.enabled)
+		swap_json(fp);
+	else
+		fprintf(fp, "null");
+	fprintf(fp, ",\"cgroup\":");
+	cgroup_sampler_json(fp);
+
+	fprintf(fp, ",\"workers\":[");
+	for (int i = 0; i < SHARED->workers_count; i++) {
+		const struct worker *w = &SHARED->workers[i];
+		fprintf(fp,
+			"%s{\"worker\":%d,\"pid\":%d,\"cpu\":%d,\"node\":%d,"
+			"\"data_node\":%d,\"total\":",
+			i ? "," : "", i, w->pid, w->cpu, w->node, w->data_node);
+		json_result(fp, &w->total);
+		fprintf(fp, ",\"locality\":");
+		if (w->locality.sampled > 0)
+			locality_json(fp, &w->locality);
+		else
+			fprintf(fp, "null");
+		fprintf(fp,
+			",\"relocalized_pages\":%lu,\"relocalize_ns\":%lu,"
+			"\"involuntary_context_switches\":%lu,"
+			"\"preempted_ops\":%lu,\"timer_jumps\":%lu,"
+			"\"timer_freq_changes\":%lu",
+			w->relocalized, w->relocalize_ns,
+			w->involuntary_switches, w->preempted, w->timer_jumps,
+			w->timer_freq_changes);
+		fprintf(fp,
+			",\"major_faults\":%lu,\"page_cache\":",
+			w->major_faults);
+		if (opts->backing.file) {
+			fprintf(fp, "{\"hits\":%lu,\"misses\":%lu,"
+				    "\"cached_latency_ns\":",
+				w->page_hits, w->page_misses);
+			hist_json(fp, &w->cached_latency);
+			fprintf(fp, ",\"uncached_latency_ns\":");
+			hist_json(fp, &w->uncached_latency);
+			fprintf(fp, "}");
+		} else {
+			fprintf(fp, "null");
+		}
+		fprintf(fp, ",\"population\":");
+		if (opts->populate != POPULATE_EAGER) {
+			fprintf(fp,
+				"{\"pages_filled\":%lu,\"minor_faults\":%lu,"
+				"\"last_populate_ns\":%lu,"
+				"\"populate_latency_ns\":",
+				w->populated_pages, w->minor_faults,
+				w->last_populate_ns);
+			hist_json(fp, &w->populate_latency);
+			fprintf(fp, ",\"steady_latency_ns\":");
+			hist_json(fp, &w->steady_latency);
+			fprintf(fp, "}");
+		} else {
+			fprintf(fp, "null");
+		}
+		fprintf(fp, ",\"async\":");
+		if (opts->async_depth > 0) {
+			fprintf(fp, "{\"saturated_ticks\":%lu,"
+				    "\"queue_latency_ns\":",
+				w->async_saturated);
+			hist_json(fp, &w->queue_latency);
+			fprintf(fp, ",\"service_latency_ns\":");
+			hist_json(fp, &w->service_latency);
+			fprintf(fp, "}");
+		} else {
+			fprintf(fp, "null");
+		}
+		fprintf(fp, ",\"churn\":");
+		if (opts->churn.rate > 0)
+			churn_json(fp, &w->churn);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"working_set\":");
+		if (opts->workset.enabled)
+			workset_json(fp, &w->workset);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"verify\":");
+		if (opts->verify.enabled)
+			verify_json(fp, &w->verify);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"payloads\":{");
+		for (int p = 0; p < PAYLOADS; p++)
+			fprintf(fp,
+				"%s\"%s\":{\"ops\":%lu,\"bytes\":%lu,"
+				"\"pages_dirtied\":%lu,\"bytes_written\":%lu}",
+				p ? "," : "", PAYLOAD_STRING[p],
+				w->payload_ops[p], w->payload_bytes[p],
+				w->payload_pages[p], w->payload_written[p]);
+		fprintf(fp, "}");
+		fprintf(fp, ",\"ksm\":");
+		if (opts->ksm.enabled)
+			ksm_stats_json(fp, &w->ksm);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"cow\":");
+		if (opts->cow.enabled)
+			cow_json(fp, &w->cow);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"swap\":");
+		if (opts->swap.enabled)
+			swap_stats_json(fp, &w->swap);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"io\":");
+		if (opts->io.enabled)
+			io_json(fp, &w->io, SHARED->segments);
+		else
+			fprintf(fp, "null");
+		fprintf(fp, ",\"latency_histogram_ns\":");
+		hist_json(fp, &w->lifetime);
+		fprintf(fp, ",\"segments\":[");
+		for (int g = 0; g < SHARED->segments; g++) {
+			fprintf(fp, "%s{\"index\":%d,\"latency_ns\":",
+				g ? "," : "", g);
+			hist_json(fp, &w->segment_latency[g]);
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "]");
+		fprintf(fp, ",\"phases\":[");
+		for (int p = 0; p < SCENARIO.count; p++) {
+			fprintf(fp, "%s{\"name\":", p ? "," : "");
+			json_string(fp, SCENARIO.phases[p].name);
+			if (!continuous) {
+				fprintf(fp, ",\"result\":");
+				json_result(fp, &w->phases[p]);
+			}
+			fprintf(fp, ",\"latency_histogram_ns\":");
+			hist_json(fp, &w->phase_latency[p]);
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "]");
+
+	// Combine the histograms of every worker so results of multiple forks
+	// can be compared as a whole.
+	struct hist *h = calloc(4, sizeof(struct hist));
+	if (h == NULL) {
+		fprintf(fp, "}\n");
+		return;
+	}
+	merge_hists(&h[0], &h[1], &h[2]);
+	fprintf(fp, ",\"total\":{\"ops\":%lu,\"bytes\":%.0f,\"latency_ns\":",
+		h[0].count, h[1].sum);
+	hist_json(fp, &h[0]);
+	fprintf(fp, ",\"size_bytes\":");
+	hist_json(fp, &h[1]);
+	fprintf(fp, ",\"phases\":[");
+	for (int p = 0; p < SCENARIO.count; p++) {
+		hist_reset(&h[3]);
+		for (int i = 0; i < SHARED->workers_count; i++)
+			hist_merge(&h[3], &SHARED->workers[i].phase_latency[p]);
+		fprintf(fp, "%s{\"name\":", p ? "," : "");
+		json_string(fp, SCENARIO.phases[p].name);
+		fprintf(fp, ",\"latency_ns\":");
+		hist_json(fp, &h[3]);
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "]}");
+
+	// Segments split the run at detected migrations, with the first one
+	// being before any migration.
+	fprintf(fp, ",\"segments\":[");
+	for (int g = 0; g < SHARED->segments; g++) {
+		hist_reset(&h[3]);
+		for (int i = 0; i < SHARED->workers_count; i++)
+			hist_merge(&h[3], &SHARED->workers[i].segment_latency[g]);
+		fprintf(fp, "%s{\"index\":%d,\"start_ns\":%lu,\"reasons\":",
+			g ? "," : "", g, SHARED->segment[g].start_ns);
+		json_string(fp, SHARED->segment[g].reasons);
+		fprintf(fp, ",\"latency_ns\":");
+		hist_json(fp, &h[3]);
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "]}\n");
+	free(h);
+}
+
+// csv_row writes a single section,worker,phase,key,value row.
+static void csv_row(FILE *fp, const char *section, int worker,
+		    const char *phase, const char *key, const char *value)
+{
+	fprintf(fp, "%s,", section);
+	if (worker >= 0)
+		fprintf(fp, "%d", worker);
+	else if (worker == -2)
+		fprintf(fp, "all");
+	fputc(',', fp);
+	csv_string(fp, phase);
+	fprintf(fp, ",%s,", key);
+	csv_string(fp, value);
+	fputc('\n', fp);
+}
+
+static void csv_num(FILE *fp, const char *section, int worker,
+		    const char *phase, const char *key, double value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.15g", value);
+	csv_row(fp, section, worker, phase, key, buf);
+}
+
+static void csv_stats(FILE *fp, int worker, const char *phase,
+		      const char *name, const struct stats *s, double scale,
+		      bool low)
+{
+	char key[128];
+	const char *p[] = { "p90", "p95", "p99" };
+	if (low) {
+		p[0] = "p10";
+		p[1] = "p5";
+		p[2] = "p1";
+	}
+
+#define CSV_STAT(field, label)                                        \
+	snprintf(key, sizeof(key), "%s.%s", name, label);             \
+	csv_num(fp, "stat", worker, phase, key, s->field * scale);
+
+	CSV_STAT(min, "min");
+	CSV_STAT(max, "max");
+	CSV_STAT(avg, "avg");
+	CSV_STAT(stdev, "stdev");
+	CSV_STAT(p90, p[0]);
+	CSV_STAT(p95, p[1]);
+	CSV_STAT(p99, p[2]);
+#undef CSV_STAT
+}
+
+static void csv_result(FILE *fp, int worker, const char *phase,
+		       const struct result *r)
+{
+	csv_num(fp, "stat", worker, phase, "ops", r->ops);
+	csv_num(fp, "stat", worker, phase, "bytes", r->bytes);
+	csv_stats(fp, worker, phase, "size_bytes", &r->sizes, 1, false);
+	csv_stats(fp, worker, phase, "latency_ns", &r->times, 1, false);
+	csv_stats(fp, worker, phase, "throughput_bytes_per_sec", &r->rates,
+		  RATE_TO_BYTES_PER_SEC, true);
+}
+
+static void write_csv(FILE *fp, const struct benchmark_opts *opts,
+		      const struct env *e)
+{
+	bool continuous = opts->duration == 0;
+
+	fprintf(fp, "section,worker,phase,key,value\n");
+	csv_num(fp, "schema", -1, NULL, "version", OUTPUT_SCHEMA_VERSION);
+
+	csv_num(fp, "config", -1, NULL, "duration_s", opts->duration);
+	csv_row(fp, "config", -1, NULL, "continuous",
+		continuous ? "true" : "false");
+	csv_num(fp, "config", -1, NULL, "data_size_bytes",
+		opts->data_size * GB);
+	csv_num(fp, "config", -1, NULL, "forks", opts->forks);
+	csv_num(fp, "config", -1, NULL, "seed", opts->seed);
+	csv_row(fp, "config", -1, NULL, "placement",
+		PLACEMENT_STRING[opts->placement]);
+	csv_num(fp, "config", -1, NULL, "data_node", opts->data_node);
+	csv_num(fp, "config", -1, NULL, "locality_interval_s", opts->locality);
+	csv_num(fp, "config", -1, NULL, "relocalize_pct", opts->relocalize);
+	csv_num(fp, "config", -1, NULL, "fifo_priority", opts->fifo);
+	csv_row(fp, "config", -1, NULL, "mlock", opts->mlock ? "true" : "false");
+	csv_row(fp, "config", -1, NULL, "clock", CLOCK_SOURCE_STRING[opts->clock]);
+	csv_row(fp, "config", -1, NULL, "backing.file",
+		opts->backing.file ? "true" : "false");
+	csv_row(fp, "config", -1, NULL, "backing.shared",
+		opts->backing.shared ? "true" : "false");
+	csv_row(fp, "config", -1, NULL, "backing.prefault",
+		PREFAULT_STRING[opts->backing.prefault]);
+	csv_row(fp, "config", -1, NULL, "backing.path",
+		opts->backing.file ? opts->backing.path : NULL);
+	csv_row(fp, "config", -1, NULL, "populate",
+		POPULATE_STRING[opts->populate]);
+	if (opts->io.enabled) {
+		csv_row(fp, "config", -1, NULL, "io.path", opts->io.path);
+		csv_row(fp, "config", -1, NULL, "io.engine",
+			IO_ENGINE_STRING[opts->io.engine]);
+		csv_row(fp, "config", -1, NULL, "io.direct",
+			opts->io.direct ? "true" : "false");
+		csv_num(fp, "config", -1, NULL, "io.depth", opts->io.depth);
+		csv_num(fp, "config", -1, NULL, "io.block_size_bytes",
+			opts->io.block_size);
+		csv_num(fp, "config", -1, NULL, "io.file_size_bytes",
+			opts->io.file_size);
+	}
+	csv_num(fp, "config", -1, NULL, "async_depth", opts->async_depth);
+	csv_num(fp, "config", -1, NULL, "async_threads", opts->async_threads);
+	if (opts->churn.rate > 0) {
+		csv_num(fp, "config", -1, NULL, "churn.rate", opts->churn.rate);
+		csv_row(fp, "config", -1, NULL, "churn.allocator",
+			ALLOCATOR_STRING[opts->churn.allocator]);
+		csv_num(fp, "config", -1, NULL, "churn.min_size_bytes",
+			opts->churn.min_size);
+		csv_num(fp, "config", -1, NULL, "churn.max_size_bytes",
+			opts->churn.max_size);
+		csv_num(fp, "config", -1, NULL, "churn.lifetime_ms",
+			opts->churn.lifetime_ms);
+	}
+	if (opts->workset.enabled) {
+		csv_row(fp, "config", -1, NULL, "working_set.curve",
+			CURVE_STRING[opts->workset.curve]);
+		csv_num(fp, "config", -1, NULL, "working_set.min_pct",
+			opts->workset.min_pct);
+		csv_num(fp, "config", -1, NULL, "working_set.max_pct",
+			opts->workset.max_pct);
+		csv_num(fp, "config", -1, NULL, "working_set.period_s",
+			opts->workset.period);
+		csv_row(fp, "config", -1, NULL, "working_set.shrink",
+			SHRINK_STRING[opts->workset.shrink]);
+	}
+	if (opts->verify.enabled) {
+		csv_num(fp, "config", -1, NULL, "verify.sample_pct",
+			opts->verify.sample_pct);
+		csv_num(fp, "config", -1, NULL, "verify.threads",
+			opts->verify.threads);
+	}
+	if (opts->fingerprint_threads > 0)
+		csv_num(fp, "config", -1, NULL, "fingerprint.threads",
+			opts->fingerprint_threads);
+	for (int p = 0; p < PAYLOADS; p++) {
+		char key[64];
+		snprintf(key, sizeof(key), "payload.%s", PAYLOAD_STRING[p]);
+		csv_num(fp, "config", -1, NULL, key, opts->payload.weight[p]);
+	}
+	csv_num(fp, "config", -1, NULL, "sparse.count",
+		opts->payload.sparse.count);
+	csv_row(fp, "config", -1, NULL, "sparse.unit",
+		opts->payload.sparse.lines ? "lines" : "bytes");
+	csv_num(fp, "config", -1, NULL, "sparse.pages_pct",
+		opts->payload.sparse.pages_pct);
+	if (opts->ksm.enabled) {
+		csv_num(fp, "config", -1, NULL, "ksm.dup_pct",
+			opts->ksm.dup_pct);
+		csv_num(fp, "config", -1, NULL, "ksm.region_pct",
+			opts->ksm.region_pct);
+		csv_num(fp, "config", -1, NULL, "ksm.wait", opts->ksm.wait);
+	}
+	if (opts->cow.enabled) {
+		csv_num(fp, "config", -1, NULL, "cow.children",
+			opts->cow.children);
+		csv_num(fp, "config", -1, NULL, "cow.at", opts->cow.at);
+		csv_num(fp, "config", -1, NULL, "cow.every", opts->cow.every);
+		csv_num(fp, "config", -1, NULL, "cow.hold", opts->cow.hold);
+		csv_num(fp, "config", -1, NULL, "cow.rate", opts->cow.rate);
+	}
+	if (opts->swap.enabled) {
+		csv_num(fp, "config", -1, NULL, "swap.limit_pct",
+			opts->swap.limit_pct);
+		csv_row(fp, "config", -1, NULL, "swap.high",
+			opts->swap.high ? "true" : "false");
+		csv_row(fp, "config", -1, NULL, "swap.cgroup", opts->swap.cgroup);
+	}
+	csv_num(fp, "config", -1, NULL, "cgroup_stats_ms",
+		opts->cgroup_stats_ms);
+	csv_row(fp, "config", -1, NULL, "scenario_file", opts->scenario_file);
+	for (int i = 0; i < SCENARIO.count; i++) {
+		const struct phase *p = &SCENARIO.phases[i];
+		csv_num(fp, "config", -1, p->name, "duration_s", p->duration);
+		csv_num(fp, "config", -1, p->name, "interval_ms",
+			p->interval_ms);
+		csv_num(fp, "config", -1, p->name, "op_size_bytes",
+			p->op_size);
+		csv_num(fp, "config", -1, p->name, "rate_bytes_per_sec",
+			p->rate);
+		csv_num(fp, "config", -1, p->name, "write_pct", p->write_pct);
+		csv_row(fp, "config", -1, p->name, "pattern",
+			PATTERN_STRING[p->pattern]);
+		csv_row(fp, "config", -1, p->name, "idle",
+			p->idle ? "true" : "false");
+	}
+
+	csv_row(fp, "environment", -1, NULL, "kernel", e->kernel);
+	csv_row(fp, "environment", -1, NULL, "kernel_version",
+		e->kernel_version);
+	csv_row(fp, "environment", -1, NULL, "machine", e->machine);
+	csv_row(fp, "environment", -1, NULL, "hostname", e->hostname);
+	csv_row(fp, "environment", -1, NULL, "cpu_model", e->cpu_model);
+	csv_row(fp, "environment", -1, NULL, "microcode", e->microcode);
+	csv_row(fp, "environment", -1, NULL, "boot_id", e->boot_id);
+	csv_num(fp, "environment", -1, NULL, "cpus", e->cpus);
+	csv_num(fp, "environment", -1, NULL, "numa_nodes", e->numa_nodes);
+	csv_row(fp, "environment", -1, NULL, "thp_enabled", e->thp_enabled);
+	csv_row(fp, "environment", -1, NULL, "thp_defrag", e->thp_defrag);
+	csv_num(fp, "environment", -1, NULL, "page_size_bytes", e->page_size);
+	csv_num(fp, "environment", -1, NULL, "clock_resolution_ns",
+		e->clock_resolution_ns);
+	csv_row(fp, "environment", -1, NULL, "invariant_tsc",
+		tsc_invariant() ? "true" : "false");
+	csv_row(fp, "environment", -1, NULL, "timer.source",
+		CLOCK_SOURCE_STRING[CLOCK_SOURCE]);
+	csv_num(fp, "environment", -1, NULL, "timer.ticks_per_ns", TSC_PER_NS);
+	csv_num(fp, "environment", -1, NULL, "timer.overhead_ns",
+		TIMER_OVERHEAD_NS);
+
+	csv_row(fp, "timeline", -1, NULL, "path", opts->timeline_file);
+	// Wall clock times have more digits than a double holds.
+	char start[32];
+	snprintf(start, sizeof(start), "%lu", SHARED->start_ns);
+	csv_row(fp, "timeline", -1, NULL, "start_monotonic_ns", start);
+	snprintf(start, sizeof(start), "%lu", SHARED->start_realtime_ns);
+	csv_row(fp, "timeline", -1, NULL, "start_realtime_ns", start);
+	csv_num(fp, "population", -1, NULL, "populate_ns", SHARED->populate_ns);
+	for (int i = 0; i < STARTUP_EVENTS; i++) {
+		const struct timestamp *ts = &SHARED->startup.events[i];
+		if (ts->monotonic_ns == 0)
+			continue;
+		// Wall clock times have more digits than a double holds.
+		char key[64], value[32];
+		snprintf(key, sizeof(key), "%s.monotonic_ns",
+			 STARTUP_EVENT_STRING[i]);
+		snprintf(value, sizeof(value), "%lu", ts->monotonic_ns);
+		csv_row(fp, "startup", -1, NULL, key, value);
+		snprintf(key, sizeof(key), "%s.realtime_ns",
+			 STARTUP_EVENT_STRING[i]);
+		snprintf(value, sizeof(value), "%lu", ts->realtime_ns);
+		csv_row(fp, "startup", -1, NULL, key, value);
+	}
+	csv_row(fp, "startup", -1, NULL, "restore_reasons",
+		SHARED->startup.restore_reasons);
+	for (int i = 0; i < FINGERPRINT_POINTS; i++) {
+		const struct fingerprint *f = fingerprint_get(i);
+		if (f == NULL)
+			continue;
+		char key[64], value[32];
+		snprintf(key, sizeof(key), "%s.root",
+			 FINGERPRINT_POINT_STRING[i]);
+		snprintf(value, sizeof(value), "%016lx", f->root);
+		csv_row(fp, "fingerprint", -1, NULL, key, value);
+		for (int g = 0; g < f->count; g++) {
+			snprintf(key, sizeof(key), "%s.gb.%d",
+				 FINGERPRINT_POINT_STRING[i], g);
+			snprintf(value, sizeof(value), "%016lx", f->gb[g]);
+			csv_row(fp, "fingerprint", -1, NULL, key, value);
+		}
+		snprintf(key, sizeof(key), "%s.ns",
+			 FINGERPRINT_POINT_STRING[i]);
+		csv_num(fp, "fingerprint", -1, NULL, key, f->ns);
+	}
+	for (int p = 0; p < KSM_POINTS; p++) {
+		const long *c = ksm_counters(p);
+		if (c == NULL)
+			continue;
+		for (int k = 0; k < KSM_COUNTERS; k++) {
+			char key[64];
+			if (c[k] < 0)
+				continue;
+			snprintf(key, sizeof(key), "%s.%s", KSM_POINT_STRING[p],
+				 KSM_COUNTER_STRING[k]);
+			csv_num(fp, "ksm", -1, NULL, key, c[k]);
+		}
+	}
+	for (int p = 0; p < SWAP_POINTS; p++) {
+		const long *c = swap_counters(p);
+		if (c == NULL)
+			continue;
+		for (int k = 0; k < SWAP_COUNTERS; k++) {
+			char key[64];
+			if (c[k] < 0)
+				continue;
+			snprintf(key, sizeof(key), "%s.%s", SWAP_POINT_STRING[p],
+				 SWAP_COUNTER_STRING[k]);
+			csv_num(fp, "swap", -1, NULL, key, c[k]);
+		}
+	}
+	for (int last = 0; last < 2; last++) {
+		const struct cgroup_sample *c = cgroup_sampler_get(last);
+		if (c == NULL)
+			break;
+		const char *point = last ? "last" : "first";
+		const char *names[] = { "memory_some_avg10",
+					"memory_full_avg10",
+					"memory_some_total_us",
+					"memory_full_total_us",
+					"cpu_some_avg10",
+					"cpu_some_total_us",
+					"memory_current",
+					"anon",
+					"file",
+					"anon_thp",
+					"file_thp",
+					"workingset_refault",
+					"pgfault" };
+		double values[] = { c->memory.some_avg10, c->memory.full_avg10,
+				    c->memory.some_total, c->memory.full_total,
+				    c->cpu.some_avg10,	  c->cpu.some_total,
+				    c->current,		  c->anon,
+				    c->file,		  c->anon_thp,
+				    c->file_thp,	  c->workingset_refault,
+				    c->pgfault };
+		for (int k = 0; k < sizeof(values) / sizeof(values[0]); k++) {
+			char key[64];
+			if (values[k] < 0)
+				continue;
+			snprintf(key, sizeof(key), "%s.%s", point, names[k]);
+			csv_num(fp, "cgroup", -1, NULL, key, values[k]);
+		}
+	}
+
+	for (int i = 0; i < SHARED->workers_count; i++) {
+		const struct worker *w = &SHARED->workers[i];
+		csv_num(fp, "worker", i, NULL, "pid", w->pid);
+		csv_num(fp, "worker", i, NULL, "cpu", w->cpu);
+		csv_num(fp, "worker", i, NULL, "node", w->node);
+		csv_num(fp, "worker", i, NULL, "data_node", w->data_node);
+		for (int n = 0; n < LOCALITY_MAX_NODES; n++) {
+			char key[32];
+			if (w->locality.nodes[n] == 0)
+				continue;
+			snprintf(key, sizeof(key), "locality.node%d", n);
+			csv_num(fp, "worker", i, NULL, key,
+				w->locality.nodes[n]);
+		}
+		if (w->locality.sampled > 0) {
+			csv_num(fp, "worker", i, NULL, "locality.missing",
+				w->locality.missing);
+			csv_num(fp, "worker", i, NULL, "locality.sampled",
+				w->locality.sampled);
+		}
+		csv_num(fp, "worker", i, NULL, "relocalized_pages",
+			w->relocalized);
+		csv_num(fp, "worker", i, NULL, "relocalize_ns",
+			w->relocalize_ns);
+		csv_num(fp, "worker", i, NULL, "involuntary_context_switches",
+			w->involuntary_switches);
+		csv_num(fp, "worker", i, NULL, "preempted_ops", w->preempted);
+		csv_num(fp, "worker", i, NULL, "timer_jumps", w->timer_jumps);
+		csv_num(fp, "worker", i, NULL, "timer_freq_changes",
+			w->timer_freq_changes);
+		csv_num(fp, "worker", i, NULL, "major_faults", w->major_faults);
+		if (opts->backing.file) {
+			csv_num(fp, "worker", i, NULL, "page_cache.hits",
+				w->page_hits);
+			csv_num(fp, "worker", i, NULL, "page_cache.misses",
+				w->page_misses);
+			csv_num(fp, "worker", i, NULL,
+				"page_cache.cached_latency_ns.p50",
+				hist_percentile(&w->cached_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"page_cache.uncached_latency_ns.p50",
+				hist_percentile(&w->uncached_latency, 50));
+		}
+		if (opts->populate != POPULATE_EAGER) {
+			csv_num(fp, "worker", i, NULL,
+				"population.pages_filled", w->populated_pages);
+			csv_num(fp, "worker", i, NULL,
+				"population.minor_faults", w->minor_faults);
+			csv_num(fp, "worker", i, NULL,
+				"population.last_populate_ns",
+				w->last_populate_ns);
+			csv_num(fp, "worker", i, NULL,
+				"population.populate_latency_ns.p50",
+				hist_percentile(&w->populate_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"population.steady_latency_ns.p50",
+				hist_percentile(&w->steady_latency, 50));
+		}
+		if (opts->async_depth > 0) {
+			csv_num(fp, "worker", i, NULL, "async.saturated_ticks",
+				w->async_saturated);
+			csv_num(fp, "worker", i, NULL,
+				"async.queue_latency_ns.p50",
+				hist_percentile(&w->queue_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"async.queue_latency_ns.p99",
+				hist_percentile(&w->queue_latency, 99));
+			csv_num(fp, "worker", i, NULL,
+				"async.service_latency_ns.p50",
+				hist_percentile(&w->service_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"async.service_latency_ns.p99",
+				hist_percentile(&w->service_latency, 99));
+		}
+		if (opts->churn.rate > 0) {
+			const struct churn_stats *c = &w->churn;
+			csv_num(fp, "worker", i, NULL, "churn.allocs", c->allocs);
+			csv_num(fp, "worker", i, NULL, "churn.frees", c->frees);
+			csv_num(fp, "worker", i, NULL, "churn.failures",
+				c->failures);
+			csv_num(fp, "worker", i, NULL, "churn.live_bytes",
+				c->live_bytes);
+			csv_num(fp, "worker", i, NULL, "churn.peak_live_bytes",
+				c->peak_live_bytes);
+			csv_num(fp, "worker", i, NULL, "churn.peak_rss_bytes",
+				c->peak_rss);
+			csv_num(fp, "worker", i, NULL,
+				"churn.alloc_latency_ns.p50",
+				hist_percentile(&c->alloc_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"churn.alloc_latency_ns.p99",
+				hist_percentile(&c->alloc_latency, 99));
+		}
+		if (opts->workset.enabled) {
+			const struct workset_stats *ws = &w->workset;
+			csv_num(fp, "worker", i, NULL, "working_set.size_bytes",
+				ws->size);
+			csv_num(fp, "worker", i, NULL,
+				"working_set.peak_size_bytes", ws->peak_size);
+			csv_num(fp, "worker", i, NULL,
+				"working_set.peak_rss_bytes", ws->peak_rss);
+			csv_num(fp, "worker", i, NULL, "working_set.grows",
+				ws->grows);
+			csv_num(fp, "worker", i, NULL, "working_set.shrinks",
+				ws->shrinks);
+		}
+		for (int p = 0; p < PAYLOADS; p++) {
+			char key[64];
+			snprintf(key, sizeof(key), "payloads.%s.ops",
+				 PAYLOAD_STRING[p]);
+			csv_num(fp, "worker", i, NULL, key, w->payload_ops[p]);
+			snprintf(key, sizeof(key), "payloads.%s.bytes",
+				 PAYLOAD_STRING[p]);
+			csv_num(fp, "worker", i, NULL, key, w->payload_bytes[p]);
+			snprintf(key, sizeof(key), "payloads.%s.pages_dirtied",
+				 PAYLOAD_STRING[p]);
+			csv_num(fp, "worker", i, NULL, key, w->payload_pages[p]);
+			snprintf(key, sizeof(key), "payloads.%s.bytes_written",
+				 PAYLOAD_STRING[p]);
+			csv_num(fp, "worker", i, NULL, key,
+				w->payload_written[p]);
+		}
+		if (opts->ksm.enabled) {
+			const struct ksm_stats *k = &w->ksm;
+			csv_num(fp, "worker", i, NULL, "ksm.merged_writes",
+				k->merged_writes);
+			csv_num(fp, "worker", i, NULL, "ksm.merged_pages",
+				k->merged_pages);
+			csv_num(fp, "worker", i, NULL,
+				"ksm.merged_latency_ns.p50",
+				hist_percentile(&k->merged_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"ksm.merged_latency_ns.p99",
+				hist_percentile(&k->merged_latency, 99));
+			csv_num(fp, "worker", i, NULL,
+				"ksm.unmerged_latency_ns.p50",
+				hist_percentile(&k->unmerged_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"ksm.unmerged_latency_ns.p99",
+				hist_percentile(&k->unmerged_latency, 99));
+		}
+		if (opts->cow.enabled) {
+			const struct cow_stats *c = &w->cow;
+			csv_num(fp, "worker", i, NULL, "cow.forks", c->forks);
+			csv_num(fp, "worker", i, NULL, "cow.fork_latency_ns.p50",
+				hist_percentile(&c->fork_latency, 50));
+			csv_num(fp, "worker", i, NULL, "cow.fork_latency_ns.max",
+				c->fork_latency.max);
+			csv_num(fp, "worker", i, NULL, "cow.cow_writes",
+				c->cow_writes);
+			csv_num(fp, "worker", i, NULL, "cow.cow_pages",
+				c->cow_pages);
+			const struct hist *h[] = { &c->cow_latency,
+						   &c->steady_latency,
+						   &c->child_cow_latency,
+						   &c->child_steady_latency };
+			const char *name[] = { "cow", "steady", "child_cow",
+					       "child_steady" };
+			for (int k = 0; k < 4; k++) {
+				char key[64];
+				snprintf(key, sizeof(key),
+					 "cow.%s_latency_ns.p50", name[k]);
+				csv_num(fp, "worker", i, NULL, key,
+					hist_percentile(h[k], 50));
+				snprintf(key, sizeof(key),
+					 "cow.%s_latency_ns.p99", name[k]);
+				csv_num(fp, "worker", i, NULL, key,
+					hist_percentile(h[k], 99));
+			}
+		}
+		if (opts->swap.enabled) {
+			const struct swap_stats *sw = &w->swap;
+			csv_num(fp, "worker", i, NULL, "swap.resident_pages",
+				sw->resident_pages);
+			csv_num(fp, "worker", i, NULL, "swap.nonresident_pages",
+				sw->nonresident_pages);
+			csv_num(fp, "worker", i, NULL, "swap.major_faults",
+				sw->major_faults);
+			csv_num(fp, "worker", i, NULL,
+				"swap.resident_latency_ns.p50",
+				hist_percentile(&sw->resident_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"swap.resident_latency_ns.p99",
+				hist_percentile(&sw->resident_latency, 99));
+			csv_num(fp, "worker", i, NULL,
+				"swap.nonresident_latency_ns.p50",
+				hist_percentile(&sw->nonresident_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"swap.nonresident_latency_ns.p99",
+				hist_percentile(&sw->nonresident_latency, 99));
+		}
+		if (opts->verify.enabled) {
+			const struct verify_stats *v = &w->verify;
+			csv_num(fp, "worker", i, NULL, "verify.runs", v->runs);
+			csv_num(fp, "worker", i, NULL, "verify.pages", v->pages);
+			csv_num(fp, "worker", i, NULL, "verify.mismatches",
+				v->mismatches);
+			csv_num(fp, "worker", i, NULL, "verify.last_bytes",
+				v->last_bytes);
+			csv_num(fp, "worker", i, NULL, "verify.last_ns",
+				v->last_ns);
+		}
+		if (opts->io.enabled) {
+			const struct io_stats *io = &w->io;
+			csv_row(fp, "worker", i, NULL, "io.engine",
+				IO_ENGINE_STRING[io->engine]);
+			csv_num(fp, "worker", i, NULL, "io.reads",
+				io->read_latency.count);
+			csv_num(fp, "worker", i, NULL, "io.writes",
+				io->write_latency.count);
+			csv_num(fp, "worker", i, NULL, "io.bytes", io->bytes);
+			csv_num(fp, "worker", i, NULL, "io.errors", io->errors);
+			csv_num(fp, "worker", i, NULL, "io.missed_ticks",
+				io->missed_ticks);
+			csv_num(fp, "worker", i, NULL, "io.saturated_ticks",
+				io->saturated_ticks);
+			csv_num(fp, "worker", i, NULL, "io.read_latency_ns.p50",
+				hist_percentile(&io->read_latency, 50));
+			csv_num(fp, "worker", i, NULL, "io.read_latency_ns.p99",
+				hist_percentile(&io->read_latency, 99));
+			csv_num(fp, "worker", i, NULL,
+				"io.write_latency_ns.p50",
+				hist_percentile(&io->write_latency, 50));
+			csv_num(fp, "worker", i, NULL,
+				"io.write_latency_ns.p99",
+				hist_percentile(&io->write_latency, 99));
+		}
+		csv_result(fp, i, "all", &w->total);
+		for (int p = 0; p < SCENARIO.count && !continuous; p++)
+			csv_result(fp, i, SCENARIO.phases[p].name,
+				   &w->phases[p]);
+	}
+
+	struct hist *h = calloc(3, sizeof(struct hist));
+	if (h == NULL)
+		return;
+	merge_hists(&h[0], &h[1], &h[2]);
+	struct result total = {
+		.ops = h[0].count,
+		.bytes = h[1].sum,
+	};
+	hist_stats(&h[1], &total.sizes);
+	hist_stats(&h[0], &total.times);
+	hist_stats(&h[2], &total.rates);
+	total.rates.p99 = hist_percentile(&h[2], 1);
+	total.rates.p95 = hist_percentile(&h[2], 5);
+	total.rates.p90 = hist_percentile(&h[2], 10);
+	csv_result(fp, -2, "all", &total);
+
+	for (int g = 0; g < SHARED->segments; g++) {
+		char name[32];
+		snprintf(name, sizeof(name), "segment%d", g);
+		hist_reset(&h[0]);
+		for (int i = 0; i < SHARED->workers_count; i++)
+			hist_merge(&h[0], &SHARED->workers[i].segment_latency[g]);
+		struct stats st;
+		hist_stats(&h[0], &st);
+		csv_num(fp, "segment", -2, name, "start_ns",
+			SHARED->segment[g].start_ns);
+		csv_row(fp, "segment", -2, name, "reasons",
+			SHARED->segment[g].reasons);
+		csv_num(fp, "segment", -2, name, "ops", h[0].count);
+		csv_stats(fp, -2, name, "latency_ns", &st, 1, false);
+	}
+	free(h);
+}
+
+// output_write writes the configuration, environment and results of every
+// worker in the requested machine readable format.
+void output_write(const struct benchmark_opts *opts)
+{
+	if (OUTPUT_FP == NULL)
+		return;
+
+	struct env e;
+	env_read(&e);
+	if (opts->output == OUTPUT_JSON)
+		write_json(OUTPUT_FP, opts, &e);
+	else
+		write_csv(OUTPUT_FP, opts, &e);
+	fclose(OUTPUT_FP);
+	OUTPUT_FP = NULL;
+}
@@ -0,0 +1,32 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+
+#include "bench.h"
+
+// OUTPUT_SCHEMA_VERSION is increased whenever fields of the machine readable
+// output are renamed or removed.
+#define OUTPUT_SCHEMA_VERSION 1
+
+int output_open(const struct benchmark_opts *opts);
+void output_write(const struct benchmark_opts *opts);
+void json_string(FILE *fp, const char *s);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "pagemap.h"
+
+// PAGEMAP_FD is /proc/self/pagemap of the process that opened it.
+static int PAGEMAP_FD = -1;
+
+// pagemap_open opens the pagemap of the calling process, replacing the one of
+// its parent after a fork. It must be called before any thread counts pages,
+// and only makes async-signal-safe calls, so forked children of threaded
+// processes can use it. It returns 0 on success and -1 on failure.
+int pagemap_open()
+{
+	if (PAGEMAP_FD != -1)
+		close(PAGEMAP_FD);
+	PAGEMAP_FD = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	return PAGEMAP_FD == -1 ? -1 : 0;
+}
+
+// pagemap_count returns how many of the pages of the size bytes at addr have
+// a pagemap entry for which counted returns true, or 0 if the pagemap isn't
+// open. Only async-signal-safe calls are made.
+unsigned long pagemap_count(void *addr, unsigned long size,
+			    bool (*counted)(uint64_t entry))
+{
+	if (size == 0 || PAGEMAP_FD == -1)
+		return 0;
+
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t)addr / page;
+	uintptr_t last = ((uintptr_t)addr + size - 1) / page;
+	uint64_t entries[512];
+	unsigned long count = 0;
+	for (uintptr_t p = first; p <= last;) {
+		unsigned long n = last - p + 1;
+		if (n > 512)
+			n = 512;
+		ssize_t got = pread(PAGEMAP_FD, entries, n * sizeof(uint64_t),
+				    p * sizeof(uint64_t));
+		if (got <= 0)
+			break;
+		n = got / sizeof(uint64_t);
+		for (unsigned long i = 0; i < n; i++)
+			count += counted(entries[i]);
+		p += n;
+	}
+	return count;
+}
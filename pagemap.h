@@ -0,0 +1,33 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// PM_PRESENT and PM_EXCLUSIVE are the bits of a pagemap entry telling whether
+// a page is present and only mapped once, and PM_PFN its page frame number.
+#define PM_PRESENT (1UL << 63)
+#define PM_EXCLUSIVE (1UL << 56)
+#define PM_PFN ((1UL << 55) - 1)
+
+int pagemap_open(void);
+unsigned long pagemap_count(void *addr, unsigned long size,
+			    bool (*counted)(uint64_t entry));
+
+#endif
@@ -0,0 +1,268 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "payload.h"
+
+#define CACHE_LINE 64
+// SPARSE_MAX_UNITS is how many bytes or cache lines of a page the sparse
+// payload chooses from, enough for 64 KB pages.
+#define SPARSE_MAX_UNITS (64 * 1024)
+
+const char *PAYLOAD_STRING[] = {
+	"zero",
+	"random",
+	"copy",
+	"counter",
+	"byte",
+	"sparse",
+};
+
+// payload_parse parses a payload of the form <payload> or a weighted mix of
+// the form <payload>:<weight>[,<payload>:<weight>...]. It returns 0 on success
+// and -1 on failure.
+int payload_parse(const char *arg, struct payload_mix *m)
+{
+	memset(m, 0, sizeof(*m));
+
+	const char *opt = arg;
+	do {
+		if (*opt == ',')
+			opt++;
+		size_t n = strcspn(opt, ",");
+		size_t len = strcspn(opt, ":,");
+		int p = option_match(opt, len, PAYLOAD_STRING, PAYLOADS);
+		char *end = (char *)opt + len;
+		int weight = 1;
+		if (p != -1 && len < n)
+			weight = strtol(opt + len + 1, &end, 10);
+		if (p == -1 || end != opt + n || weight < 0) {
+			printf("Invalid payload: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+		m->weight[p] += weight;
+		m->total += weight;
+		opt += n;
+	} while (*opt == ',');
+
+	if (m->total == 0) {
+		printf("Invalid payload: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// payload_sparse_parse parses a sparse payload of the form
+// <count>[bytes|lines][,pages=<pct>]. It returns 0 on success and -1 on
+// failure.
+int payload_sparse_parse(const char *arg, struct sparse_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->pages_pct = 100;
+
+	size_t len = strcspn(arg, ",");
+	char *end;
+	o->count = strtol(arg, &end, 10);
+	if (end < arg + len && !strncmp(end, "lines", 5)) {
+		o->lines = true;
+		end += 5;
+	} else if (end < arg + len && !strncmp(end, "bytes", 5)) {
+		end += 5;
+	}
+	if (end != arg + len || o->count < 1) {
+		printf("Invalid sparse count: %.*s.\n", (int)len, arg);
+		return -1;
+	}
+
+	const char *opt = arg + len;
+	while (*opt == ',') {
+		opt++;
+		size_t n = strcspn(opt, ",");
+		end = (char *)opt + n;
+		if (!strncmp(opt, "pages=", 6))
+			o->pages_pct = strtol(opt + 6, &end, 10);
+		else
+			end = NULL;
+		if (end != opt + n) {
+			printf("Invalid sparse option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+		opt += n;
+	}
+
+	if (o->pages_pct < 1 || o->pages_pct > 100) {
+		printf("Invalid sparse pages percentage: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// payload_pick returns the payload of the next write, only drawing from the
+// RNG for mixes like plan_op does for mixed phases.
+enum Payload payload_pick(const struct payload_mix *m)
+{
+	int r = 0;
+	for (int p = 0; p < PAYLOADS; p++) {
+		if (m->weight[p] == m->total)
+			return p;
+	}
+	if (m->total > 0)
+		r = rand() % m->total;
+	for (int p = 0; p < PAYLOADS; p++) {
+		if (r < m->weight[p])
+			return p;
+		r -= m->weight[p];
+	}
+	return PAYLOAD_ZERO;
+}
+
+// payload_prepare fills the zeroed size bytes of buf with what a write of p
+// copies, from the data at source or random bytes drawn from seed.
+void payload_prepare(enum Payload p, char *buf, unsigned long size,
+		     const char *source, unsigned long seed)
+{
+	switch (p) {
+	case PAYLOAD_RANDOM: {
+		// xorshift64* is fast enough that filling buf takes a
+		// fraction of the tick interval.
+		uint64_t x = seed | 1;
+		unsigned long i;
+		for (i = 0; i + sizeof(x) <= size; i += sizeof(x)) {
+			x ^= x >> 12;
+			x ^= x << 25;
+			x ^= x >> 27;
+			uint64_t v = x * 0x2545f4914f6cdd1dUL;
+			memcpy(buf + i, &v, sizeof(v));
+		}
+		for (; i < size; i++)
+			buf[i] = x >> (i % 8 * 8);
+		break;
+	}
+	case PAYLOAD_COPY:
+		memcpy(buf, source, size);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x >> 12;
+	*x ^= *x << 25;
+	*x ^= *x >> 27;
+	return *x * 0x2545f4914f6cdd1dUL;
+}
+
+// sparse_page changes count distinct units of unit bytes, picked at random
+// between lo and hi, and returns how many bytes it changed. Every byte of a
+// unit is flipped with a non-zero mask so it is guaranteed to change.
+static unsigned long sparse_page(uintptr_t lo, uintptr_t hi, int unit,
+				 unsigned long count, uint64_t *x)
+{
+	uintptr_t first = (lo + unit - 1) & ~(uintptr_t)(unit - 1);
+	if (first >= hi)
+		return 0;
+	unsigned long units = (hi - first) / unit;
+	if (units > SPARSE_MAX_UNITS)
+		units = SPARSE_MAX_UNITS;
+	unsigned long n = count < units ? count : units;
+
+	// Floyd's algorithm picks n distinct units with n draws.
+	uint64_t seen[SPARSE_MAX_UNITS / 64];
+	memset(seen, 0, (units + 63) / 64 * sizeof(uint64_t));
+	for (unsigned long j = units - n; j < units; j++) {
+		unsigned long t = xorshift(x) % (j + 1);
+		if (seen[t / 64] & 1UL << t % 64)
+			t = j;
+		seen[t / 64] |= 1UL << t % 64;
+		if (unit == 1) {
+			*(volatile unsigned char *)(first + t) ^=
+				xorshift(x) | 1;
+			continue;
+		}
+		volatile uint64_t *w = (volatile uint64_t *)(first + t * unit);
+		for (int i = 0; i < unit / 8; i++)
+			w[i] ^= xorshift(x) | 0x0101010101010101UL;
+	}
+	return n * unit;
+}
+
+// payload_write writes the size bytes at dst with p, copying buf unless the
+// payload changes the data in place. It returns how many bytes it wrote and
+// stores how many pages it dirtied in pages.
+unsigned long payload_write(const struct payload_mix *m, enum Payload p,
+			    char *dst, const char *buf, unsigned long size,
+			    unsigned long seed, unsigned long *pages)
+{
+	static uintptr_t page;
+	if (page == 0)
+		page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)dst, end = start + size;
+	unsigned long written = 0;
+	*pages = 0;
+	if (size == 0)
+		return 0;
+
+	switch (p) {
+	case PAYLOAD_COUNTER: {
+		uintptr_t last = 0;
+		for (uintptr_t l = (start + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+		     l + sizeof(uint64_t) <= end; l += CACHE_LINE) {
+			(*(volatile uint64_t *)l)++;
+			written += sizeof(uint64_t);
+			*pages += (l & ~(page - 1)) != last;
+			last = l & ~(page - 1);
+		}
+		break;
+	}
+	case PAYLOAD_BYTE:
+		for (uintptr_t pg = (start + page - 1) & ~(page - 1); pg < end;
+		     pg += page) {
+			(*(volatile char *)pg)++;
+			written++;
+		}
+		*pages = written;
+		break;
+	case PAYLOAD_SPARSE: {
+		uint64_t x = seed | 1;
+		int unit = m->sparse.lines ? CACHE_LINE : 1;
+		for (uintptr_t pg = start & ~(page - 1); pg < end; pg += page) {
+			if (xorshift(&x) % 100 >= (uint64_t)m->sparse.pages_pct)
+				continue;
+			uintptr_t lo = pg < start ? start : pg;
+			uintptr_t hi = pg + page > end ? end : pg + page;
+			unsigned long changed = sparse_page(
+				lo, hi, unit, m->sparse.count, &x);
+			written += changed;
+			*pages += changed > 0;
+		}
+		break;
+	}
+	default:
+		memcpy(dst, buf, size);
+		written = size;
+		*pages = (end - 1) / page - start / page + 1;
+		break;
+	}
+	return written;
+}
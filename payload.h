@@ -0,0 +1,69 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdbool.h>
+
+// Payload is what writes store in the pages they dirty.
+enum Payload {
+	// PAYLOAD_ZERO copies zeros, turning pages into zero pages.
+	PAYLOAD_ZERO,
+	// PAYLOAD_RANDOM copies fresh random bytes.
+	PAYLOAD_RANDOM,
+	// PAYLOAD_COPY copies another part of the data with the same offset
+	// within its pages, so the pages written duplicate others.
+	PAYLOAD_COPY,
+	// PAYLOAD_COUNTER increments a counter at the start of every cache
+	// line.
+	PAYLOAD_COUNTER,
+	// PAYLOAD_BYTE increments the first byte of every page.
+	PAYLOAD_BYTE,
+	// PAYLOAD_SPARSE changes a few bytes or cache lines at random offsets
+	// of some of the pages, as described by sparse_opts.
+	PAYLOAD_SPARSE,
+	PAYLOADS,
+};
+
+extern const char *PAYLOAD_STRING[];
+
+// sparse_opts describe the sparse payload, which changes count bytes, or
+// cache lines if lines is set, in pages_pct percent of the pages it covers.
+struct sparse_opts {
+	int count;
+	bool lines;
+	int pages_pct;
+};
+
+// payload_mix is how often writes use each payload, relative to the total
+// weight.
+struct payload_mix {
+	int weight[PAYLOADS];
+	int total;
+	struct sparse_opts sparse;
+};
+
+int payload_parse(const char *arg, struct payload_mix *m);
+int payload_sparse_parse(const char *arg, struct sparse_opts *o);
+enum Payload payload_pick(const struct payload_mix *m);
+void payload_prepare(enum Payload p, char *buf, unsigned long size,
+		     const char *source, unsigned long seed);
+unsigned long payload_write(const struct payload_mix *m, enum Payload p,
+			    char *dst, const char *buf, unsigned long size,
+			    unsigned long seed, unsigned long *pages);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <numa.h>
+
+#include "placement.h"
+
+const char *PLACEMENT_STRING[] = {
+	"bind",
+	"interleave",
+	"partition",
+	"remote",
+};
+
+// placement_parse parses a placement policy of the form
+// bind[:<node>]|interleave|partition|remote[:<node>]. It returns 0 on success
+// and -1 on failure.
+int placement_parse(const char *arg, enum Placement *placement, int *node)
+{
+	size_t len = strcspn(arg, ":");
+	*node = 0;
+	for (int i = 0; i <= PLACEMENT_REMOTE; i++) {
+		if (strlen(PLACEMENT_STRING[i]) != len ||
+		    strncmp(arg, PLACEMENT_STRING[i], len))
+			continue;
+		*placement = i;
+		if (arg[len] == '\0')
+			return 0;
+		if (i != PLACEMENT_BIND && i != PLACEMENT_REMOTE)
+			break;
+
+		char *end;
+		*node = strtol(arg + len + 1, &end, 10);
+		if (*end != '\0' || *node < 0 || *node >= placement_nodes())
+			break;
+		return 0;
+	}
+
+	printf("Invalid placement: %s.\n", arg);
+	return -1;
+}
+
+// placement_nodes returns the number of NUMA nodes of the host.
+int placement_nodes()
+{
+	return numa_available() != -1 ? numa_max_node() + 1 : 1;
+}
+
+// partition returns the slice of DATA that belongs to a worker. Slices are page
+// aligned so each one can be placed on its own node.
+static void partition(int worker, int workers, size_t data_size, size_t *offset,
+		      size_t *size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t slice = data_size / workers / page * page;
+	*offset = worker * slice;
+	*size = worker == workers - 1 ? data_size - *offset : slice;
+}
+
+// placement_apply sets the memory policy of data before it is first touched.
+// It returns 0 on success and -1 on failure.
+int placement_apply(void *data, size_t size, enum Placement placement,
+		    int node, int workers)
+{
+	if (numa_available() == -1)
+		return 0;
+
+	errno = 0;
+	switch (placement) {
+	case PLACEMENT_BIND:
+	case PLACEMENT_REMOTE:
+		numa_tonode_memory(data, size, node);
+		break;
+	case PLACEMENT_INTERLEAVE:
+		numa_interleave_memory(data, size, numa_all_nodes_ptr);
+		break;
+	case PLACEMENT_PARTITION:
+		// Placing each slice up front is equivalent to letting every
+		// worker first touch its slice, but keeps the data loaded
+		// before the test starts.
+		for (int i = 0; i < workers; i++) {
+			size_t offset, len;
+			partition(i, workers, size, &offset, &len);
+			numa_tonode_memory(data + offset, len,
+					   i % placement_nodes());
+		}
+		break;
+	}
+	if (errno != 0) {
+		printf("Failed to set memory placement: %s\n",
+		       strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// placement_range places the size bytes at data on node, or interleaves them
+// across all nodes if node is -1, as for data mapped again after
+// placement_apply. It returns 0 on success and -1 on failure.
+int placement_range(void *data, size_t size, int node)
+{
+	if (numa_available() == -1)
+		return 0;
+
+	errno = 0;
+	if (node == -1)
+		numa_interleave_memory(data, size, numa_all_nodes_ptr);
+	else
+		numa_tonode_memory(data, size, node);
+	return errno != 0 ? -1 : 0;
+}
+
+// placement_worker computes where a worker runs and which part of the data it
+// accesses. With spread set, workers are distributed across all nodes.
+void placement_worker(enum Placement placement, int node, bool spread,
+		      int worker, int workers, size_t data_size,
+		      struct worker_placement *res)
+{
+	int nodes = placement_nodes();
+	int used = spread ? nodes : 1;
+	res->offset = 0;
+	res->size = data_size;
+	res->data_node = node;
+	res->node = spread ? worker % nodes : node;
+
+	switch (placement) {
+	case PLACEMENT_BIND:
+		break;
+	case PLACEMENT_INTERLEAVE:
+		res->data_node = -1;
+		break;
+	case PLACEMENT_PARTITION:
+		res->node = worker % nodes;
+		res->data_node = res->node;
+		used = nodes;
+		partition(worker, workers, data_size, &res->offset, &res->size);
+		break;
+	case PLACEMENT_REMOTE:
+		if (nodes > 1) {
+			res->node = (node + 1 + worker % (nodes - 1)) % nodes;
+			used = nodes - 1;
+		}
+		break;
+	}
+
+	// Use a different CPU of the node for every worker placed on it.
+	res->cpu = worker % sysconf(_SC_NPROCESSORS_ONLN);
+	if (numa_available() == -1)
+		return;
+	struct bitmask *cpus = numa_allocate_cpumask();
+	if (numa_node_to_cpus(res->node, cpus) == 0) {
+		int count = numa_bitmask_weight(cpus);
+		int nth = count > 0 ? worker / used % count : 0;
+		for (int cpu = 0; cpu < cpus->size && count > 0; cpu++) {
+			if (numa_bitmask_isbitset(cpus, cpu) && nth-- == 0) {
+				res->cpu = cpu;
+				break;
+			}
+		}
+	}
+	numa_free_cpumask(cpus);
+}
+
+// placement_pin restricts the calling process to the CPUs of the node of p,
+// and its allocations to that node. The access thread is pinned to the CPU of
+// p on its own, so other threads of the worker stay free to run anywhere on
+// the node. It returns 0 on success and -1 on failure.
+int placement_pin(const struct worker_placement *p)
+{
+	if (numa_available() == -1)
+		return 0;
+
+	if (numa_run_on_node(p->node)) {
+		printf("Failed to run on node %d: %s\n", p->node,
+		       strerror(errno));
+		return -1;
+	}
+	struct bitmask *mask = numa_bitmask_alloc(numa_num_possible_nodes());
+	numa_bitmask_setbit(mask, p->node);
+	numa_set_membind(mask);
+	numa_bitmask_free(mask);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Placement describes which NUMA nodes DATA is allocated on.
+enum Placement {
+	// PLACEMENT_BIND puts all of DATA on a single node.
+	PLACEMENT_BIND,
+	// PLACEMENT_INTERLEAVE spreads DATA page by page across all nodes.
+	PLACEMENT_INTERLEAVE,
+	// PLACEMENT_PARTITION gives every worker its own slice of DATA on the
+	// node it runs on.
+	PLACEMENT_PARTITION,
+	// PLACEMENT_REMOTE puts DATA on a single node and runs workers on the
+	// other nodes.
+	PLACEMENT_REMOTE,
+};
+
+extern const char *PLACEMENT_STRING[];
+
+// worker_placement is where a worker runs and which part of DATA it accesses.
+// data_node is -1 when the data is interleaved.
+struct worker_placement {
+	int cpu;
+	int node;
+	int data_node;
+	size_t offset;
+	size_t size;
+};
+
+int placement_parse(const char *arg, enum Placement *placement, int *node);
+int placement_nodes(void);
+int placement_apply(void *data, size_t size, enum Placement placement,
+		    int node, int workers);
+int placement_range(void *data, size_t size, int node);
+void placement_worker(enum Placement placement, int node, bool spread,
+		      int worker, int workers, size_t data_size,
+		      struct worker_placement *res);
+int placement_pin(const struct worker_placement *p);
+
+#endif
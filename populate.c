@@ -0,0 +1,125 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "populate.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+const char *POPULATE_STRING[] = {
+	"eager",
+	"lazy",
+	"populate-flag",
+	"none",
+};
+
+// POPULATED has a bit set for every page of DATA filled by lazy population.
+static unsigned long *POPULATED;
+static long PAGE_SIZE;
+
+// populate_parse parses the name of a population mode into p. It returns 0 on
+// success and -1 on failure.
+int populate_parse(const char *arg, enum Populate *p)
+{
+	for (int i = POPULATE_EAGER; i <= POPULATE_NONE; i++) {
+		if (!strcmp(arg, POPULATE_STRING[i])) {
+			*p = i;
+			return 0;
+		}
+	}
+	printf("Invalid population mode: %s.\n", arg);
+	return -1;
+}
+
+// populate_setup prepares size bytes of data for population mode p, other than
+// eager population which is left to the caller. It returns 0 on success and
+// -1 on failure.
+int populate_setup(enum Populate p, void *data, size_t size)
+{
+	PAGE_SIZE = sysconf(_SC_PAGESIZE);
+	switch (p) {
+	case POPULATE_LAZY: {
+		size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+		POPULATED = calloc(pages / 64 + 1, sizeof(unsigned long));
+		if (POPULATED == NULL) {
+			printf("Failed to allocate the population bitmap.\n");
+			return -1;
+		}
+		return 0;
+	}
+	case POPULATE_FLAG:
+		// MAP_POPULATE would fault pages in before the NUMA policy is
+		// applied, so populate the mapping afterwards instead.
+		if (madvise(data, size, MADV_POPULATE_WRITE)) {
+			printf("Failed to populate memory: %s\n",
+			       strerror(errno));
+			return -1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+// fill_page writes data derived from the index of the page at p, so pages
+// filled twice by racing threads end up the same.
+static void fill_page(unsigned long *p, unsigned long index)
+{
+	unsigned long x = index * 0x9e3779b97f4a7c15UL + 1;
+	for (size_t i = 0; i < PAGE_SIZE / sizeof(*p); i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		p[i] = x;
+	}
+}
+
+// populate_range fills the pages of data overlapping [offset, offset + size)
+// that weren't accessed yet in lazy mode, and returns how many it filled.
+unsigned long populate_range(void *data, size_t offset, size_t size)
+{
+	if (POPULATED == NULL || size == 0)
+		return 0;
+
+	unsigned long filled = 0;
+	size_t last = (offset + size - 1) / PAGE_SIZE;
+	for (size_t page = offset / PAGE_SIZE; page <= last; page++) {
+		unsigned long bit = 1UL << (page % 64);
+		unsigned long *word = &POPULATED[page / 64];
+		if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+			continue;
+		fill_page((unsigned long *)((char *)data + page * PAGE_SIZE),
+			  page);
+		__atomic_fetch_or(word, bit, __ATOMIC_RELEASE);
+		filled++;
+	}
+	return filled;
+}
+
+// populate_free releases the population bitmap.
+void populate_free()
+{
+	free(POPULATED);
+	POPULATED = NULL;
+}
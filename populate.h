@@ -0,0 +1,41 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef POPULATE_H
+#define POPULATE_H
+
+#include <stddef.h>
+
+// Populate is how DATA is brought into memory before the test starts.
+enum Populate {
+	// POPULATE_EAGER writes random data to every page.
+	POPULATE_EAGER,
+	// POPULATE_LAZY fills pages with data on their first access.
+	POPULATE_LAZY,
+	// POPULATE_FLAG has the kernel fault in zeroed pages up front.
+	POPULATE_FLAG,
+	// POPULATE_NONE leaves DATA untouched, so pages fault on first access.
+	POPULATE_NONE,
+};
+
+extern const char *POPULATE_STRING[];
+
+int populate_parse(const char *arg, enum Populate *p);
+int populate_setup(enum Populate p, void *data, size_t size);
+unsigned long populate_range(void *data, size_t offset, size_t size);
+void populate_free(void);
+
+#endif
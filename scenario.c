@@ -0,0 +1,236 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "bench.h"
+#include "scenario.h"
+
+const char *PATTERN_STRING[] = {
+	"random",
+	"sequential",
+};
+
+// trim removes leading and trailing whitespace from s in place.
+static char *trim(char *s)
+{
+	while (isspace((unsigned char)*s))
+		s++;
+	char *end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		end--;
+	*end = '\0';
+	return s;
+}
+
+// parse_bool parses yes/no style values, returning -1 if value is invalid.
+static int parse_bool(const char *value)
+{
+	if (!strcasecmp(value, "true") || !strcasecmp(value, "yes") ||
+	    !strcmp(value, "1"))
+		return 1;
+	if (!strcasecmp(value, "false") || !strcasecmp(value, "no") ||
+	    !strcmp(value, "0"))
+		return 0;
+	return -1;
+}
+
+// parse_number parses a non-negative number, returning -1 if it is invalid.
+static double parse_number(const char *value)
+{
+	char *end;
+	errno = 0;
+	double n = strtod(value, &end);
+	if (errno != 0 || end == value || *end != '\0' || n < 0)
+		return -1;
+	return n;
+}
+
+// set_phase_key applies a single key = value pair to phase p. It returns an
+// error message or NULL on success.
+static const char *set_phase_key(struct phase *p, const char *key,
+				 const char *value)
+{
+	if (!strcmp(key, "pattern")) {
+		if (!strcmp(value, "random"))
+			p->pattern = RANDOM;
+		else if (!strcmp(value, "sequential"))
+			p->pattern = SEQUENTIAL;
+		else
+			return "pattern must be random or sequential";
+		return NULL;
+	}
+	if (!strcmp(key, "idle")) {
+		int idle = parse_bool(value);
+		if (idle == -1)
+			return "idle must be true or false";
+		p->idle = idle;
+		return NULL;
+	}
+
+	double n = parse_number(value);
+	if (n < 0)
+		return "value must be a non-negative number";
+
+	if (!strcmp(key, "duration")) {
+		if (n < 1)
+			return "duration must be at least one second";
+		// Keep the sum of all phases in scenario_duration an int.
+		if (n > INT_MAX / MAX_PHASES)
+			return "duration is too long";
+		p->duration = n;
+	} else if (!strcmp(key, "interval")) {
+		if (n < 1)
+			return "interval must be at least one millisecond";
+		if (n > INT_MAX)
+			return "interval is too long";
+		p->interval_ms = n;
+	} else if (!strcmp(key, "size")) {
+		if (n * MB < 1)
+			return "size must be greater than zero";
+		p->op_size = n * MB;
+	} else if (!strcmp(key, "rate")) {
+		p->rate = n * MB;
+	} else if (!strcmp(key, "writes")) {
+		if (n > 100)
+			return "writes must be a percentage between 0 and 100";
+		p->write_pct = n;
+	} else {
+		return "unknown key";
+	}
+	return NULL;
+}
+
+// scenario_load parses the scenario file at path into s. Every section of the
+// file starts a new phase and keys not set in a section are taken from
+// defaults. It returns 0 on success and -1 on failure.
+//
+// Example scenario file:
+//
+//	[warmup]
+//	duration = 30
+//	pattern = sequential
+//
+//	[steady]
+//	duration = 60
+//	rate = 500
+//	writes = 100
+//
+//	[idle]
+//	duration = 10
+//	idle = true
+int scenario_load(struct scenario *s, const char *path,
+		  const struct phase *defaults)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Failed to open scenario file %s: %s\n", path,
+		       strerror(errno));
+		return -1;
+	}
+
+	int ret = 0;
+	char line[256];
+	int lineno = 0;
+	struct phase *p = NULL;
+
+	s->count = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		char *l = trim(line);
+		if (*l == '\0' || *l == '#' || *l == ';')
+			continue;
+
+		if (*l == '[') {
+			char *end = strchr(l, ']');
+			if (end == NULL || end[1] != '\0' || end == l + 1) {
+				printf("%s:%d: invalid section header.\n", path,
+				       lineno);
+				goto fail;
+			}
+			if (s->count == MAX_PHASES) {
+				printf("%s:%d: too many phases (max %d).\n",
+				       path, lineno, MAX_PHASES);
+				goto fail;
+			}
+			*end = '\0';
+			p = &s->phases[s->count++];
+			*p = *defaults;
+			snprintf(p->name, sizeof(p->name), "%s", trim(l + 1));
+			continue;
+		}
+
+		char *eq = strchr(l, '=');
+		if (eq == NULL) {
+			printf("%s:%d: expected key = value.\n", path, lineno);
+			goto fail;
+		}
+		if (p == NULL) {
+			printf("%s:%d: key outside of a phase section.\n", path,
+			       lineno);
+			goto fail;
+		}
+		*eq = '\0';
+		char *key = trim(l);
+		char *value = trim(eq + 1);
+		const char *err = set_phase_key(p, key, value);
+		if (err != NULL) {
+			printf("%s:%d: %s: %s.\n", path, lineno, key, err);
+			goto fail;
+		}
+	}
+
+	if (s->count == 0) {
+		printf("%s: scenario has no phases.\n", path);
+		goto fail;
+	}
+	goto out;
+
+fail:
+	ret = -1;
+out:
+	fclose(fp);
+	return ret;
+}
+
+// scenario_ticks returns the number of memory operations the scenario can
+// issue, which is used to size the result storage.
+unsigned long scenario_ticks(const struct scenario *s)
+{
+	unsigned long ticks = 0;
+	for (int i = 0; i < s->count; i++) {
+		const struct phase *p = &s->phases[i];
+		if (!p->idle)
+			ticks += (unsigned long)p->duration * 1000 /
+				 p->interval_ms;
+	}
+	return ticks;
+}
+
+// scenario_duration returns the total duration of the scenario in seconds.
+int scenario_duration(const struct scenario *s)
+{
+	int duration = 0;
+	for (int i = 0; i < s->count; i++)
+		duration += s->phases[i].duration;
+	return duration;
+}
@@ -0,0 +1,63 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <stdbool.h>
+
+#define MAX_PHASES 32
+#define PHASE_NAME_MAX 32
+
+enum Pattern {
+	RANDOM,
+	SEQUENTIAL,
+};
+
+// phase describes one segment of a benchmark run.
+struct phase {
+	char name[PHASE_NAME_MAX];
+	// duration is how long the phase runs in seconds.
+	int duration;
+	// interval_ms is the time between two memory operations.
+	int interval_ms;
+	// op_size is the maximum size of a memory operation in bytes.
+	unsigned long op_size;
+	// rate is the target throughput in bytes per second. When set, every
+	// operation has a fixed size of rate * interval_ms instead of a random
+	// size up to op_size.
+	unsigned long rate;
+	// write_pct is the percentage of operations that are writes.
+	int write_pct;
+	enum Pattern pattern;
+	// idle phases don't access memory at all.
+	bool idle;
+};
+
+// scenario is the list of phases executed back to back in a run.
+struct scenario {
+	struct phase phases[MAX_PHASES];
+	int count;
+};
+
+extern const char *PATTERN_STRING[];
+
+int scenario_load(struct scenario *s, const char *path,
+		  const struct phase *defaults);
+unsigned long scenario_ticks(const struct scenario *s);
+int scenario_duration(const struct scenario *s);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "env.h"
+#include "output.h"
+#include "startup.h"
+
+// RESTORE_CLOCK_STEP_NS is how far CLOCK_REALTIME or CLOCK_BOOTTIME may move
+// relative to CLOCK_MONOTONIC while waiting for the signal before the process
+// counts as restored. It is larger than for migration checks as the wait may
+// be long enough for NTP to slew the clock noticeably.
+#define RESTORE_CLOCK_STEP_NS NSEC_PER_SEC
+
+const char *STARTUP_EVENT_STRING[] = {
+	"process",
+	"allocated",
+	"loaded",
+	"ready",
+	"signal",
+	"fingerprinted",
+	"first_op",
+	"first_steady_op",
+	"restore",
+	"first_op_after_restore",
+};
+
+// EARLY holds the events recorded before the shared memory is allocated.
+static struct startup EARLY;
+static struct startup *STARTUP = &EARLY;
+
+// WAIT_HOST is the host before waiting for the signal, which is compared with
+// the one after it to detect a restore.
+static struct host WAIT_HOST;
+
+static unsigned long realtime_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// startup_mark records that event happened now.
+void startup_mark(enum StartupEvent event)
+{
+	STARTUP->events[event].monotonic_ns = now_ns();
+	STARTUP->events[event].realtime_ns = realtime_ns();
+}
+
+// startup_fingerprinted records that fingerprinting the data after the signal
+// took ns and ended now.
+void startup_fingerprinted(unsigned long ns)
+{
+	startup_mark(STARTUP_FINGERPRINTED);
+	STARTUP->fingerprint_ns = ns;
+}
+
+// startup_share moves the events recorded so far to s, where the workers
+// record their first operations.
+void startup_share(struct startup *s)
+{
+	*s = *STARTUP;
+	STARTUP = s;
+}
+
+// startup_wait_begin remembers the state of the host before waiting for the
+// signal to start, when a snapshot is usually taken.
+void startup_wait_begin()
+{
+	host_read(&WAIT_HOST);
+}
+
+// startup_wait_end records a restore if the host looks different than before
+// waiting for the signal: a new boot ID or process start time, as after a
+// CRIU restore, or clocks that stepped, as after restoring a VM snapshot.
+void startup_wait_end()
+{
+	struct host cur;
+	host_read(&cur);
+
+	char reasons[STARTUP_REASONS_MAX] = "";
+	if (strcmp(WAIT_HOST.env.boot_id, cur.env.boot_id))
+		add_reason(reasons, sizeof(reasons), "boot_id");
+	if (WAIT_HOST.start_time != cur.start_time)
+		add_reason(reasons, sizeof(reasons), "start_time");
+	host_clock_reasons(&WAIT_HOST, &cur, RESTORE_CLOCK_STEP_NS, reasons,
+			   sizeof(reasons));
+	if (reasons[0] == '\0')
+		return;
+
+	snprintf(STARTUP->restore_reasons, STARTUP_REASONS_MAX, "%s", reasons);
+	startup_mark(STARTUP_RESTORE);
+	printf("Restore detected (%s).\n", reasons);
+}
+
+// mark_once records event at t unless another operation already did.
+static void mark_once(enum StartupEvent event, unsigned long t)
+{
+	struct timestamp *ts = &STARTUP->events[event];
+	if (ts->monotonic_ns == 0 &&
+	    __sync_bool_compare_and_swap(&ts->monotonic_ns, 0, t))
+		ts->realtime_ns = realtime_ns() - (now_ns() - t);
+}
+
+// startup_op records the first operation of any worker, completed at done_ns,
+// and the first one that ran at steady state latency, without populating
+// memory or missing the page cache.
+void startup_op(unsigned long done_ns, bool steady)
+{
+	mark_once(STARTUP_FIRST_OP, done_ns);
+	if (steady)
+		mark_once(STARTUP_FIRST_STEADY_OP, done_ns);
+	if (STARTUP->events[STARTUP_RESTORE].monotonic_ns != 0)
+		mark_once(STARTUP_FIRST_OP_AFTER_RESTORE, done_ns);
+}
+
+// elapsed returns how many nanoseconds after a b happened. Wall clock time is
+// used across a restore, as the monotonic clock may have been reset.
+static long elapsed(const struct timestamp *a, const struct timestamp *b)
+{
+	if (STARTUP->restore_reasons[0] != '\0')
+		return (long)(b->realtime_ns - a->realtime_ns);
+	return (long)(b->monotonic_ns - a->monotonic_ns);
+}
+
+// since returns how many nanoseconds after from event happened, or -1 if
+// either didn't, less the time taken fingerprinting the data in between.
+static long since(enum StartupEvent from, enum StartupEvent event)
+{
+	const struct timestamp *a = &STARTUP->events[from];
+	const struct timestamp *b = &STARTUP->events[event];
+	const struct timestamp *f = &STARTUP->events[STARTUP_FINGERPRINTED];
+	if (a->monotonic_ns == 0 || b->monotonic_ns == 0)
+		return -1;
+	long t = elapsed(a, b);
+	if (f->monotonic_ns != 0 && event != STARTUP_FINGERPRINTED &&
+	    elapsed(a, f) > 0 && elapsed(f, b) >= 0)
+		t -= STARTUP->fingerprint_ns;
+	return t;
+}
+
+// startup_report prints when every startup event happened after the process
+// started, and how long fingerprinting the data after the signal took, which
+// is left out of the times after it.
+void startup_report()
+{
+	printf("Startup:");
+	const char *sep = "";
+	for (int e = STARTUP_ALLOCATED; e <= STARTUP_FIRST_STEADY_OP; e++) {
+		long t = since(STARTUP_PROCESS, e);
+		if (t < 0)
+			continue;
+		if (e == STARTUP_FINGERPRINTED) {
+			printf("%s fingerprint %.3f s", sep,
+			       STARTUP->fingerprint_ns / (double)NSEC_PER_SEC);
+			continue;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "%s", STARTUP_EVENT_STRING[e]);
+		for (char *c = strchr(name, '_'); c; c = strchr(c, '_'))
+			*c = ' ';
+		printf("%s %s %.3f s", sep, name, t / (double)NSEC_PER_SEC);
+		sep = ",";
+	}
+	printf(".\n");
+
+	long t = since(STARTUP_RESTORE, STARTUP_FIRST_OP_AFTER_RESTORE);
+	if (STARTUP->restore_reasons[0] != '\0')
+		printf("Restored (%s), first operation %.3f ms later.\n",
+		       STARTUP->restore_reasons,
+		       t < 0 ? 0 : t / (double)(NSEC_PER_SEC / 1000));
+}
+
+// startup_json writes the startup events to fp as a JSON object, with how
+// long after the process started the benchmark became ready and served its
+// first operations.
+void startup_json(FILE *fp)
+{
+	fprintf(fp, "{");
+	for (int e = 0; e < STARTUP_EVENTS; e++) {
+		const struct timestamp *ts = &STARTUP->events[e];
+		fprintf(fp, "%s\"%s\":", e ? "," : "", STARTUP_EVENT_STRING[e]);
+		if (ts->monotonic_ns == 0)
+			fprintf(fp, "null");
+		else
+			fprintf(fp, "{\"monotonic_ns\":%lu,\"realtime_ns\":%lu}",
+				ts->monotonic_ns, ts->realtime_ns);
+	}
+	fprintf(fp, ",\"restore_reasons\":");
+	json_string(fp, STARTUP->restore_reasons[0] != '\0' ?
+				STARTUP->restore_reasons :
+				NULL);
+
+	const char *name[] = { "time_to_ready_ns", "time_to_first_op_ns",
+			       "time_to_first_steady_op_ns" };
+	const enum StartupEvent event[] = { STARTUP_READY, STARTUP_FIRST_OP,
+					    STARTUP_FIRST_STEADY_OP };
+	for (int i = 0; i < 3; i++)
+		fprintf(fp, ",\"%s\":%ld", name[i],
+			since(STARTUP_PROCESS, event[i]));
+	fprintf(fp, ",\"fingerprint_ns\":%lu", STARTUP->fingerprint_ns);
+	fprintf(fp, ",\"restore_to_first_op_ns\":%ld}",
+		since(STARTUP_RESTORE, STARTUP_FIRST_OP_AFTER_RESTORE));
+}
@@ -0,0 +1,74 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define STARTUP_REASONS_MAX 128
+
+// StartupEvent is a point on the way from starting the process to serving
+// operations at steady state latency.
+enum StartupEvent {
+	STARTUP_PROCESS,
+	STARTUP_ALLOCATED,
+	STARTUP_LOADED,
+	// STARTUP_READY is when the data was loaded and the ready file, if any,
+	// created.
+	STARTUP_READY,
+	STARTUP_SIGNAL,
+	// STARTUP_FINGERPRINTED is when the data was fingerprinted after the
+	// signal, which is left out of the time to the events after it.
+	STARTUP_FINGERPRINTED,
+	STARTUP_FIRST_OP,
+	STARTUP_FIRST_STEADY_OP,
+	// STARTUP_RESTORE is when a restore from a snapshot was detected
+	// while waiting for the signal to start.
+	STARTUP_RESTORE,
+	STARTUP_FIRST_OP_AFTER_RESTORE,
+	STARTUP_EVENTS,
+};
+
+extern const char *STARTUP_EVENT_STRING[];
+
+// timestamp is when an event happened, or zero if it didn't.
+struct timestamp {
+	unsigned long monotonic_ns;
+	unsigned long realtime_ns;
+};
+
+// startup holds the startup events of the benchmark. It is shared with the
+// workers so they can record their first operations.
+struct startup {
+	struct timestamp events[STARTUP_EVENTS];
+	char restore_reasons[STARTUP_REASONS_MAX];
+	// fingerprint_ns is how long fingerprinting the data took before
+	// STARTUP_FINGERPRINTED.
+	unsigned long fingerprint_ns;
+};
+
+void startup_mark(enum StartupEvent event);
+void startup_fingerprinted(unsigned long ns);
+void startup_share(struct startup *s);
+void startup_wait_begin(void);
+void startup_wait_end(void);
+void startup_op(unsigned long done_ns, bool steady);
+void startup_report(void);
+void startup_json(FILE *fp);
+
+#endif
@@ -0,0 +1,424 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "affinity.h"
+#include "bench.h"
+#include "cgroup.h"
+#include "output.h"
+#include "swap.h"
+#include "timeline.h"
+
+// SWAP_SAMPLE_NS is how often memory pressure is written to the timeline.
+#define SWAP_SAMPLE_NS NSEC_PER_SEC
+
+const char *SWAP_POINT_STRING[] = {
+	"start",
+	"end",
+};
+
+const char *SWAP_COUNTER_STRING[] = {
+	"vmstat.pswpin",
+	"vmstat.pswpout",
+	"memory.stat.pgmajfault",
+	"memory.stat.zswpin",
+	"memory.stat.zswpout",
+	"memory.stat.workingset_refault_anon",
+	"memory.events.high",
+	"memory.events.max",
+	"memory.events.oom_kill",
+};
+
+static struct swap_opts SWAP;
+static char SWAP_CGROUP[CGROUP_PATH_MAX];
+static char SWAP_ORIGIN[CGROUP_PATH_MAX];
+static bool SWAP_CREATED;
+static bool SWAP_JOINED;
+// SWAP_LEAF holds the process while the memory controller is enabled in
+// SWAP_ORIGIN, which can't have processes of its own then.
+static char SWAP_LEAF[CGROUP_PATH_MAX];
+static bool SWAP_LEAF_CREATED;
+static bool SWAP_IN_LEAF;
+// SWAP_ENABLED is whether the memory controller was enabled in SWAP_ORIGIN.
+static bool SWAP_ENABLED;
+static pid_t SWAP_PID;
+static long COUNTERS[SWAP_POINTS][SWAP_COUNTERS];
+static bool SAMPLED[SWAP_POINTS];
+static struct pressure PEAK;
+
+static pthread_t SWAP_TID;
+static bool SWAP_RUNNING = false;
+static volatile bool SWAP_STOP = false;
+
+// swap_parse parses a memory limit of the form
+// <pct>[,high][,cgroup=<path>]. It returns 0 on success and -1 on failure.
+int swap_parse(const char *arg, struct swap_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->enabled = true;
+
+	char *end;
+	o->limit_pct = strtol(arg, &end, 10);
+	while (*end == ',') {
+		const char *opt = end + 1;
+		size_t n = strcspn(opt, ",");
+		end = (char *)opt + n;
+		if (n == 4 && !strncmp(opt, "high", 4)) {
+			o->high = true;
+		} else if (!strncmp(opt, "cgroup=", 7) && n > 7) {
+			o->cgroup = strndup(opt + 7, n - 7);
+		} else {
+			printf("Invalid swap option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+	}
+
+	if (*end != '\0' || o->limit_pct < 1 || o->limit_pct > 100) {
+		printf("Invalid memory limit: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// leave_origin moves the process from SWAP_ORIGIN into a new leaf cgroup next
+// to the one it is limited in, so the memory controller can be enabled for
+// the children of SWAP_ORIGIN. It returns 0 on success and -1 on failure.
+static int leave_origin()
+{
+	int n = snprintf(SWAP_LEAF, sizeof(SWAP_LEAF), "%s/bench-%d-origin",
+			 SWAP_ORIGIN, SWAP_PID);
+	if (n >= sizeof(SWAP_LEAF)) {
+		printf("Cgroup path is too long: %s\n", SWAP_LEAF);
+		return -1;
+	}
+	if (mkdir(SWAP_LEAF, 0755)) {
+		printf("Failed to create cgroup %s: %s\n", SWAP_LEAF,
+		       strerror(errno));
+		return -1;
+	}
+	SWAP_LEAF_CREATED = true;
+
+	char value[32];
+	snprintf(value, sizeof(value), "%d", SWAP_PID);
+	if (cgroup_write(SWAP_LEAF, "cgroup.procs", value)) {
+		printf("Failed to join cgroup %s: %s\n", SWAP_LEAF,
+		       strerror(errno));
+		return -1;
+	}
+	SWAP_IN_LEAF = true;
+	return 0;
+}
+
+// swap_setup moves the process into the cgroup described by o, creating it
+// unless it exists, and limits its memory to a percentage of the data_size
+// bytes of data. It returns 0 on success and -1 on failure, leaving the
+// cgroups as they were.
+int swap_setup(const struct swap_opts *o, unsigned long data_size)
+{
+	SWAP = *o;
+	SWAP_PID = getpid();
+	if (cgroup_self(SWAP_ORIGIN, sizeof(SWAP_ORIGIN))) {
+		printf("Failed to find the cgroup v2 of the process.\n");
+		return -1;
+	}
+	int n;
+	if (o->cgroup != NULL && o->cgroup[0] == '/')
+		n = snprintf(SWAP_CGROUP, sizeof(SWAP_CGROUP), "%s", o->cgroup);
+	else if (o->cgroup != NULL)
+		n = snprintf(SWAP_CGROUP, sizeof(SWAP_CGROUP), "%s/%s",
+			     SWAP_ORIGIN, o->cgroup);
+	else
+		n = snprintf(SWAP_CGROUP, sizeof(SWAP_CGROUP), "%s/bench-%d",
+			     SWAP_ORIGIN, SWAP_PID);
+	if (n >= sizeof(SWAP_CGROUP)) {
+		printf("Cgroup path is too long: %s\n", SWAP_CGROUP);
+		return -1;
+	}
+
+	if (mkdir(SWAP_CGROUP, 0755) == 0)
+		SWAP_CREATED = true;
+	else if (errno != EEXIST) {
+		printf("Failed to create cgroup %s: %s\n", SWAP_CGROUP,
+		       strerror(errno));
+		return -1;
+	}
+
+	// The memory controller has to be enabled by the parent, which can't
+	// have processes of its own then. Other processes in it need a
+	// delegated cgroup to be given instead.
+	const char *file = o->high ? "memory.high" : "memory.max";
+	char path[CGROUP_PATH_MAX + 64];
+	snprintf(path, sizeof(path), "%s/%s", SWAP_CGROUP, file);
+	if (access(path, F_OK)) {
+		char parent[CGROUP_PATH_MAX];
+		snprintf(parent, sizeof(parent), "%s", SWAP_CGROUP);
+		*strrchr(parent, '/') = '\0';
+		bool origin = !strcmp(parent, SWAP_ORIGIN);
+		if (origin && leave_origin())
+			goto fail;
+		if (cgroup_write(parent, "cgroup.subtree_control", "+memory")) {
+			printf("Failed to enable the memory controller in %s: %s\n",
+			       parent, strerror(errno));
+			if (errno == EBUSY)
+				printf("It has other processes, pass a delegated cgroup with cgroup=<path>.\n");
+			goto fail;
+		}
+		SWAP_ENABLED = origin;
+	}
+
+	unsigned long limit = data_size / 100 * o->limit_pct;
+	char value[32];
+	snprintf(value, sizeof(value), "%lu", limit);
+	if (cgroup_write(SWAP_CGROUP, file, value)) {
+		printf("Failed to set %s of %s: %s\n", file, SWAP_CGROUP,
+		       strerror(errno));
+		goto fail;
+	}
+	snprintf(value, sizeof(value), "%d", SWAP_PID);
+	if (cgroup_write(SWAP_CGROUP, "cgroup.procs", value)) {
+		printf("Failed to join cgroup %s: %s\n", SWAP_CGROUP,
+		       strerror(errno));
+		goto fail;
+	}
+	SWAP_JOINED = true;
+	printf("Limited %s of %s to %.3f GB.\n", file, SWAP_CGROUP,
+	       limit / (double)GB);
+
+	// /proc/swaps has a header line and one line per swap device.
+	FILE *fp = fopen("/proc/swaps", "r");
+	int lines = 0;
+	char line[256];
+	while (fp != NULL && fgets(line, sizeof(line), fp) != NULL)
+		lines++;
+	if (fp != NULL)
+		fclose(fp);
+	if (lines < 2)
+		printf("WARN: No swap device, data over the limit can't be swapped out.\n");
+	return 0;
+
+fail:
+	swap_free();
+	return -1;
+}
+
+// read_counters reads the swap counters into values, storing -1 for the ones
+// that aren't available.
+static void read_counters(long *values)
+{
+	for (int i = 0; i < SWAP_COUNTERS; i++) {
+		const char *name = SWAP_COUNTER_STRING[i];
+		const char *key = strrchr(name, '.') + 1;
+		if (!strncmp(name, "vmstat.", 7)) {
+			values[i] = cgroup_stat("/proc", "vmstat", key);
+		} else {
+			char file[32];
+			snprintf(file, sizeof(file), "%.*s", (int)(key - name - 1),
+				 name);
+			values[i] = cgroup_stat(SWAP_CGROUP, file, key);
+		}
+	}
+}
+
+// swap_sample reads the swap counters at point.
+void swap_sample(enum SwapPoint point)
+{
+	if (!SWAP.enabled)
+		return;
+	read_counters(COUNTERS[point]);
+	SAMPLED[point] = true;
+}
+
+// swap_counters returns the swap counters read at point, or NULL if they
+// weren't.
+const long *swap_counters(enum SwapPoint point)
+{
+	return SAMPLED[point] ? COUNTERS[point] : NULL;
+}
+
+// swap_loop writes the memory pressure of the cgroup to the timeline every
+// SWAP_SAMPLE_NS and tracks its peak, until stopped.
+static void *swap_loop(void *arg)
+{
+	pin_aux_thread();
+	struct timespec step = { .tv_sec = SWAP_SAMPLE_NS / NSEC_PER_SEC };
+	while (!SWAP_STOP) {
+		struct pressure p;
+		if (cgroup_pressure(SWAP_CGROUP, "memory", &p) == 0) {
+			unsigned long now = now_ns();
+			// avg10 is recorded in hundredths of a percent.
+			timeline_row(now, NULL, "memory_pressure", "some",
+				     p.some_total, p.some_avg10 * 100);
+			timeline_row(now, NULL, "memory_pressure", "full",
+				     p.full_total, p.full_avg10 * 100);
+			if (p.some_avg10 > PEAK.some_avg10)
+				PEAK.some_avg10 = p.some_avg10;
+			if (p.full_avg10 > PEAK.full_avg10)
+				PEAK.full_avg10 = p.full_avg10;
+			PEAK.some_total = p.some_total;
+			PEAK.full_total = p.full_total;
+		}
+		nanosleep(&step, NULL);
+	}
+	return NULL;
+}
+
+// swap_start starts sampling the memory pressure of the cgroup. It returns 0
+// on success and -1 on failure.
+int swap_start()
+{
+	if (!SWAP.enabled)
+		return 0;
+
+	SWAP_STOP = false;
+	if (pthread_create(&SWAP_TID, NULL, swap_loop, NULL)) {
+		printf("Failed to start memory pressure thread.\n");
+		return -1;
+	}
+	SWAP_RUNNING = true;
+	return 0;
+}
+
+// swap_stop stops sampling the memory pressure.
+void swap_stop()
+{
+	if (!SWAP_RUNNING)
+		return;
+
+	SWAP_STOP = true;
+	pthread_join(SWAP_TID, NULL);
+	SWAP_RUNNING = false;
+}
+
+// swap_free moves the process back to the cgroup it started in, disables the
+// memory controller if it enabled it there and removes the cgroups it
+// created. Forked workers leave them alone.
+void swap_free()
+{
+	if (!SWAP.enabled || getpid() != SWAP_PID)
+		return;
+
+	// The origin only takes the process back once its controller is
+	// disabled again, until then it waits in the leaf.
+	char value[32];
+	snprintf(value, sizeof(value), "%d", SWAP_PID);
+	const char *back = SWAP_IN_LEAF ? SWAP_LEAF : SWAP_ORIGIN;
+	if (SWAP_JOINED && cgroup_write(back, "cgroup.procs", value))
+		return;
+	SWAP_JOINED = false;
+	if (SWAP_CREATED && rmdir(SWAP_CGROUP) == 0)
+		SWAP_CREATED = false;
+	if (SWAP_ENABLED && cgroup_write(SWAP_ORIGIN, "cgroup.subtree_control",
+					 "-memory") == 0)
+		SWAP_ENABLED = false;
+	if (SWAP_IN_LEAF && !SWAP_ENABLED &&
+	    cgroup_write(SWAP_ORIGIN, "cgroup.procs", value) == 0)
+		SWAP_IN_LEAF = false;
+	if (SWAP_LEAF_CREATED && !SWAP_IN_LEAF && rmdir(SWAP_LEAF) == 0)
+		SWAP_LEAF_CREATED = false;
+}
+
+// swap_report prints how the swap counters changed over the test and the
+// peak memory pressure of the cgroup.
+void swap_report()
+{
+	if (!SWAP.enabled)
+		return;
+
+	printf("Swap counters (start, end):\n");
+	for (int i = 0; i < SWAP_COUNTERS; i++) {
+		printf("  %-36s", SWAP_COUNTER_STRING[i]);
+		for (int p = 0; p < SWAP_POINTS; p++) {
+			if (SAMPLED[p] && COUNTERS[p][i] >= 0)
+				printf(" %12ld", COUNTERS[p][i]);
+			else
+				printf(" %12s", "-");
+		}
+		printf("\n");
+	}
+	printf("Memory pressure: peak some %.2f%%, full %.2f%%, total some %lu us, full %lu us.\n",
+	       PEAK.some_avg10, PEAK.full_avg10, PEAK.some_total,
+	       PEAK.full_total);
+}
+
+// swap_worker_report prints the latency of operations that found all their
+// pages resident next to that of the others.
+void swap_worker_report(pid_t pid, const struct swap_stats *s)
+{
+	unsigned long pages = s->resident_pages + s->nonresident_pages;
+	printf("[%d] Swap: %lu pages resident, %lu not (%.2f%% resident), %lu major faults.\n",
+	       pid, s->resident_pages, s->nonresident_pages,
+	       pages ? s->resident_pages * 100.0 / pages : 0, s->major_faults);
+	const struct hist *h[] = { &s->resident_latency,
+				   &s->nonresident_latency };
+	const char *name[] = { "Resident", "Non-resident" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s operations: %ld, p50 %.2f ns, p99 %.2f ns.\n",
+		       pid, name[i], h[i]->count, hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99));
+	}
+}
+
+// swap_json writes the cgroup, swap counters and peak memory pressure to fp
+// as a JSON object.
+void swap_json(FILE *fp)
+{
+	fprintf(fp, "{\"cgroup\":");
+	json_string(fp, SWAP_CGROUP);
+	for (int p = 0; p < SWAP_POINTS; p++) {
+		fprintf(fp, ",\"%s\":", SWAP_POINT_STRING[p]);
+		if (!SAMPLED[p]) {
+			fprintf(fp, "null");
+			continue;
+		}
+		fprintf(fp, "{");
+		for (int i = 0; i < SWAP_COUNTERS; i++) {
+			fprintf(fp, "%s\"%s\":", i ? "," : "",
+				SWAP_COUNTER_STRING[i]);
+			if (COUNTERS[p][i] >= 0)
+				fprintf(fp, "%ld", COUNTERS[p][i]);
+			else
+				fprintf(fp, "null");
+		}
+		fprintf(fp, "}");
+	}
+	fprintf(fp,
+		",\"pressure\":{\"peak_some_avg10\":%.2f,"
+		"\"peak_full_avg10\":%.2f,\"some_total_us\":%lu,"
+		"\"full_total_us\":%lu}}",
+		PEAK.some_avg10, PEAK.full_avg10, PEAK.some_total,
+		PEAK.full_total);
+}
+
+// swap_stats_json writes s to fp as a JSON object.
+void swap_stats_json(FILE *fp, const struct swap_stats *s)
+{
+	fprintf(fp,
+		"{\"resident_pages\":%lu,\"nonresident_pages\":%lu,"
+		"\"major_faults\":%lu,\"resident_latency_ns\":",
+		s->resident_pages, s->nonresident_pages, s->major_faults);
+	hist_json(fp, &s->resident_latency);
+	fprintf(fp, ",\"nonresident_latency_ns\":");
+	hist_json(fp, &s->nonresident_latency);
+	fprintf(fp, "}");
+}
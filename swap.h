@@ -0,0 +1,71 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "hist.h"
+
+// SwapPoint is when the swap counters are read.
+enum SwapPoint {
+	SWAP_START,
+	SWAP_END,
+	SWAP_POINTS,
+};
+
+// SWAP_COUNTERS is the number of system wide and cgroup swap counters.
+#define SWAP_COUNTERS 9
+
+extern const char *SWAP_POINT_STRING[];
+extern const char *SWAP_COUNTER_STRING[];
+
+// swap_opts describe a cgroup v2 the benchmark runs in, whose memory.max, or
+// memory.high if high is set, is limit_pct percent of the data. cgroup is an
+// existing cgroup to join instead of creating one.
+struct swap_opts {
+	bool enabled;
+	int limit_pct;
+	bool high;
+	char *cgroup;
+};
+
+// swap_stats are the results of a worker whose data may be swapped out.
+// Operations are split by whether all pages they accessed were resident.
+struct swap_stats {
+	unsigned long resident_pages;
+	unsigned long nonresident_pages;
+	unsigned long major_faults;
+	struct hist resident_latency;
+	struct hist nonresident_latency;
+};
+
+int swap_parse(const char *arg, struct swap_opts *o);
+int swap_setup(const struct swap_opts *o, unsigned long data_size);
+void swap_sample(enum SwapPoint point);
+const long *swap_counters(enum SwapPoint point);
+int swap_start(void);
+void swap_stop(void);
+void swap_free(void);
+void swap_report(void);
+void swap_worker_report(pid_t pid, const struct swap_stats *s);
+void swap_json(FILE *fp);
+void swap_stats_json(FILE *fp, const struct swap_stats *s);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "timeline.h"
+
+// The timeline is a CSV file with one row per memory operation or event. It is
+// opened with O_APPEND before forking so every process writes to the same
+// file. Rows are buffered per process and always flushed at a row boundary so
+// lines from different processes never interleave.
+#define TIMELINE_BUF_SIZE (64 * 1024)
+#define TIMELINE_ROW_MAX 512
+
+static int TIMELINE_FD = -1;
+static unsigned long TIMELINE_START;
+static char TIMELINE_BUF[TIMELINE_BUF_SIZE];
+static size_t TIMELINE_LEN = 0;
+static pthread_mutex_t TIMELINE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+// COLUMNS_HEADER and COLUMNS_FN add columns to the header and every row.
+static const char *COLUMNS_HEADER = "";
+static timeline_columns_fn COLUMNS_FN;
+
+// flush_locked writes the buffered rows to the timeline file. TIMELINE_LOCK
+// must be held.
+static void flush_locked()
+{
+	size_t off = 0;
+	while (off < TIMELINE_LEN) {
+		ssize_t n = write(TIMELINE_FD, TIMELINE_BUF + off,
+				  TIMELINE_LEN - off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			printf("WARN: Failed to write timeline: %s\n",
+			       strerror(errno));
+			break;
+		}
+		off += n;
+	}
+	TIMELINE_LEN = 0;
+}
+
+// Fork handlers make sure a child never inherits rows buffered by the parent
+// or a lock held by another thread.
+static void atfork_prepare()
+{
+	pthread_mutex_lock(&TIMELINE_LOCK);
+	if (TIMELINE_FD != -1)
+		flush_locked();
+}
+
+static void atfork_release()
+{
+	pthread_mutex_unlock(&TIMELINE_LOCK);
+}
+
+// timeline_enabled returns true if a timeline file is being written.
+bool timeline_enabled()
+{
+	return TIMELINE_FD != -1;
+}
+
+// timeline_columns adds the columns named by header, starting with a comma,
+// to the timeline, filled in for every row by fn. It must be called before
+// timeline_open.
+void timeline_columns(const char *header, timeline_columns_fn fn)
+{
+	COLUMNS_HEADER = header;
+	COLUMNS_FN = fn;
+}
+
+// timeline_open creates the timeline file at path and writes its header. Row
+// timestamps are relative to start_ns. It returns 0 on success and -1 on
+// failure.
+int timeline_open(const char *path, unsigned long start_ns)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd == -1) {
+		printf("Failed to open timeline file %s: %s\n", path,
+		       strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&TIMELINE_LOCK);
+	TIMELINE_FD = fd;
+	TIMELINE_START = start_ns;
+	TIMELINE_LEN = snprintf(TIMELINE_BUF, TIMELINE_BUF_SIZE,
+				"time_ns,pid,phase,event,label,size,value%s\n",
+				COLUMNS_HEADER);
+	flush_locked();
+	pthread_mutex_unlock(&TIMELINE_LOCK);
+
+	pthread_atfork(atfork_prepare, atfork_release, atfork_release);
+	return 0;
+}
+
+// timeline_row appends a row to the timeline. For memory operations size is
+// the number of bytes accessed and value is the latency in nanoseconds.
+void timeline_row(unsigned long t_ns, const char *phase, const char *event,
+		  const char *label, unsigned long size, unsigned long value)
+{
+	if (TIMELINE_FD == -1)
+		return;
+
+	pthread_mutex_lock(&TIMELINE_LOCK);
+	if (TIMELINE_LEN + TIMELINE_ROW_MAX > TIMELINE_BUF_SIZE)
+		flush_locked();
+	long t = t_ns >= TIMELINE_START ? t_ns - TIMELINE_START : 0;
+	char *row = TIMELINE_BUF + TIMELINE_LEN;
+	int n = snprintf(row, TIMELINE_ROW_MAX, "%ld,%d,%s,%s,%s,%lu,%lu", t,
+			 getpid(), phase ? phase : "", event, label ? label : "",
+			 size, value);
+	if (n > 0 && n < TIMELINE_ROW_MAX && COLUMNS_FN != NULL)
+		n += COLUMNS_FN(row + n, TIMELINE_ROW_MAX - n);
+	if (n > 0 && n < TIMELINE_ROW_MAX - 1) {
+		row[n++] = '\n';
+		TIMELINE_LEN += n;
+	}
+	pthread_mutex_unlock(&TIMELINE_LOCK);
+}
+
+// timeline_flush writes buffered rows to the timeline file.
+void timeline_flush()
+{
+	if (TIMELINE_FD == -1)
+		return;
+
+	pthread_mutex_lock(&TIMELINE_LOCK);
+	flush_locked();
+	pthread_mutex_unlock(&TIMELINE_LOCK);
+}
+
+// timeline_close flushes and closes the timeline file.
+void timeline_close()
+{
+	if (TIMELINE_FD == -1)
+		return;
+
+	pthread_mutex_lock(&TIMELINE_LOCK);
+	flush_locked();
+	close(TIMELINE_FD);
+	TIMELINE_FD = -1;
+	pthread_mutex_unlock(&TIMELINE_LOCK);
+}
@@ -0,0 +1,35 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// timeline_columns_fn appends extra columns, each starting with a comma, to a
+// row in buf. It returns the number of characters written.
+typedef int (*timeline_columns_fn)(char *buf, size_t size);
+
+bool timeline_enabled(void);
+int timeline_open(const char *path, unsigned long start_ns);
+void timeline_row(unsigned long t_ns, const char *phase, const char *event,
+		  const char *label, unsigned long size, unsigned long value);
+void timeline_columns(const char *header, timeline_columns_fn fn);
+void timeline_flush(void);
+void timeline_close(void);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+#include "bench.h"
+#include "timing.h"
+
+#if HAVE_TSC
+#include <cpuid.h>
+#endif
+
+// TIMER_TOLERANCE is the relative difference between the TSC and
+// CLOCK_MONOTONIC after which the TSC is considered to have jumped or changed
+// frequency.
+#define TIMER_TOLERANCE 0.01
+#define CALIBRATION_NS (100 * 1000 * 1000UL)
+#define RECALIBRATION_NS (10 * 1000 * 1000UL)
+#define OVERHEAD_SAMPLES 10000
+
+const char *CLOCK_SOURCE_STRING[] = {
+	"monotonic",
+	"tsc",
+};
+
+enum ClockSource CLOCK_SOURCE = CLOCK_SOURCE_MONOTONIC;
+double TSC_PER_NS = 1;
+unsigned long TIMER_OVERHEAD_NS = 0;
+
+// REF_TSC and REF_NS are a pair of TSC and CLOCK_MONOTONIC readings the TSC is
+// periodically checked against.
+static unsigned long REF_TSC;
+static unsigned long REF_NS;
+
+// tsc_invariant returns true if the CPU has an invariant TSC, which ticks at a
+// constant rate regardless of frequency scaling and sleep states, and supports
+// rdtscp.
+bool tsc_invariant()
+{
+#if HAVE_TSC
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+	    eax < 0x80000007)
+		return false;
+	__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 27)))
+		return false;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return edx & (1 << 8);
+#else
+	return false;
+#endif
+}
+
+// calibrate returns the number of TSC ticks per nanosecond, measured against
+// CLOCK_MONOTONIC by busy waiting for period_ns.
+static double calibrate(unsigned long period_ns)
+{
+	unsigned long ns = now_ns(), tsc = timer_read();
+	unsigned long end_ns, end_tsc;
+	do {
+		end_tsc = timer_read();
+		end_ns = now_ns();
+	} while (end_ns - ns < period_ns);
+	return (double)(end_tsc - tsc) / (end_ns - ns);
+}
+
+// measure_overhead returns the smallest time measured between two back to
+// back timer reads, which is included in every measured operation.
+static unsigned long measure_overhead()
+{
+	unsigned long best = ULONG_MAX;
+	for (int i = 0; i < OVERHEAD_SAMPLES; i++) {
+		unsigned long start = timer_read();
+		unsigned long stop = timer_read();
+		if (stop - start < best)
+			best = stop - start;
+	}
+	return CLOCK_SOURCE == CLOCK_SOURCE_TSC ? best / TSC_PER_NS : best;
+}
+
+// timer_init selects the clock used to time operations, falling back to
+// CLOCK_MONOTONIC when the TSC can't be used. It returns 0 on success and -1
+// on failure.
+int timer_init(enum ClockSource source)
+{
+	CLOCK_SOURCE = CLOCK_SOURCE_MONOTONIC;
+	TSC_PER_NS = 1;
+	if (source == CLOCK_SOURCE_TSC && !tsc_invariant()) {
+		printf("WARN: No invariant TSC, falling back to CLOCK_MONOTONIC.\n");
+	} else if (source == CLOCK_SOURCE_TSC) {
+		CLOCK_SOURCE = CLOCK_SOURCE_TSC;
+		TSC_PER_NS = calibrate(CALIBRATION_NS);
+		if (!isfinite(TSC_PER_NS) || TSC_PER_NS <= 0) {
+			printf("WARN: TSC calibration failed, falling back to CLOCK_MONOTONIC.\n");
+			CLOCK_SOURCE = CLOCK_SOURCE_MONOTONIC;
+			TSC_PER_NS = 1;
+		}
+		REF_TSC = timer_read();
+		REF_NS = now_ns();
+	}
+	TIMER_OVERHEAD_NS = measure_overhead();
+	return 0;
+}
+
+// timer_elapsed_ns returns the nanoseconds between two timer reads. With the
+// TSC, the timer overhead is subtracted, while CLOCK_MONOTONIC times are
+// returned as measured. bound_ns is the time CLOCK_MONOTONIC measured around
+// both reads; a TSC measurement exceeding it means the TSC jumped, in which
+// case event is set to TIMER_JUMP and bound_ns is used instead.
+long timer_elapsed_ns(unsigned long start, unsigned long stop,
+		      unsigned long bound_ns, int *event)
+{
+	long ns;
+	*event = TIMER_OK;
+	if (CLOCK_SOURCE == CLOCK_SOURCE_TSC) {
+		ns = (stop - start) / TSC_PER_NS;
+		if (stop < start ||
+		    ns > bound_ns * (1 + TIMER_TOLERANCE) + 1000) {
+			*event = TIMER_JUMP;
+			ns = bound_ns;
+			REF_TSC = timer_read();
+			REF_NS = now_ns();
+		}
+		ns -= TIMER_OVERHEAD_NS;
+	} else {
+		ns = stop - start;
+	}
+	return ns > 0 ? ns : 1;
+}
+
+// timer_check compares the TSC with CLOCK_MONOTONIC at most once per second.
+// If they drifted apart, the TSC is recalibrated to tell a jump, such as after
+// moving to another host, from a frequency change, which is then used from
+// now on. It returns the detected event, or TIMER_OK.
+int timer_check()
+{
+	if (CLOCK_SOURCE != CLOCK_SOURCE_TSC)
+		return TIMER_OK;
+
+	unsigned long ns = now_ns();
+	if (ns - REF_NS < NSEC_PER_SEC)
+		return TIMER_OK;
+	unsigned long tsc = timer_read();
+
+	int event = TIMER_OK;
+	double ratio = (double)(tsc - REF_TSC) / (ns - REF_NS) / TSC_PER_NS;
+	if (tsc < REF_TSC || fabs(ratio - 1) > TIMER_TOLERANCE) {
+		double measured = calibrate(RECALIBRATION_NS);
+		if (fabs(measured / TSC_PER_NS - 1) <= TIMER_TOLERANCE) {
+			event = TIMER_JUMP;
+		} else {
+			event = TIMER_FREQ_CHANGE;
+			TSC_PER_NS = measured;
+		}
+		tsc = timer_read();
+		ns = now_ns();
+	}
+	REF_TSC = tsc;
+	REF_NS = ns;
+	return event;
+}
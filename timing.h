@@ -0,0 +1,70 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+// ClockSource is the clock memory operations are timed with.
+enum ClockSource {
+	CLOCK_SOURCE_MONOTONIC,
+	CLOCK_SOURCE_TSC,
+};
+
+extern const char *CLOCK_SOURCE_STRING[];
+extern enum ClockSource CLOCK_SOURCE;
+extern double TSC_PER_NS;
+extern unsigned long TIMER_OVERHEAD_NS;
+
+// timer_read returns the current time in clock ticks. With the TSC, earlier
+// instructions are completed before the counter is read, and later ones don't
+// start before it was read.
+static inline unsigned long timer_read(void)
+{
+#if HAVE_TSC
+	if (CLOCK_SOURCE == CLOCK_SOURCE_TSC) {
+		unsigned int aux;
+		unsigned long t = __rdtscp(&aux);
+		_mm_lfence();
+		return t;
+	}
+#endif
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+int timer_init(enum ClockSource source);
+bool tsc_invariant(void);
+long timer_elapsed_ns(unsigned long start, unsigned long stop,
+		      unsigned long bound_ns, int *event);
+int timer_check(void);
+
+// Events reported by timer_elapsed_ns and timer_check.
+#define TIMER_OK 0
+#define TIMER_JUMP 1
+#define TIMER_FREQ_CHANGE 2
+
+#endif
@@ -0,0 +1,501 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "bench.h"
+#include "affinity.h"
+#include "output.h"
+#include "timeline.h"
+#include "verify.h"
+
+// VERIFY_CHUNK is the part of DATA locked at once, by writes while they update
+// the checksums of its pages and by verifications while they check them.
+// Sampled verifications check whole chunks.
+#define VERIFY_CHUNK (2 * MB)
+// VERIFY_POLL_NS is how often workers check for verification requests.
+#define VERIFY_POLL_NS (100 * 1000000UL)
+// LANES is how many parts of a page are checksummed independently, so the
+// CRC32 instructions of several can be in flight at once.
+#define LANES 4
+
+static struct verify_opts VERIFY;
+static bool VERIFY_ENABLED = false;
+static char *VERIFY_DATA;
+static unsigned long VERIFY_SIZE;
+static unsigned long VERIFY_PAGE;
+// SUMS holds the checksum of every page of DATA, LOCKS a lock for every
+// VERIFY_CHUNK of it.
+static uint32_t *SUMS;
+static pthread_rwlock_t *LOCKS;
+static unsigned long CHUNKS;
+
+static uint32_t CRC_TABLE[256];
+static uint32_t (*page_sum)(const char *page);
+static const char *CRC_IMPL;
+
+static struct verify_stats *STATS;
+static unsigned long RANGE_START;
+static unsigned long RANGE_END;
+static pthread_mutex_t STATS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t VERIFY_TID;
+static bool VERIFY_RUNNING = false;
+static volatile bool VERIFY_STOP = false;
+
+// pass is a checksum computation or verification of a part of DATA, split
+// into chunks between several threads.
+struct pass {
+	unsigned long start;
+	unsigned long end;
+	unsigned long next_chunk;
+	unsigned long run;
+	int sample_pct;
+	// store computes the checksums instead of checking them.
+	bool store;
+	unsigned long pages;
+	unsigned long mismatches;
+};
+
+// crc_sw updates the CRC32C crc with the len bytes at buf using a table.
+static uint32_t crc_sw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		crc = CRC_TABLE[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+// page_sum_sw returns the checksum of page: the CRC32C of the CRC32C of each
+// of its LANES parts.
+static uint32_t page_sum_sw(const char *page)
+{
+	size_t lane = VERIFY_PAGE / LANES;
+	uint32_t crc = ~0U;
+	for (int i = 0; i < LANES; i++) {
+		uint32_t c = ~crc_sw(~0U, (const unsigned char *)page + i * lane,
+				     lane);
+		crc = crc_sw(crc, (const unsigned char *)&c, sizeof(c));
+	}
+	return ~crc;
+}
+
+#if defined(__x86_64__)
+// page_sum_sse42 returns the same checksum as page_sum_sw using the CRC32
+// instruction of SSE4.2, interleaving the lanes to hide its latency.
+__attribute__((target("sse4.2"))) static uint32_t
+page_sum_sse42(const char *page)
+{
+	const uint64_t *w = (const uint64_t *)page;
+	size_t n = VERIFY_PAGE / LANES / sizeof(uint64_t);
+	uint64_t c0 = ~0U, c1 = ~0U, c2 = ~0U, c3 = ~0U;
+	for (size_t i = 0; i < n; i++) {
+		c0 = _mm_crc32_u64(c0, w[i]);
+		c1 = _mm_crc32_u64(c1, w[n + i]);
+		c2 = _mm_crc32_u64(c2, w[2 * n + i]);
+		c3 = _mm_crc32_u64(c3, w[3 * n + i]);
+	}
+	uint32_t crc = ~0U;
+	crc = _mm_crc32_u32(crc, ~(uint32_t)c0);
+	crc = _mm_crc32_u32(crc, ~(uint32_t)c1);
+	crc = _mm_crc32_u32(crc, ~(uint32_t)c2);
+	crc = _mm_crc32_u32(crc, ~(uint32_t)c3);
+	return ~crc;
+}
+#endif
+
+// crc_init selects the fastest checksum implementation for this CPU.
+static void crc_init()
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+		CRC_TABLE[i] = c;
+	}
+	page_sum = page_sum_sw;
+	CRC_IMPL = "software";
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		page_sum = page_sum_sse42;
+		CRC_IMPL = "sse4.2";
+	}
+#endif
+}
+
+// verify_parse parses a verify mode of the form all|<pct>[,threads=<n>]. It
+// returns 0 on success and -1 on failure.
+int verify_parse(const char *arg, struct verify_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->enabled = true;
+	o->sample_pct = 100;
+	o->threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	size_t len = strcspn(arg, ",");
+	char *end = (char *)arg + len;
+	if (len != 3 || strncmp(arg, "all", 3))
+		o->sample_pct = strtol(arg, &end, 10);
+	if (end != arg + len || o->sample_pct < 1 || o->sample_pct > 100) {
+		printf("Invalid verify sample: %.*s.\n", (int)len, arg);
+		return -1;
+	}
+
+	const char *opt = arg + len;
+	while (*opt == ',') {
+		opt++;
+		size_t n = strcspn(opt, ",");
+		end = (char *)opt + n;
+		if (!strncmp(opt, "threads=", 8))
+			o->threads = strtol(opt + 8, &end, 10);
+		else
+			end = NULL;
+		if (end != opt + n) {
+			printf("Invalid verify option: %.*s.\n", (int)n, opt);
+			return -1;
+		}
+		opt += n;
+	}
+
+	if (o->threads < 1) {
+		printf("Invalid verify threads: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// sampled returns whether chunk is checked by run.
+static bool sampled(const struct pass *p, unsigned long chunk)
+{
+	if (p->sample_pct >= 100)
+		return true;
+	unsigned long h = (chunk + 1) * 0x9e3779b97f4a7c15UL ^ p->run;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9UL;
+	h ^= h >> 32;
+	return h % 100 < (unsigned long)p->sample_pct;
+}
+
+// mismatch reports a page whose checksum changed without being written.
+static void mismatch(struct pass *p, unsigned long offset, uint32_t expected,
+		     uint32_t sum)
+{
+	pthread_mutex_lock(&STATS_LOCK);
+	if (p->mismatches < VERIFY_MAX_MISMATCHES)
+		printf("[%d] Verify: page at offset %#lx changed, checksum %08x instead of %08x.\n",
+		       getpid(), offset, sum, expected);
+	if (STATS->mismatches < VERIFY_MAX_MISMATCHES)
+		STATS->mismatch_offset[STATS->mismatches] = offset;
+	STATS->mismatches++;
+	p->mismatches++;
+	pthread_mutex_unlock(&STATS_LOCK);
+}
+
+// spread_thread lets a pass thread run on the auxiliary CPUs, or on any CPU
+// rather than only the one of the worker that started it.
+static void spread_thread()
+{
+	if (AUX_CPUS.count > 0) {
+		pin_aux_thread();
+		return;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int cpu = 0; cpu < cpus && cpu < CPU_SETSIZE; cpu++)
+		CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *pass_loop(void *arg)
+{
+	struct pass *p = arg;
+	spread_thread();
+
+	unsigned long pages = 0, chunk;
+	unsigned long last = (p->end - 1) / VERIFY_CHUNK;
+	while ((chunk = __sync_fetch_and_add(&p->next_chunk, 1)) <= last) {
+		if (!sampled(p, chunk))
+			continue;
+		unsigned long start = chunk * VERIFY_CHUNK;
+		unsigned long end = start + VERIFY_CHUNK;
+		if (start < p->start)
+			start = p->start;
+		if (end > p->end)
+			end = p->end;
+
+		if (!p->store)
+			pthread_rwlock_rdlock(&LOCKS[chunk]);
+		for (unsigned long o = start; o < end; o += VERIFY_PAGE) {
+			uint32_t sum = page_sum(VERIFY_DATA + o);
+			unsigned long page = o / VERIFY_PAGE;
+			if (p->store)
+				SUMS[page] = sum;
+			else if (sum != SUMS[page])
+				mismatch(p, o, SUMS[page], sum);
+			pages++;
+		}
+		if (!p->store)
+			pthread_rwlock_unlock(&LOCKS[chunk]);
+	}
+	__sync_fetch_and_add(&p->pages, pages);
+	return NULL;
+}
+
+// run_pass runs p on VERIFY.threads threads, or on the calling one if they
+// can't be started.
+static void run_pass(struct pass *p)
+{
+	p->next_chunk = p->start / VERIFY_CHUNK;
+	pthread_t *tids = calloc(VERIFY.threads, sizeof(pthread_t));
+	int started = 0;
+	while (tids != NULL && started < VERIFY.threads &&
+	       pthread_create(&tids[started], NULL, pass_loop, p) == 0)
+		started++;
+	if (started == 0)
+		pass_loop(p);
+	for (int i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+// verify_setup computes the checksum of every page of the size bytes of data
+// in parallel. It returns 0 on success and -1 on failure.
+int verify_setup(const struct verify_opts *o, void *data, unsigned long size)
+{
+	VERIFY = *o;
+	VERIFY_DATA = data;
+	VERIFY_SIZE = size;
+	VERIFY_PAGE = sysconf(_SC_PAGESIZE);
+	CHUNKS = (size + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+	SUMS = malloc(size / VERIFY_PAGE * sizeof(uint32_t));
+	LOCKS = malloc(CHUNKS * sizeof(pthread_rwlock_t));
+	if (SUMS == NULL || LOCKS == NULL) {
+		printf("Failed to allocate page checksums.\n");
+		verify_free();
+		return -1;
+	}
+	for (unsigned long i = 0; i < CHUNKS; i++)
+		pthread_rwlock_init(&LOCKS[i], NULL);
+	crc_init();
+
+	struct pass p = {
+		.start = 0,
+		.end = size,
+		.sample_pct = 100,
+		.store = true,
+	};
+	unsigned long start = now_ns();
+	run_pass(&p);
+	unsigned long took = now_ns() - start;
+	printf("Checksummed %.3f GB in %.3f s (%.2f GB/s, %s, %d threads).\n",
+	       size / (double)GB, took / (double)NSEC_PER_SEC,
+	       size / (double)GB / (took / (double)NSEC_PER_SEC), CRC_IMPL,
+	       VERIFY.threads);
+	VERIFY_ENABLED = true;
+	return 0;
+}
+
+// verify_lock keeps the pages of DATA being written from being verified until
+// their checksums are updated.
+void verify_lock(unsigned long offset, unsigned long size)
+{
+	if (!VERIFY_ENABLED || size == 0)
+		return;
+
+	for (unsigned long c = offset / VERIFY_CHUNK;
+	     c <= (offset + size - 1) / VERIFY_CHUNK; c++)
+		pthread_rwlock_wrlock(&LOCKS[c]);
+}
+
+// verify_update computes the checksums of the pages of DATA that were written.
+void verify_update(unsigned long offset, unsigned long size)
+{
+	if (!VERIFY_ENABLED || size == 0)
+		return;
+
+	for (unsigned long p = offset / VERIFY_PAGE;
+	     p <= (offset + size - 1) / VERIFY_PAGE; p++)
+		SUMS[p] = page_sum(VERIFY_DATA + p * VERIFY_PAGE);
+}
+
+void verify_unlock(unsigned long offset, unsigned long size)
+{
+	if (!VERIFY_ENABLED || size == 0)
+		return;
+
+	for (unsigned long c = offset / VERIFY_CHUNK;
+	     c <= (offset + size - 1) / VERIFY_CHUNK; c++)
+		pthread_rwlock_unlock(&LOCKS[c]);
+}
+
+// verify_request asks every worker to verify its data. It is async-signal
+// safe. It returns 0 on success and -1 if verification isn't enabled.
+int verify_request()
+{
+	if (!VERIFY_ENABLED || SHARED == NULL)
+		return -1;
+	__sync_fetch_and_add(&SHARED->verify_requests, 1);
+	return 0;
+}
+
+// verify runs a verification of the data of the worker.
+static void verify(unsigned long run)
+{
+	struct pass p = {
+		.start = RANGE_START,
+		.end = RANGE_END,
+		.run = run,
+		.sample_pct = VERIFY.sample_pct,
+	};
+	unsigned long start = now_ns();
+	run_pass(&p);
+	unsigned long took = now_ns() - start;
+
+	pthread_mutex_lock(&STATS_LOCK);
+	STATS->runs++;
+	STATS->pages += p.pages;
+	STATS->last_bytes = p.pages * VERIFY_PAGE;
+	STATS->last_ns = took;
+	pthread_mutex_unlock(&STATS_LOCK);
+
+	const char *phase = SCENARIO.phases[SHARED->workers[0].phase].name;
+	timeline_row(start, phase, "verify", p.mismatches ? "mismatch" : "ok",
+		     p.pages * VERIFY_PAGE, took);
+	printf("[%d] Verified %.3f GB in %.3f s (%.2f GB/s), %lu mismatches.\n",
+	       getpid(), p.pages * VERIFY_PAGE / (double)GB,
+	       took / (double)NSEC_PER_SEC,
+	       p.pages * VERIFY_PAGE / (double)GB /
+		       (took / (double)NSEC_PER_SEC),
+	       p.mismatches);
+	fflush(stdout);
+}
+
+static void *verify_loop(void *arg)
+{
+	pin_aux_thread();
+	// SIGUSR2 requests are handled here, where they can only cut polling
+	// short.
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR2);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	struct timespec poll = { .tv_nsec = VERIFY_POLL_NS };
+	unsigned long seen = 0;
+	while (!VERIFY_STOP) {
+		unsigned long requests = SHARED->verify_requests;
+		if (requests == seen) {
+			nanosleep(&poll, NULL);
+			continue;
+		}
+		seen = requests;
+		verify(seen);
+	}
+	return NULL;
+}
+
+// verify_start verifies the size bytes of DATA at offset accessed by a worker
+// in a background thread whenever requested, recording the results in s. It
+// returns 0 on success and -1 on failure.
+int verify_start(struct verify_stats *s, unsigned long offset,
+		 unsigned long size)
+{
+	if (!VERIFY_ENABLED)
+		return 0;
+
+	STATS = s;
+	RANGE_START = offset / VERIFY_PAGE * VERIFY_PAGE;
+	RANGE_END = (offset + size + VERIFY_PAGE - 1) / VERIFY_PAGE *
+		    VERIFY_PAGE;
+	if (RANGE_END > VERIFY_SIZE)
+		RANGE_END = VERIFY_SIZE;
+	VERIFY_STOP = false;
+	if (pthread_create(&VERIFY_TID, NULL, verify_loop, NULL)) {
+		printf("Failed to start verify thread.\n");
+		return -1;
+	}
+	VERIFY_RUNNING = true;
+	return 0;
+}
+
+// verify_stop stops the background verifications once the one in progress is
+// done.
+void verify_stop()
+{
+	if (!VERIFY_RUNNING)
+		return;
+
+	VERIFY_STOP = true;
+	pthread_join(VERIFY_TID, NULL);
+	VERIFY_RUNNING = false;
+}
+
+// verify_report prints the results of the verifications of a worker.
+void verify_report(pid_t pid, const struct verify_stats *s)
+{
+	printf("[%d] Verify: %lu runs, %lu pages checked, %lu mismatches.\n",
+	       pid, s->runs, s->pages, s->mismatches);
+	if (s->runs > 0)
+		printf("[%d] Last verification: %.3f GB in %.3f s (%.2f GB/s).\n",
+		       pid, s->last_bytes / (double)GB,
+		       s->last_ns / (double)NSEC_PER_SEC,
+		       s->last_bytes / (double)GB /
+			       (s->last_ns / (double)NSEC_PER_SEC));
+	for (unsigned long i = 0;
+	     i < s->mismatches && i < VERIFY_MAX_MISMATCHES; i++)
+		printf("[%d]   Mismatch at offset %#lx\n", pid,
+		       s->mismatch_offset[i]);
+}
+
+// verify_json writes s to fp as a JSON object.
+void verify_json(FILE *fp, const struct verify_stats *s)
+{
+	fprintf(fp,
+		"{\"runs\":%lu,\"pages\":%lu,\"mismatches\":%lu,"
+		"\"mismatch_offsets\":[",
+		s->runs, s->pages, s->mismatches);
+	for (unsigned long i = 0;
+	     i < s->mismatches && i < VERIFY_MAX_MISMATCHES; i++)
+		fprintf(fp, "%s%lu", i ? "," : "", s->mismatch_offset[i]);
+	fprintf(fp, "],\"last_bytes\":%lu,\"last_ns\":%lu}", s->last_bytes,
+		s->last_ns);
+}
+
+// verify_free releases the page checksums.
+void verify_free()
+{
+	if (LOCKS != NULL) {
+		for (unsigned long i = 0; i < CHUNKS; i++)
+			pthread_rwlock_destroy(&LOCKS[i]);
+	}
+	free(SUMS);
+	free(LOCKS);
+	SUMS = NULL;
+	LOCKS = NULL;
+	VERIFY_ENABLED = false;
+}
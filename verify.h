@@ -0,0 +1,62 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// VERIFY_MAX_MISMATCHES is how many mismatching page offsets are kept.
+#define VERIFY_MAX_MISMATCHES 16
+
+// verify_opts describe how DATA is checked for corruption. Checksums of every
+// page are computed once it is loaded, and sample_pct is the percentage of it
+// checked by every later verification.
+struct verify_opts {
+	bool enabled;
+	int sample_pct;
+	int threads;
+};
+
+// verify_stats are the results of the verifications of a worker.
+struct verify_stats {
+	unsigned long runs;
+	unsigned long pages;
+	unsigned long mismatches;
+	unsigned long mismatch_offset[VERIFY_MAX_MISMATCHES];
+	// last_bytes and last_ns are how much data the last verification
+	// checked and how long it took.
+	unsigned long last_bytes;
+	unsigned long last_ns;
+};
+
+int verify_parse(const char *arg, struct verify_opts *o);
+int verify_setup(const struct verify_opts *o, void *data,
+		 unsigned long size);
+int verify_start(struct verify_stats *s, unsigned long offset,
+		 unsigned long size);
+void verify_lock(unsigned long offset, unsigned long size);
+void verify_update(unsigned long offset, unsigned long size);
+void verify_unlock(unsigned long offset, unsigned long size);
+int verify_request(void);
+void verify_stop(void);
+void verify_report(pid_t pid, const struct verify_stats *s);
+void verify_json(FILE *fp, const struct verify_stats *s);
+void verify_free(void);
+
+#endif
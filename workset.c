@@ -0,0 +1,322 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "affinity.h"
+#include "bench.h"
+#include "env.h"
+#include "placement.h"
+#include "workset.h"
+#include "timeline.h"
+
+// WORKSET_STEP_NS is how often the working set follows its curve.
+#define WORKSET_STEP_NS (100 * 1000000UL)
+
+const char *CURVE_STRING[] = {
+	"ramp",
+	"sawtooth",
+	"step",
+};
+
+const char *SHRINK_STRING[] = {
+	"dontneed",
+	"free",
+	"munmap",
+};
+
+static struct workset_opts WS;
+static struct workset_stats *STATS;
+static char *WS_BASE;
+// WS_NODE is the node the working set is placed on, or -1 if interleaved.
+static int WS_NODE;
+static unsigned long WS_MAX;
+// WS_SIZE is the current size of the working set. Operations hold WS_LOCK for
+// reading while they access it, so it can only shrink between operations.
+static unsigned long WS_SIZE;
+static pthread_rwlock_t WS_LOCK = PTHREAD_RWLOCK_INITIALIZER;
+
+static pthread_t WS_TID;
+static bool WS_RUNNING = false;
+static volatile bool WS_STOP = false;
+
+// workset_parse parses a working set of the form
+// <ramp|sawtooth|step>[,min=<pct>][,max=<pct>][,period=<s>]
+// [,dontneed|,free|,munmap]. It returns 0 on success and -1 on failure.
+int workset_parse(const char *arg, struct workset_opts *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->enabled = true;
+	o->min_pct = 10;
+	o->max_pct = 100;
+	o->period = 60;
+
+	size_t len = strcspn(arg, ",");
+	int curve = option_match(arg, len, CURVE_STRING, 3);
+	if (curve == -1) {
+		printf("Invalid working set curve: %.*s.\n", (int)len, arg);
+		return -1;
+	}
+	o->curve = curve;
+
+	const char *opt = arg + len;
+	while (*opt == ',') {
+		opt++;
+		size_t n = strcspn(opt, ",");
+		char *end = (char *)opt + n;
+		int shrink = option_match(opt, n, SHRINK_STRING, 3);
+		if (shrink != -1)
+			o->shrink = shrink;
+		else if (!strncmp(opt, "min=", 4))
+			o->min_pct = strtol(opt + 4, &end, 10);
+		else if (!strncmp(opt, "max=", 4))
+			o->max_pct = strtol(opt + 4, &end, 10);
+		else if (!strncmp(opt, "period=", 7))
+			o->period = strtol(opt + 7, &end, 10);
+		else
+			end = NULL;
+		if (end != opt + n) {
+			printf("Invalid working set option: %.*s.\n", (int)n,
+			       opt);
+			return -1;
+		}
+		opt += n;
+	}
+
+	if (o->min_pct < 1 || o->min_pct > o->max_pct || o->max_pct > 100 ||
+	    o->period < 1) {
+		printf("Invalid working set: %s.\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// target returns the size the working set should have elapsed_ns after the
+// start, rounded down to a page.
+static unsigned long target(unsigned long elapsed_ns)
+{
+	double period_ns = WS.period * (double)NSEC_PER_SEC;
+	double t = fmod(elapsed_ns, period_ns) / period_ns;
+	double f;
+	switch (WS.curve) {
+	case CURVE_RAMP:
+		f = t < 0.5 ? 2 * t : 2 * (1 - t);
+		break;
+	case CURVE_SAWTOOTH:
+		f = t;
+		break;
+	default:
+		f = t < 0.5 ? 1 : 0;
+	}
+
+	long page = sysconf(_SC_PAGESIZE);
+	double pct = WS.min_pct + (WS.max_pct - WS.min_pct) * f;
+	unsigned long size = (unsigned long)(WS_MAX * pct / 100) / page * page;
+	return size < page ? page : size;
+}
+
+// grow maps, if needed, and touches the memory between the current size of
+// the working set and size before making it accessible.
+static void grow(unsigned long size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = now_ns();
+	char *from = WS_BASE + WS_SIZE;
+	// A new mapping loses the placement of the data, which has to be set
+	// again before the pages are touched from the auxiliary CPUs.
+	if (WS.shrink == SHRINK_MUNMAP &&
+	    (mmap(from, size - WS_SIZE, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+		  0) == MAP_FAILED ||
+	     placement_range(from, size - WS_SIZE, WS_NODE))) {
+		if (STATS->grows == 0)
+			printf("WARN: Failed to grow the working set: %s\n",
+			       strerror(errno));
+		return;
+	}
+	for (char *p = from; p < WS_BASE + size; p += page)
+		*(volatile char *)p = 1;
+	hist_record(&STATS->grow_latency, now_ns() - start);
+	STATS->grows++;
+
+	pthread_rwlock_wrlock(&WS_LOCK);
+	WS_SIZE = size;
+	pthread_rwlock_unlock(&WS_LOCK);
+}
+
+// shrink makes the working set inaccessible past size, then releases that
+// memory.
+static void shrink(unsigned long size)
+{
+	pthread_rwlock_wrlock(&WS_LOCK);
+	unsigned long prev = WS_SIZE;
+	WS_SIZE = size;
+	pthread_rwlock_unlock(&WS_LOCK);
+
+	unsigned long start = now_ns();
+	int ret;
+	switch (WS.shrink) {
+	case SHRINK_FREE:
+		ret = madvise(WS_BASE + size, prev - size, MADV_FREE);
+		break;
+	case SHRINK_MUNMAP:
+		// Replace the memory with an inaccessible mapping instead of
+		// leaving a hole, so no other mapping can land in the middle
+		// of the data before it grows again.
+		ret = mmap(WS_BASE + size, prev - size, PROT_NONE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED |
+				   MAP_NORESERVE,
+			   -1, 0) == MAP_FAILED;
+		break;
+	default:
+		ret = madvise(WS_BASE + size, prev - size, MADV_DONTNEED);
+	}
+	if (ret && STATS->shrinks == 0)
+		printf("WARN: Failed to release working set memory: %s\n",
+		       strerror(errno));
+	hist_record(&STATS->shrink_latency, now_ns() - start);
+	STATS->shrinks++;
+}
+
+// workset_loop resizes the working set to follow its curve, recording the
+// resident set size whenever it changes and at least every second.
+static void *workset_loop(void *arg)
+{
+	pin_aux_thread();
+	struct timespec step = { .tv_nsec = WORKSET_STEP_NS };
+	unsigned long start = now_ns();
+	unsigned long next_sample = start;
+
+	while (!WS_STOP) {
+		unsigned long now = now_ns();
+		unsigned long size = target(now - start);
+		bool changed = size != WS_SIZE;
+		if (size > WS_SIZE)
+			grow(size);
+		else if (size < WS_SIZE)
+			shrink(size);
+
+		STATS->size = WS_SIZE;
+		if (WS_SIZE > STATS->peak_size)
+			STATS->peak_size = WS_SIZE;
+		if (changed || now >= next_sample) {
+			unsigned long rss = resident_bytes();
+			if (rss > STATS->peak_rss)
+				STATS->peak_rss = rss;
+			timeline_row(now, NULL, "working_set", NULL, WS_SIZE,
+				     rss);
+			timeline_row(now, NULL, "rss_peak", NULL, WS_SIZE,
+				     STATS->peak_rss);
+			next_sample = now + NSEC_PER_SEC;
+		}
+		nanosleep(&step, NULL);
+	}
+	return NULL;
+}
+
+// workset_start makes the size bytes of data at base, placed on node or
+// interleaved if it is -1, follow the curve of o, recording results in s. It
+// returns 0 on success and -1 on failure.
+int workset_start(const struct workset_opts *o, struct workset_stats *s,
+		  char *base, unsigned long size, int node)
+{
+	WS = *o;
+	STATS = s;
+	WS_BASE = base;
+	WS_NODE = node;
+	WS_MAX = size;
+	WS_SIZE = size;
+	WS_STOP = false;
+	if (pthread_create(&WS_TID, NULL, workset_loop, NULL)) {
+		printf("Failed to start working set thread.\n");
+		return -1;
+	}
+	WS_RUNNING = true;
+	printf("[%d] Working set follows a %ds %s between %d%% and %d%% of %.3f GB, released with %s.\n",
+	       getpid(), WS.period, CURVE_STRING[WS.curve], WS.min_pct,
+	       WS.max_pct, size / (double)GB, SHRINK_STRING[WS.shrink]);
+	return 0;
+}
+
+// workset_lock prevents the working set from shrinking and returns its size,
+// or size if the working set is fixed.
+unsigned long workset_lock(unsigned long size)
+{
+	if (!WS_RUNNING)
+		return size;
+	pthread_rwlock_rdlock(&WS_LOCK);
+	return WS_SIZE;
+}
+
+// workset_unlock lets the working set shrink again.
+void workset_unlock()
+{
+	if (WS_RUNNING)
+		pthread_rwlock_unlock(&WS_LOCK);
+}
+
+// workset_stop stops resizing the working set. Unmapped memory is mapped
+// again so the data is whole for the rest of the run.
+void workset_stop()
+{
+	if (!WS_RUNNING)
+		return;
+
+	WS_STOP = true;
+	pthread_join(WS_TID, NULL);
+	WS_RUNNING = false;
+	if (WS.shrink == SHRINK_MUNMAP && WS_SIZE < WS_MAX &&
+	    mmap(WS_BASE + WS_SIZE, WS_MAX - WS_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+		placement_range(WS_BASE + WS_SIZE, WS_MAX - WS_SIZE, WS_NODE);
+}
+
+// workset_report prints the results of the working set.
+void workset_report(pid_t pid, const struct workset_stats *s)
+{
+	printf("[%d] Working set: %.3f GB, %.3f GB at peak, %lu grows, %lu shrinks, peak RSS %.3f GB.\n",
+	       pid, s->size / (double)GB, s->peak_size / (double)GB, s->grows,
+	       s->shrinks, s->peak_rss / (double)GB);
+	const struct hist *h[] = { &s->grow_latency, &s->shrink_latency };
+	const char *name[] = { "Grow", "Shrink" };
+	for (int i = 0; i < 2; i++) {
+		printf("[%d] %s latency: p50 %.2f ns, p99 %.2f ns, max %lu ns.\n",
+		       pid, name[i], hist_percentile(h[i], 50),
+		       hist_percentile(h[i], 99), h[i]->max);
+	}
+}
+
+// workset_json writes s to fp as a JSON object.
+void workset_json(FILE *fp, const struct workset_stats *s)
+{
+	fprintf(fp,
+		"{\"size_bytes\":%lu,\"peak_size_bytes\":%lu,"
+		"\"peak_rss_bytes\":%lu,\"grows\":%lu,\"shrinks\":%lu,"
+		"\"grow_latency_ns\":",
+		s->size, s->peak_size, s->peak_rss, s->grows, s->shrinks);
+	hist_json(fp, &s->grow_latency);
+	fprintf(fp, ",\"shrink_latency_ns\":");
+	hist_json(fp, &s->shrink_latency);
+	fprintf(fp, "}");
+}
@@ -0,0 +1,82 @@
+/*
+	Copyright 2024 Loophole Labs
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		   http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#ifndef WORKSET_H
+#define WORKSET_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "hist.h"
+
+// Curve is the shape the working set follows over every period.
+enum Curve {
+	// CURVE_RAMP grows linearly from the minimum to the maximum over half
+	// a period and shrinks back over the other half.
+	CURVE_RAMP,
+	// CURVE_SAWTOOTH grows linearly over the period, then drops back to
+	// the minimum at once.
+	CURVE_SAWTOOTH,
+	// CURVE_STEP stays at the maximum for half a period and at the
+	// minimum for the other half.
+	CURVE_STEP,
+};
+
+// Shrink is how memory leaving the working set is released.
+enum Shrink {
+	SHRINK_DONTNEED,
+	SHRINK_FREE,
+	SHRINK_MUNMAP,
+};
+
+extern const char *CURVE_STRING[];
+extern const char *SHRINK_STRING[];
+
+// workset_opts describe how the part of the data a worker accesses changes
+// over time, as percentages of its data.
+struct workset_opts {
+	bool enabled;
+	enum Curve curve;
+	enum Shrink shrink;
+	int min_pct;
+	int max_pct;
+	int period;
+};
+
+// workset_stats are the results of the working set of a worker.
+struct workset_stats {
+	unsigned long size;
+	unsigned long peak_size;
+	unsigned long peak_rss;
+	unsigned long grows;
+	unsigned long shrinks;
+	// grow_latency is how long mapping and touching new memory took,
+	// shrink_latency releasing it.
+	struct hist grow_latency;
+	struct hist shrink_latency;
+};
+
+int workset_parse(const char *arg, struct workset_opts *o);
+int workset_start(const struct workset_opts *o, struct workset_stats *s,
+		  char *base, unsigned long size, int node);
+unsigned long workset_lock(unsigned long size);
+void workset_unlock(void);
+void workset_stop(void);
+void workset_report(pid_t pid, const struct workset_stats *s);
+void workset_json(FILE *fp, const struct workset_stats *s);
+
+#endif